@@ -0,0 +1,26 @@
+$Matrix multiplication over one dimensional arrays.
+begin
+    const n = 100; const size = 10000;
+    Integer array A, B, C[size];
+    Integer i, j, k, sum, check;
+    
+    i := 1;
+    do ~(i > size) -> A[i], B[i], C[i] := i \ 7, i \ 11, 0; i := i + 1; od;
+    i := 0;
+    do i < n ->
+        j := 0;
+        do j < n ->
+            k, sum := 0, 0;
+            do k < n ->
+                sum := sum + A[i * n + k + 1] * B[k * n + j + 1];
+                k := k + 1;
+            od;
+            C[i * n + j + 1] := sum;
+            j := j + 1;
+        od;
+        i := i + 1;
+    od;
+    i, check := 1, 0;
+    do ~(i > size) -> check := (check + C[i]) \ 1000003; i := i + 1; od;
+    write check;
+end.
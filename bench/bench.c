@@ -0,0 +1,373 @@
+/* Throughput benchmarks of the scanner, the parser and the interpreter.
+   Usage: bench [-c commit] [-o results.json] [-p] <program>...
+   -p also reads the hardware counters of every phase where the system offers them.
+   The results are written as JSON so that runs of different commits can be compared. */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "code.h"
+#include "counters.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "profile.h"
+#include "regvm.h"
+#include "scanner.h"
+
+#define MIN_TIME 0.2
+#define RUNS 3
+
+typedef struct {
+    const char *path;
+    long tokens;
+    double scanTime;
+    int statements;
+    double parseTime;
+    int codeLength;
+    int codeInstructions;
+    long long instructions;
+    double runTime;
+    int regCodeInstructions;
+    long long regInstructions;
+    double regRunTime;
+    Counts scanCounts;
+    Counts parseCounts;
+    Counts translateCounts;
+    Counts runCounts;
+    Counts regRunCounts;
+    bool ok;
+} Result;
+
+/* NULL unless -p is given and at least one counter could be opened */
+static Counters *counters;
+
+static void startPhase() {
+    if (counters) {
+        startCounters(counters);
+    }
+}
+
+static void endPhase(Counts *counts, int passes) {
+    if (counters) {
+        stopCounters(counters, counts);
+        divideCounts(counts, passes);
+    }
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static char *readSource(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long srcLen = ftell(f);
+    rewind(f);
+    char *src = malloc(srcLen + 1);
+    size_t last = fread(src, 1, srcLen, f);
+    src[last] = '\0';
+    fclose(f);
+    return src;
+}
+
+/* Program output is not part of the measurement */
+static int silenceStdout() {
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    return saved;
+}
+
+static void restoreStdout(int saved) {
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+}
+
+static void benchScan(Result *result, char *src) {
+    int passes = 0;
+    startPhase();
+    double start = now();
+    double elapsed;
+    do {
+        Scanner scanner;
+        initScan(&scanner, src, stderr);
+        long tokens = 0;
+        while (scanNext(&scanner).type != T_EOF) {
+            tokens++;
+        }
+        cleanScan(&scanner);
+        result->tokens = tokens;
+        passes++;
+        elapsed = now() - start;
+    } while (elapsed < MIN_TIME);
+    endPhase(&result->scanCounts, passes);
+    result->scanTime = elapsed / passes;
+}
+
+static bool benchParse(Result *result, char *src) {
+    int passes = 0;
+    double start = now();
+    double elapsed;
+    bool ok;
+    startPhase();
+    do {
+        Parser parser;
+        initParser(&parser, src, stderr);
+        ok = parse(&parser);
+        result->statements = parser.statementCount;
+        result->codeLength = parser.code.length;
+        cleanParser(&parser);
+        passes++;
+        elapsed = now() - start;
+    } while (ok && elapsed < MIN_TIME);
+    endPhase(&result->parseCounts, passes);
+    result->parseTime = elapsed / passes;
+    return ok;
+}
+
+static void benchRun(Result *result, char *src) {
+    Parser parser;
+    initParser(&parser, src, stderr);
+    parse(&parser);
+    if (!loadProgram(&parser.code)) {
+        cleanParser(&parser);
+        return;
+    }
+    int saved = silenceStdout();
+    Profile profile;
+    initProfile(&profile, parser.code.length);
+    profileProgram(&profile);
+    result->instructions = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        result->instructions += profile.opCounts[op];
+    }
+    cleanProfile(&profile);
+    
+    result->codeInstructions = 0;
+    for (int pc = 0; pc < parser.code.length; pc += getOpLength(parser.code.words[pc])) {
+        result->codeInstructions++;
+    }
+    
+    /* The counts are those of the fastest run */
+    result->runTime = 0;
+    for (int i = 0; i < RUNS; i++) {
+        Counts counts;
+        startPhase();
+        double start = now();
+        runProgram();
+        double elapsed = now() - start;
+        endPhase(&counts, 1);
+        if (i == 0 || elapsed < result->runTime) {
+            result->runTime = elapsed;
+            result->runCounts = counts;
+        }
+    }
+    
+    RegCode regCode;
+    initRegCode(&regCode);
+    startPhase();
+    bool translated = translateCode(&parser.code, &regCode) && loadRegisters(&regCode);
+    endPhase(&result->translateCounts, 1);
+    if (translated) {
+        result->regCodeInstructions = regCode.length / 4;
+        result->regInstructions = countRegisters();
+        for (int i = 0; i < RUNS; i++) {
+            Counts counts;
+            startPhase();
+            double start = now();
+            runRegisters();
+            double elapsed = now() - start;
+            endPhase(&counts, 1);
+            if (i == 0 || elapsed < result->regRunTime) {
+                result->regRunTime = elapsed;
+                result->regRunCounts = counts;
+            }
+        }
+    }
+    cleanRegCode(&regCode);
+    restoreStdout(saved);
+    cleanParser(&parser);
+}
+
+static double getRatio(long long count, long long per) {
+    return count < 0 || per <= 0 ? 0 : (double)count / per;
+}
+
+static void printCounts(const Result *r) {
+    fprintf(stderr, "%-16s IPC %5.2f scan %5.2f parse %5.2f stack %5.2f register, "
+        "branch misses per instruction %6.4f stack %6.4f register\n", "",
+        getRatio(r->scanCounts.values[COUNT_INSTRUCTIONS], r->scanCounts.values[COUNT_CYCLES]),
+        getRatio(r->parseCounts.values[COUNT_INSTRUCTIONS], r->parseCounts.values[COUNT_CYCLES]),
+        getRatio(r->runCounts.values[COUNT_INSTRUCTIONS], r->runCounts.values[COUNT_CYCLES]),
+        getRatio(r->regRunCounts.values[COUNT_INSTRUCTIONS], r->regRunCounts.values[COUNT_CYCLES]),
+        getRatio(r->runCounts.values[COUNT_BRANCH_MISSES], r->instructions),
+        getRatio(r->regRunCounts.values[COUNT_BRANCH_MISSES], r->regInstructions));
+}
+
+static void writeCount(FILE *f, const char *name, long long count) {
+    if (count < 0) {
+        fprintf(f, "\"%s\": null", name);
+    } else {
+        fprintf(f, "\"%s\": %lld", name, count);
+    }
+}
+
+static void writeRatio(FILE *f, const char *name, long long count, long long per) {
+    if (count < 0 || per <= 0) {
+        fprintf(f, "\"%s\": null", name);
+    } else {
+        fprintf(f, "\"%s\": %.4f", name, (double)count / per);
+    }
+}
+
+/* The counts of one phase, their instructions per cycle and, for the runs, the misses per
+   executed machine instruction */
+static void writeCounts(FILE *f, const char *phase, const Counts *counts, long long vmInstructions,
+        bool isLast) {
+    fprintf(f, "       \"%s\": {", phase);
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        writeCount(f, getCountName(kind), counts->values[kind]);
+        fprintf(f, ", ");
+    }
+    writeRatio(f, "ipc", counts->values[COUNT_INSTRUCTIONS], counts->values[COUNT_CYCLES]);
+    if (vmInstructions >= 0) {
+        fprintf(f, ", ");
+        writeRatio(f, "instructions_per_vm_instruction", counts->values[COUNT_INSTRUCTIONS],
+            vmInstructions);
+        fprintf(f, ", ");
+        writeRatio(f, "branch_misses_per_vm_instruction", counts->values[COUNT_BRANCH_MISSES],
+            vmInstructions);
+        fprintf(f, ", ");
+        writeRatio(f, "l1d_misses_per_vm_instruction", counts->values[COUNT_L1D_MISSES],
+            vmInstructions);
+        fprintf(f, ", ");
+        writeRatio(f, "llc_misses_per_vm_instruction", counts->values[COUNT_LLC_MISSES],
+            vmInstructions);
+    }
+    fprintf(f, "}%s\n", isLast ? "" : ",");
+}
+
+static void writeResults(FILE *f, const char *commit, Result *results, int count) {
+    fprintf(f, "{\n  \"commit\": \"%s\",\n  \"timestamp\": %ld,\n  \"benchmarks\": [\n",
+        commit, (long)time(NULL));
+    for (int i = 0; i < count; i++) {
+        Result *r = &results[i];
+        const char *name = strrchr(r->path, '/') ? strrchr(r->path, '/') + 1 : r->path;
+        fprintf(f, "    {\"name\": \"%s\", \"ok\": %s,\n", name, r->ok ? "true" : "false");
+        fprintf(f, "     \"tokens\": %ld, \"scan_seconds\": %.6f, \"tokens_per_sec\": %.0f,\n",
+            r->tokens, r->scanTime, r->scanTime > 0 ? r->tokens / r->scanTime : 0);
+        fprintf(f, "     \"statements\": %d, \"parse_seconds\": %.6f, \"statements_per_sec\": %.0f,\n",
+            r->statements, r->parseTime, r->parseTime > 0 ? r->statements / r->parseTime : 0);
+        fprintf(f, "     \"code_words\": %d, \"instructions\": %lld, \"run_seconds\": %.6f, "
+            "\"instructions_per_sec\": %.0f,\n", r->codeLength, r->instructions, r->runTime,
+            r->runTime > 0 ? r->instructions / r->runTime : 0);
+        fprintf(f, "     \"code_instructions_per_statement\": %.2f, "
+            "\"register_code_instructions_per_statement\": %.2f,\n",
+            r->statements ? (double)r->codeInstructions / r->statements : 0,
+            r->statements ? (double)r->regCodeInstructions / r->statements : 0);
+        fprintf(f, "     \"register_instructions\": %lld, \"register_run_seconds\": %.6f",
+            r->regInstructions, r->regRunTime);
+        if (counters) {
+            fprintf(f, ",\n     \"counters\": {\n");
+            writeCounts(f, "scan", &r->scanCounts, -1, false);
+            writeCounts(f, "parse", &r->parseCounts, -1, false);
+            writeCounts(f, "translate", &r->translateCounts, -1, false);
+            writeCounts(f, "run", &r->runCounts, r->instructions, false);
+            writeCounts(f, "register_run", &r->regRunCounts, r->regInstructions, true);
+            fprintf(f, "     }");
+        }
+        fprintf(f, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    const char *commit = "unknown";
+    const char *output = NULL;
+    bool useCounters = false;
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (!strcmp(argv[first], "-p")) {
+            useCounters = true;
+            first++;
+        } else if (first + 1 < argc && !strcmp(argv[first], "-c")) {
+            commit = argv[first + 1];
+            first += 2;
+        } else if (first + 1 < argc && !strcmp(argv[first], "-o")) {
+            output = argv[first + 1];
+            first += 2;
+        } else {
+            break;
+        }
+    }
+    if (first >= argc) {
+        fprintf(stderr, "Usage: %s [-c commit] [-o results.json] [-p] <program>...\n", argv[0]);
+        return 1;
+    }
+    
+    Counters threadCounters;
+    if (useCounters) {
+        if (openCounters(&threadCounters)) {
+            counters = &threadCounters;
+        } else {
+            fprintf(stderr, "Hardware counters are not available, measuring time only\n");
+        }
+    }
+    
+    int count = argc - first;
+    Result *results = calloc(count, sizeof(Result));
+    for (int i = 0; i < count; i++) {
+        Result *result = &results[i];
+        result->path = argv[first + i];
+        clearCounts(&result->scanCounts);
+        clearCounts(&result->parseCounts);
+        clearCounts(&result->translateCounts);
+        clearCounts(&result->runCounts);
+        clearCounts(&result->regRunCounts);
+        char *src = readSource(result->path);
+        if (!src) {
+            fprintf(stderr, "Cannot open '%s'\n", result->path);
+            continue;
+        }
+        benchScan(result, src);
+        result->ok = benchParse(result, src);
+        if (result->ok) {
+            benchRun(result, src);
+        }
+        fprintf(stderr, "%-16s %12.0f tokens/s %12.0f statements/s %14.0f instructions/s"
+            " %8.3f s stack %8.3f s register\n",
+            result->path, result->tokens / result->scanTime, result->statements / result->parseTime,
+            result->runTime > 0 ? result->instructions / result->runTime : 0,
+            result->runTime, result->regRunTime);
+        if (counters) {
+            printCounts(result);
+        }
+        free(src);
+    }
+    
+    FILE *f = output ? fopen(output, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Cannot write '%s'\n", output);
+        return 1;
+    }
+    writeResults(f, commit, results, count);
+    if (output) {
+        fclose(f);
+    }
+    if (counters) {
+        closeCounters(counters);
+    }
+    free(results);
+    return 0;
+}
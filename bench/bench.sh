@@ -0,0 +1,13 @@
+#!/bin/sh
+# Builds the benchmark harness with the compiler and interpreter sources and runs
+# it over the benchmark programs. Usage: bench/bench.sh [results.json]
+set -e
+dir=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$dir")
+out=${1:-$dir/results.json}
+sources=$(ls "$root"/*.c | grep -v '/main\.c$')
+
+${CC:-gcc} -std=c11 -O2 -I"$root" -o "$dir/bench" "$dir/bench.c" "$dir/counters.c" $sources -lpthread
+commit=$(git -C "$root" rev-parse --short HEAD 2>/dev/null || echo unknown)
+"$dir/bench" -p -c "$commit" -o "$out" "$dir"/*.pl
+echo "Results written to $out"
@@ -0,0 +1,23 @@
+$Whole array copy and fill: 2000 rounds over arrays of 50000 elements, with the element loops
+$they replace for comparison.
+begin
+    const n = 50000; const rounds = 2000;
+    Integer array A[n]; Integer array B[n];
+    Integer i, r, sum;
+    
+    i := 1;
+    do ~(i > n) -> B[i] := i; i := i + 1; od;
+    r := 0;
+    do r < rounds -> A := 0; A := B; r := r + 1; od;
+    r := 0;
+    do r < rounds / 100 ->
+        i := 1;
+        do ~(i > n) -> A[i] := 0; i := i + 1; od;
+        i := 1;
+        do ~(i > n) -> A[i] := B[i]; i := i + 1; od;
+        r := r + 1;
+    od;
+    i, sum := 1, 0;
+    do ~(i > n) -> sum := (sum + A[i]) \ 65536; i := i + 1; od;
+    write sum;
+end.
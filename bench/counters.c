@@ -0,0 +1,122 @@
+/* Hardware performance counters read through perf_event_open. Where the system has none (other
+   kernels, virtual machines, perf_event_paranoid) every counter reads as unavailable. */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+static const char *countNames[COUNT_KINDS] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses"
+};
+
+#ifdef __linux__
+static int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define CACHE_READ_MISSES(cache) \
+    ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+/* Opens every counter on its own rather than as a group, so that a processor short of counters
+   multiplexes them instead of failing the group */
+bool openCounters(Counters *counters) {
+    counters->fds[COUNT_CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counters->fds[COUNT_INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters->fds[COUNT_BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    counters->fds[COUNT_L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE,
+        CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D));
+    counters->fds[COUNT_LLC_MISSES] = openCounter(PERF_TYPE_HW_CACHE,
+        CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_LL));
+    bool any = false;
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        any |= counters->fds[kind] >= 0;
+    }
+    return any;
+}
+
+void startCounters(Counters *counters) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        if (counters->fds[kind] >= 0) {
+            ioctl(counters->fds[kind], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[kind], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/* A multiplexed counter is scaled by the share of the phase it was running */
+void stopCounters(Counters *counters, Counts *counts) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        if (counters->fds[kind] >= 0) {
+            ioctl(counters->fds[kind], PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        uint64_t values[3];
+        counts->values[kind] = -1;
+        if (counters->fds[kind] >= 0 && read(counters->fds[kind], values, sizeof(values)) ==
+                sizeof(values) && values[2] > 0) {
+            counts->values[kind] = (long long)((double)values[0] * values[1] / values[2]);
+        }
+    }
+}
+#else
+bool openCounters(Counters *counters) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        counters->fds[kind] = -1;
+    }
+    return false;
+}
+
+void startCounters(Counters *counters) {
+    (void)counters;
+}
+
+void stopCounters(Counters *counters, Counts *counts) {
+    (void)counters;
+    clearCounts(counts);
+}
+#endif
+
+void closeCounters(Counters *counters) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        if (counters->fds[kind] >= 0) {
+            close(counters->fds[kind]);
+        }
+        counters->fds[kind] = -1;
+    }
+}
+
+void divideCounts(Counts *counts, int passes) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        if (counts->values[kind] > 0) {
+            counts->values[kind] /= passes;
+        }
+    }
+}
+
+void clearCounts(Counts *counts) {
+    for (int kind = 0; kind < COUNT_KINDS; kind++) {
+        counts->values[kind] = -1;
+    }
+}
+
+const char *getCountName(CountKind kind) {
+    return countNames[kind];
+}
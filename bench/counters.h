@@ -0,0 +1,35 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdbool.h>
+
+typedef enum {
+    COUNT_CYCLES,
+    COUNT_INSTRUCTIONS,
+    COUNT_BRANCH_MISSES,
+    COUNT_L1D_MISSES,
+    COUNT_LLC_MISSES,
+    COUNT_KINDS
+} CountKind;
+
+/* Hardware counters of the calling thread and the threads it starts, user mode only.
+   fds[kind] is -1 when the processor or the kernel does not offer that counter. */
+typedef struct {
+    int fds[COUNT_KINDS];
+} Counters;
+
+/* Events counted over one measured phase, -1 for a counter that was not available or never
+   scheduled */
+typedef struct {
+    long long values[COUNT_KINDS];
+} Counts;
+
+bool openCounters(Counters *counters);
+void closeCounters(Counters *counters);
+void startCounters(Counters *counters);
+void stopCounters(Counters *counters, Counts *counts);
+void divideCounts(Counts *counts, int passes);
+void clearCounts(Counts *counts);
+const char *getCountName(CountKind kind);
+
+#endif
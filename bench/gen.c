@@ -0,0 +1,36 @@
+/* Writes a generated program to standard output.
+   Usage: gen [-s seed] [-n names] [-p procs] [-d depth] [-l list] [-e terms] [-t statements] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generator.h"
+
+int main(int argc, char *argv[]) {
+    Shape shape;
+    defaultShape(&shape);
+    for (int i = 1; i + 1 < argc; i += 2) {
+        int value = atoi(argv[i + 1]);
+        if (!strcmp(argv[i], "-s")) {
+            shape.seed = value;
+        } else if (!strcmp(argv[i], "-n")) {
+            shape.names = value;
+        } else if (!strcmp(argv[i], "-p")) {
+            shape.procs = value;
+        } else if (!strcmp(argv[i], "-d")) {
+            shape.depth = value;
+        } else if (!strcmp(argv[i], "-l")) {
+            shape.listLength = value;
+        } else if (!strcmp(argv[i], "-e")) {
+            shape.exprTerms = value;
+        } else if (!strcmp(argv[i], "-t")) {
+            shape.statements = value;
+        } else {
+            fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    char *program = generateProgram(&shape);
+    fputs(program, stdout);
+    free(program);
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "generator.h"
+
+#define TERMS_PER_LINE 12
+
+typedef struct {
+    char *start;
+    size_t length;
+    size_t capacity;
+    unsigned random;
+    const Shape *shape;
+    int names;
+} Text;
+
+static void append(Text *text, const char *format, ...) {
+    va_list args;
+    while (true) {
+        va_start(args, format);
+        size_t room = text->capacity - text->length;
+        int written = vsnprintf(text->start + text->length, room, format, args);
+        va_end(args);
+        if ((size_t)written < room) {
+            text->length += written;
+            return;
+        }
+        text->capacity *= 2;
+        text->start = realloc(text->start, text->capacity);
+    }
+}
+
+/* Linear congruential generator, so that a seed gives the same program everywhere */
+static int nextRandom(Text *text, int range) {
+    text->random = text->random * 1103515245 + 12345;
+    return (text->random >> 8) % range;
+}
+
+static void indent(Text *text, int level) {
+    append(text, "%*s", 4 * level, "");
+}
+
+static void appendOperand(Text *text) {
+    if (nextRandom(text, 4) == 0) {
+        append(text, "%d", nextRandom(text, 1000));
+    } else {
+        append(text, "v%d", nextRandom(text, text->names));
+    }
+}
+
+/* Sum of terms, where some terms are parenthesized products */
+static void appendExpression(Text *text, int terms, int level) {
+    static const char *ops[] = {" + ", " - ", " * "};
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) {
+            append(text, "%s", ops[nextRandom(text, 3)]);
+            if (i % TERMS_PER_LINE == 0) {
+                append(text, "\n");
+                indent(text, level + 1);
+            }
+        }
+        if (i + 1 < terms && nextRandom(text, 8) == 0) {
+            append(text, "(");
+            appendOperand(text);
+            append(text, " - ");
+            appendOperand(text);
+            append(text, ")");
+            i++;
+        } else {
+            appendOperand(text);
+        }
+    }
+}
+
+static void appendStatement(Text *text, int level) {
+    int target = nextRandom(text, text->names);
+    int terms = text->shape->exprTerms;
+    switch (nextRandom(text, 4)) {
+        case 0:
+            indent(text, level);
+            append(text, "if v%d < v%d -> v%d := ", target, nextRandom(text, text->names), target);
+            appendExpression(text, terms, level);
+            append(text, ";\n");
+            indent(text, level);
+            append(text, "[] ~(v%d < v%d) -> skip;\n", target, nextRandom(text, text->names));
+            indent(text, level);
+            append(text, "fi;\n");
+            break;
+        case 1:
+            indent(text, level);
+            append(text, "do v%d < %d -> v%d := v%d + 1; od;\n",
+                target, nextRandom(text, 100), target, target);
+            break;
+        case 2:
+            indent(text, level);
+            append(text, "write ");
+            appendExpression(text, terms, level);
+            append(text, ";\n");
+            break;
+        default:
+            indent(text, level);
+            append(text, "v%d := ", target);
+            appendExpression(text, terms, level);
+            append(text, ";\n");
+            break;
+    }
+}
+
+static void appendMultipleAssignment(Text *text, int level) {
+    int count = text->shape->listLength;
+    indent(text, level);
+    for (int i = 0; i < count; i++) {
+        append(text, i + 1 < count ? "v%d, " : "v%d", i);
+        if ((i + 1) % TERMS_PER_LINE == 0) {
+            append(text, "\n");
+            indent(text, level + 1);
+        }
+    }
+    append(text, " := ");
+    for (int i = 0; i < count; i++) {
+        appendOperand(text);
+        append(text, i + 1 < count ? ", " : ";\n");
+        if ((i + 1) % TERMS_PER_LINE == 0) {
+            append(text, "\n");
+            indent(text, level + 1);
+        }
+    }
+}
+
+/* A chain of procedures, each defined inside the previous one and calling the next */
+static void appendProcedure(Text *text, int chain, int link, int length, int level) {
+    indent(text, level);
+    append(text, "proc p%dx%d\n", chain, link);
+    indent(text, level);
+    append(text, "begin\n");
+    indent(text, level + 1);
+    append(text, "Integer l%d;\n", link);
+    if (link + 1 < length) {
+        appendProcedure(text, chain, link + 1, length, level + 1);
+    }
+    indent(text, level + 1);
+    append(text, "l%d := v%d;\n", link, nextRandom(text, text->names));
+    for (int i = 0; i < text->shape->statements; i++) {
+        appendStatement(text, level + 1);
+    }
+    if (link + 1 < length) {
+        indent(text, level + 1);
+        append(text, "call p%dx%d;\n", chain, link + 1);
+    }
+    indent(text, level);
+    append(text, "end;\n");
+}
+
+void defaultShape(Shape *shape) {
+    shape->seed = 1;
+    shape->names = 100;
+    shape->procs = 16;
+    shape->depth = 4;
+    shape->listLength = 10;
+    shape->exprTerms = 8;
+    shape->statements = 4;
+}
+
+/* Returns the text of a valid program of the given shape; the caller frees it */
+char *generateProgram(const Shape *shape) {
+    Text text = {.capacity = 4096, .random = shape->seed, .shape = shape};
+    text.start = malloc(text.capacity);
+    text.start[0] = '\0';
+    text.names = shape->names > shape->listLength ? shape->names : shape->listLength;
+    if (text.names < 1) {
+        text.names = 1;
+    }
+    int depth = shape->depth < 1 ? 1 : shape->depth;
+    
+    append(&text, "$Generated program, seed %u\nbegin\n", shape->seed);
+    for (int i = 0; i < text.names; i++) {
+        if (i % TERMS_PER_LINE == 0) {
+            append(&text, "    Integer ");
+        }
+        bool last = i + 1 == text.names || (i + 1) % TERMS_PER_LINE == 0;
+        append(&text, last ? "v%d;\n" : "v%d, ", i);
+    }
+    int chains = (shape->procs + depth - 1) / depth;
+    for (int chain = 0; chain < chains; chain++) {
+        int length = shape->procs - chain * depth < depth ? shape->procs - chain * depth : depth;
+        appendProcedure(&text, chain, 0, length, 1);
+    }
+    if (shape->listLength > 1) {
+        appendMultipleAssignment(&text, 1);
+    }
+    for (int i = 0; i < shape->statements; i++) {
+        appendStatement(&text, 1);
+    }
+    for (int chain = 0; chain < chains; chain++) {
+        append(&text, "    call p%dx0;\n", chain);
+    }
+    append(&text, "end.\n");
+    return text.start;
+}
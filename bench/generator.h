@@ -0,0 +1,18 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+/* Shape of a generated program. Every parameter scales one part of the compiler input. */
+typedef struct {
+    unsigned seed;
+    int names;      /* Integer variables of the program block */
+    int procs;      /* procedures in total */
+    int depth;      /* nesting depth of the procedure chains */
+    int listLength; /* targets of one multiple assignment */
+    int exprTerms;  /* operands of one expression */
+    int statements; /* statements of the program body and of every procedure */
+} Shape;
+
+void defaultShape(Shape *shape);
+char *generateProgram(const Shape *shape);
+
+#endif
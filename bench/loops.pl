@@ -0,0 +1,16 @@
+$Tight counting loops: one guard with each comparison, a negated guard and two guards
+$taking turns. 11000001 iterations in all.
+begin
+    const n = 2000000;
+    Integer i, j, sum;
+    
+    i, sum := 0, 0;
+    do i < n -> i := i + 1; od;
+    do i > 0 -> i := i - 1; od;
+    do ~(i = n) -> sum := sum + 1; i := i + 1; od;
+    i, j := 0, 0;
+    do i < n -> i := i + 1; [] j < n -> j := j + 1; od;
+    i := 0;
+    do i = n -> i := n + 1; [] i < n -> i := i + 2; od;
+    write sum, i, j;
+end.
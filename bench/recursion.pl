@@ -0,0 +1,33 @@
+$Recursive Fibonacci in a nested procedure reaching its argument and
+$result through the static chain.
+begin
+    Integer total, round;
+    
+    proc Outer
+    begin
+        Integer n, r;
+        
+        proc Fib
+        begin
+            Integer k, a;
+            if n < 2 -> r := n;
+            [] ~(n < 2) ->
+                k := n;
+                n := k - 1;
+                call Fib;
+                a := r;
+                n := k - 2;
+                call Fib;
+                r := a + r;
+            fi;
+        end;
+        
+        n := 24;
+        call Fib;
+        total := total + r;
+    end;
+    
+    total, round := 0, 0;
+    do round < 5 -> call Outer; round := round + 1; od;
+    write total;
+end.
@@ -0,0 +1,140 @@
+/* Compile time and peak memory of generated programs against the size of each shape parameter.
+   Usage: scale [-s seed] [-o report.txt]
+   Every compilation runs in a child process, so its peak memory is measured alone and a crash
+   is reported instead of ending the run. */
+#define _POSIX_C_SOURCE 200809L
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "generator.h"
+#include "parser.h"
+
+typedef struct {
+    const char *name;
+    size_t field;
+    int first;
+    int steps;
+} Sweep;
+
+typedef struct {
+    double seconds;
+    long peakKb;
+    bool ok;
+} Measure;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static long maxRss() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool compileChild(char *src, Measure *measure) {
+    int channel[2];
+    if (pipe(channel)) {
+        return false;
+    }
+    pid_t child = fork();
+    if (child == 0) {
+        close(channel[0]);
+        FILE *log = fopen("/dev/null", "w");
+        long before = maxRss();
+        double start = now();
+        Parser parser;
+        initParser(&parser, src, log);
+        Measure result = {.ok = parse(&parser)};
+        cleanParser(&parser);
+        result.seconds = now() - start;
+        result.peakKb = maxRss() - before;
+        ssize_t written = write(channel[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(channel[1]);
+    ssize_t got = read(channel[0], measure, sizeof(*measure));
+    close(channel[0]);
+    int status;
+    waitpid(child, &status, 0);
+    return got == sizeof(*measure) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void runSweep(FILE *f, Shape *base, Sweep *sweep) {
+    fprintf(f, "\n%s\n%10s %12s %12s %12s %10s\n", sweep->name,
+        "value", "source KB", "compile ms", "peak KB", "exponent");
+    Shape shape = *base;
+    double lastSeconds = 0;
+    int lastValue = 0;
+    for (int step = 0; step < sweep->steps; step++) {
+        int value = sweep->first << step;
+        *(int*)((char*)&shape + sweep->field) = value;
+        char *src = generateProgram(&shape);
+        Measure measure;
+        if (!compileChild(src, &measure)) {
+            fprintf(f, "%10d %12zu %12s\n", value, strlen(src) / 1024, "crashed");
+            free(src);
+            break;
+        }
+        fprintf(f, "%10d %12zu %12.1f %12ld", value, strlen(src) / 1024,
+            measure.seconds * 1000, measure.peakKb);
+        if (step > 0 && lastSeconds > 0) {
+            fprintf(f, " %10.2f", log(measure.seconds / lastSeconds) / log((double)value / lastValue));
+        }
+        fprintf(f, "%s\n", measure.ok ? "" : "  (compile errors)");
+        fflush(f);
+        lastSeconds = measure.seconds;
+        lastValue = value;
+        free(src);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Shape base;
+    defaultShape(&base);
+    const char *output = NULL;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "-s")) {
+            base.seed = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "-o")) {
+            output = argv[i + 1];
+        }
+    }
+    FILE *f = output ? fopen(output, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Cannot write '%s'\n", output);
+        return 1;
+    }
+    
+    /* Procedures nest at most MAX_LEVEL - 2 deep inside the program block */
+    Sweep sweeps[] = {
+        {"names (Integer variables of the program block)", offsetof(Shape, names), 3125, 6},
+        {"procs (procedures in chains of depth 4)", offsetof(Shape, procs), 500, 6},
+        {"depth (nesting of 256 procedures)", offsetof(Shape, depth), 1, 4},
+        {"list (targets of one multiple assignment)", offsetof(Shape, listLength), 2000, 6},
+        {"terms (operands per expression)", offsetof(Shape, exprTerms), 2000, 6},
+    };
+    fprintf(f, "Scaling of the compiler, seed %u. The exponent is the slope of log time against\n"
+        "log value between successive rows: 1 is linear, 2 quadratic.\n", base.seed);
+    fprintf(f, "Base shape: names %d, procs %d, depth %d, list %d, terms %d, statements %d\n",
+        base.names, base.procs, base.depth, base.listLength, base.exprTerms, base.statements);
+    for (size_t i = 0; i < sizeof(sweeps) / sizeof(sweeps[0]); i++) {
+        Shape shape = base;
+        if (sweeps[i].field == offsetof(Shape, depth)) {
+            shape.procs = 256;
+        }
+        runSweep(f, &shape, &sweeps[i]);
+    }
+    if (output) {
+        fclose(f);
+    }
+    return 0;
+}
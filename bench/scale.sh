@@ -0,0 +1,13 @@
+#!/bin/sh
+# Builds the program generator and the scaling harness and writes the scaling report.
+# Usage: bench/scale.sh [report.txt] [seed]
+set -e
+dir=$(cd "$(dirname "$0")" && pwd)
+root=$(dirname "$dir")
+out=${1:-$dir/scaling.txt}
+sources=$(ls "$root"/*.c | grep -v '/main\.c$')
+
+${CC:-gcc} -std=c11 -O2 -o "$dir/gen" "$dir/gen.c" "$dir/generator.c"
+${CC:-gcc} -std=c11 -O2 -I"$root" -o "$dir/scale" "$dir/scale.c" "$dir/generator.c" $sources -lm -lpthread
+"$dir/scale" -s "${2:-1}" -o "$out"
+echo "Report written to $out"
@@ -0,0 +1,39 @@
+$Linear search (test2.txt) at scale: a pseudo random table is
+$searched for a sequence of pseudo random keys.
+begin
+    const n = 10000; const queries = 2000;
+    Integer array A[n];
+    Integer x, i, q, seed, hits; Boolean found;
+    
+    proc Random
+    begin
+        seed := (seed * 1103 + 12345) \ 65536;
+    end;
+    
+    proc Search
+    begin
+        Integer m;
+        i, m := 1, n;
+        do i < m ->
+            if A[i] = x -> m := i;[]
+               ~(A[i] = x) -> i := i+1;
+            fi;
+        od;
+        found := A[i] = x;
+    end;
+    
+    seed := 1;
+    i := 1;
+    do ~(i > n) -> call Random; A[i] := seed; i := i+1; od;
+    q, hits := 0, 0;
+    do q < queries ->
+        call Random;
+        x := seed;
+        call Search;
+        if found -> hits := hits + 1; []
+           ~found -> skip;
+        fi;
+        q := q + 1;
+    od;
+    write hits;
+end.
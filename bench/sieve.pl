@@ -0,0 +1,24 @@
+$Sieve of Eratosthenes over a Boolean flag table, repeated.
+begin
+    const n = 200000; const rounds = 5;
+    Boolean array composite[n];
+    Integer i, j, count, round;
+    
+    round := 0;
+    do round < rounds ->
+        i := 1;
+        do ~(i > n) -> composite[i] := false; i := i + 1; od;
+        i, count := 2, 0;
+        do ~(i > n) ->
+            if ~composite[i] ->
+                count := count + 1;
+                j := i + i;
+                do ~(j > n) -> composite[j] := true; j := j + i; od;
+            [] composite[i] -> skip;
+            fi;
+            i := i + 1;
+        od;
+        round := round + 1;
+    od;
+    write count;
+end.
@@ -0,0 +1,46 @@
+$Quicksort of a pseudo random table. The recursion keeps its bounds in
+$procedure locals.
+begin
+    const n = 50000;
+    Integer array A[n];
+    Integer i, seed, lo, hi, sorted;
+    
+    proc Random
+    begin
+        seed := (seed * 1103 + 12345) \ 65536;
+    end;
+    
+    proc Sort
+    begin
+        Integer l, h, p, j, t;
+        l, h := lo, hi;
+        if l < h ->
+            p, j := A[h], l;
+            i := l;
+            do i < h ->
+                if A[i] < p -> t := A[i]; A[i] := A[j]; A[j] := t; j := j + 1; []
+                   ~(A[i] < p) -> skip;
+                fi;
+                i := i + 1;
+            od;
+            A[h] := A[j]; A[j] := p;
+            lo, hi := l, j - 1;
+            call Sort;
+            lo, hi := j + 1, h;
+            call Sort;
+        [] ~(l < h) -> skip;
+        fi;
+    end;
+    
+    seed := 7;
+    i := 1;
+    do ~(i > n) -> call Random; A[i] := seed; i := i + 1; od;
+    lo, hi := 1, n;
+    call Sort;
+    i, sorted := 1, 0;
+    do i < n ->
+        if A[i] > A[i+1] -> skip; [] ~(A[i] > A[i+1]) -> sorted := sorted + 1; fi;
+        i := i + 1;
+    od;
+    write sorted + 1, A[1], A[n];
+end.
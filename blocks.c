@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "blocks.h"
+#include "memory.h"
+
+void initBlockCache(BlockCache *cache) {
+    cache->blocks = NULL;
+    cache->count = 0;
+    cache->index = NULL;
+    cache->indexSize = 0;
+    cache->fresh = NULL;
+    cache->freshCount = 0;
+    cache->freshCapacity = 0;
+    cache->reused = 0;
+    cache->compiled = 0;
+}
+
+/* The parser hands out the parts of a block from its counted memory */
+void freeBlock(CachedBlock *block) {
+    for (int i = 0; i < block->procCount; i++) {
+        memFree(block->procs[i].name);
+    }
+    for (int i = 0; i < block->calleeCount; i++) {
+        memFree(block->callees[i].spelling);
+    }
+    for (int i = 0; i < block->accessCount; i++) {
+        memFree(block->accesses[i].spelling);
+    }
+    memFree(block->text);
+    memFree(block->words);
+    memFree(block->lines);
+    memFree(block->procs);
+    memFree(block->spaces);
+    memFree(block->callees);
+    memFree(block->calls);
+    memFree(block->accesses);
+    memFree(block);
+}
+
+void cleanBlockCache(BlockCache *cache) {
+    for (int i = 0; i < cache->freshCount; i++) {
+        if (!cache->fresh[i]->isKept) {
+            freeBlock(cache->fresh[i]);
+        }
+    }
+    for (int i = 0; i < cache->count; i++) {
+        freeBlock(cache->blocks[i]);
+    }
+    free(cache->blocks);
+    free(cache->index);
+    free(cache->fresh);
+    initBlockCache(cache);
+}
+
+static bool isNameChar(char ch) {
+    return ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9');
+}
+
+/* The source must continue with the text of the block, and its "end" must not run on into a
+   longer name */
+CachedBlock *findBlock(BlockCache *cache, uint64_t context, const char *source) {
+    if (cache->indexSize == 0) {
+        return NULL;
+    }
+    int mask = cache->indexSize - 1;
+    for (int slot = context & mask; cache->index[slot]; slot = (slot + 1) & mask) {
+        CachedBlock *block = cache->index[slot];
+        if (block->context == context && !block->isKept
+                && !strncmp(source, block->text, block->textLength)
+                && !isNameChar(source[block->textLength])) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+void addBlock(BlockCache *cache, CachedBlock *block) {
+    if (cache->freshCount >= cache->freshCapacity) {
+        cache->freshCapacity = cache->freshCapacity ? 2 * cache->freshCapacity : 64;
+        cache->fresh = realloc(cache->fresh, cache->freshCapacity * sizeof(CachedBlock*));
+    }
+    cache->fresh[cache->freshCount++] = block;
+}
+
+/* Moves a reused block, and the blocks nested in it, to the running compilation. The blocks of
+   the previous compilation are sorted by base, so the nested ones follow the block. */
+void keepBlock(BlockCache *cache, CachedBlock *block, int base) {
+    int low = 0;
+    int high = cache->count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (cache->blocks[mid]->base < block->base) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    int shift = base - block->base;
+    int end = block->base + block->length;
+    for (int i = low; i < cache->count && cache->blocks[i]->base < end; i++) {
+        CachedBlock *nested = cache->blocks[i];
+        if (!nested->isKept) {
+            nested->isKept = true;
+            nested->newBase = nested->base + shift;
+            addBlock(cache, nested);
+        }
+    }
+}
+
+static int compareBases(const void *a, const void *b) {
+    const CachedBlock *x = *(CachedBlock* const*)a;
+    const CachedBlock *y = *(CachedBlock* const*)b;
+    return x->base - y->base;
+}
+
+/* The blocks of a successful compilation replace those of the previous one. A failed one is
+   forgotten, so that the next compilation reuses what compiled before the error. */
+void finishBlocks(BlockCache *cache, bool success) {
+    for (int i = 0; i < cache->freshCount; i++) {
+        CachedBlock *block = cache->fresh[i];
+        if (block->isKept && success) {
+            block->base = block->newBase;
+        } else if (!block->isKept && !success) {
+            freeBlock(block);
+        }
+    }
+    if (success) {
+        for (int i = 0; i < cache->count; i++) {
+            if (!cache->blocks[i]->isKept) {
+                freeBlock(cache->blocks[i]);
+            }
+        }
+        free(cache->blocks);
+        cache->blocks = cache->fresh;
+        cache->count = cache->freshCount;
+    } else {
+        free(cache->fresh);
+    }
+    cache->fresh = NULL;
+    cache->freshCount = 0;
+    cache->freshCapacity = 0;
+    for (int i = 0; i < cache->count; i++) {
+        cache->blocks[i]->isKept = false;
+    }
+    if (cache->count > 0) {
+        qsort(cache->blocks, cache->count, sizeof(CachedBlock*), compareBases);
+    }
+    
+    free(cache->index);
+    cache->indexSize = 16;
+    while (cache->indexSize < 2 * cache->count) {
+        cache->indexSize *= 2;
+    }
+    cache->index = calloc(cache->indexSize, sizeof(CachedBlock*));
+    int mask = cache->indexSize - 1;
+    for (int i = 0; i < cache->count; i++) {
+        int slot = cache->blocks[i]->context & mask;
+        while (cache->index[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        cache->index[slot] = cache->blocks[i];
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "code.h"
+#include "scope.h"
+
+/* Start of a run of code from one source line. pc is counted from the start of the block and
+   line from the line of its "begin". */
+typedef struct {
+    int pc;
+    int line;
+} LineRun;
+
+/* A procedure outside the block that the block calls or inlines, found again by its name and
+   level. An inlined procedure must still have the same signature and relative line, a called
+   one must still be too big to inline. */
+typedef struct {
+    char *spelling;
+    int level;
+    bool isInlined;
+    uint64_t signature;
+    int line;
+} Callee;
+
+/* CALL whose operand at offset addresses callees[callee] */
+typedef struct {
+    int offset;
+    int callee;
+} CallSite;
+
+/* An access to an object outside the block that its statements or those of the procedures in
+   it make, found again by the spelling and level of the object. The input and output have no
+   spelling and the levels -1 and -2. via is counted from the start of the block, -1 for the
+   statements of the block. Accesses through calls of callees are left to the callees. */
+typedef struct {
+    char *spelling;
+    int level;
+    AccessKind kind;
+    int via;
+} BlockAccess;
+
+/* A compiled procedure block: the source text after its "begin" up to and including its "end",
+   compiled in a scope with the given hash into the code from PROC to ENDPROC at wordsBase.
+   base is its address in the last compilation and newBase its address in the running one
+   once it is reused. The blocks of spaces are counted from the start of the block. */
+typedef struct {
+    uint64_t context;
+    uint64_t signature;
+    char *text;
+    int textLength;
+    int32_t *words;
+    int length;
+    int wordsBase;
+    int base;
+    int newBase;
+    int endLine;
+    int statementCount;
+    LineRun *lines;
+    int lineCount;
+    ProcEntry *procs;
+    int procCount;
+    FrameSpace *spaces;
+    int spaceCount;
+    Callee *callees;
+    int calleeCount;
+    CallSite *calls;
+    int callCount;
+    BlockAccess *accesses;
+    int accessCount;
+    bool isKept;
+} CachedBlock;
+
+/* Blocks of the previous compilation of a file, and those of the running one */
+typedef struct BlockCache {
+    CachedBlock **blocks;
+    int count;
+    CachedBlock **index;
+    int indexSize;
+    CachedBlock **fresh;
+    int freshCount;
+    int freshCapacity;
+    int reused;
+    int compiled;
+} BlockCache;
+
+void initBlockCache(BlockCache *cache);
+void cleanBlockCache(BlockCache *cache);
+CachedBlock *findBlock(BlockCache *cache, uint64_t context, const char *source);
+void keepBlock(BlockCache *cache, CachedBlock *block, int base);
+void addBlock(BlockCache *cache, CachedBlock *block);
+void freeBlock(CachedBlock *block);
+void finishBlocks(BlockCache *cache, bool success);
+
+#endif
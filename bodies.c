@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include "bodies.h"
+#include "scanner.h"
+
+/* Finds the procedure blocks of the program block by balancing "begin" and "end", without
+   parsing anything else */
+void initBodyQueue(BodyQueue *queue, char *source, FILE *log, int inlineLimit) {
+    queue->source = source;
+    queue->log = log;
+    queue->inlineLimit = inlineLimit;
+    queue->bodies = NULL;
+    queue->count = 0;
+    queue->next = 0;
+    mtx_init(&queue->lock, mtx_plain);
+    cnd_init(&queue->done);
+    
+    Scanner scanner;
+    initScan(&scanner, source, log);
+    scanner.skipNames = true;
+    int capacity = 0;
+    int depth = 0;
+    bool isProc = false;
+    Body body = {.text = NULL};
+    for (Symbol sym = scanNext(&scanner); sym.type != T_EOF; sym = scanNext(&scanner)) {
+        if (sym.type == T_PROC) {
+            isProc = (depth == 1);
+        } else if (sym.type == T_BEGIN) {
+            depth++;
+            if (depth == 2 && isProc) {
+                body = (Body){.text = scanner.source, .line = scanner.symLine};
+            }
+            isProc = false;
+        } else if (sym.type == T_END) {
+            if (depth == 2 && body.text) {
+                body.length = scanner.source - body.text;
+                body.endLine = scanner.symLine;
+                if (queue->count >= capacity) {
+                    capacity = capacity ? 2 * capacity : 64;
+                    queue->bodies = realloc(queue->bodies, capacity * sizeof(Body));
+                }
+                queue->bodies[queue->count++] = body;
+                body.text = NULL;
+            }
+            depth--;
+        }
+    }
+    cleanScan(&scanner);
+}
+
+void cleanBodyQueue(BodyQueue *queue) {
+    for (int i = 0; i < queue->count; i++) {
+        if (queue->bodies[i].block) {
+            freeBlock(queue->bodies[i].block);
+        }
+    }
+    free(queue->bodies);
+    mtx_destroy(&queue->lock);
+    cnd_destroy(&queue->done);
+}
+
+/* Returns the body whose text starts at text, -1 if none does */
+int findBody(const BodyQueue *queue, const char *text) {
+    int low = 0;
+    int high = queue->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (queue->bodies[mid].text == text) {
+            return mid;
+        } else if (queue->bodies[mid].text < text) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/* Returns the next body to compile, count once all are taken */
+int claimBody(BodyQueue *queue) {
+    mtx_lock(&queue->lock);
+    int body = queue->next < queue->count ? queue->next++ : queue->count;
+    mtx_unlock(&queue->lock);
+    return body;
+}
+
+void finishBody(BodyQueue *queue, int body, CachedBlock *block) {
+    mtx_lock(&queue->lock);
+    queue->bodies[body].block = block;
+    queue->bodies[body].isDone = true;
+    cnd_broadcast(&queue->done);
+    mtx_unlock(&queue->lock);
+}
+
+/* Waits until a claimed body is compiled. Bodies only wait for bodies before them, which were
+   claimed first, so the first body not done is never waiting. */
+CachedBlock *waitBody(BodyQueue *queue, int body) {
+    mtx_lock(&queue->lock);
+    while (!queue->bodies[body].isDone) {
+        cnd_wait(&queue->done, &queue->lock);
+    }
+    CachedBlock *block = queue->bodies[body].block;
+    mtx_unlock(&queue->lock);
+    return block;
+}
@@ -0,0 +1,40 @@
+#ifndef BODIES_H
+#define BODIES_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+#include "blocks.h"
+
+/* Block of a procedure defined in the program block. text follows its "begin" and length runs
+   through its "end". block is its compiled code once done, NULL if it did not compile. */
+typedef struct {
+    const char *text;
+    int length;
+    int line;
+    int endLine;
+    CachedBlock *block;
+    bool isDone;
+} Body;
+
+/* Procedure bodies of one source text, claimed in order by compile threads.
+   Safe to share between compile threads. */
+typedef struct {
+    char *source;
+    FILE *log;
+    int inlineLimit;
+    Body *bodies;
+    int count;
+    int next;
+    mtx_t lock;
+    cnd_t done;
+} BodyQueue;
+
+void initBodyQueue(BodyQueue *queue, char *source, FILE *log, int inlineLimit);
+void cleanBodyQueue(BodyQueue *queue);
+int findBody(const BodyQueue *queue, const char *text);
+int claimBody(BodyQueue *queue);
+void finishBody(BodyQueue *queue, int body, CachedBlock *block);
+CachedBlock *waitBody(BodyQueue *queue, int body);
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <time.h>
+#include "budget.h"
+
+/* Steps a thread takes from the budget at once, and so how often it looks at the clock */
+#define STEP_CHUNK 4096
+
+static int64_t stepLimit;
+static int64_t timeLimit;
+static atomic_llong stepsLeft;
+static atomic_bool isExpired;
+static bool isWatching;
+static thrd_t watchdog;
+static mtx_t watchLock;
+static cnd_t watchDone;
+static bool isStopped;
+
+/* Limits every run to steps steps and to milliseconds of wall time, 0 for no limit */
+void setBudget(int64_t steps, int64_t milliseconds) {
+    stepLimit = steps;
+    timeLimit = milliseconds;
+}
+
+/* Sleeps until the time limit, unless the run ends first */
+static int watch(void *arg) {
+    struct timespec *deadline = arg;
+    mtx_lock(&watchLock);
+    while (!isStopped) {
+        if (cnd_timedwait(&watchDone, &watchLock, deadline) == thrd_timedout) {
+            atomic_store(&isExpired, true);
+            break;
+        }
+    }
+    mtx_unlock(&watchLock);
+    return 0;
+}
+
+/* Fills the budget for a run and starts the watchdog of its time limit */
+void startBudget() {
+    static struct timespec deadline;
+    atomic_store(&stepsLeft, stepLimit > 0 ? stepLimit : INT64_MAX);
+    atomic_store(&isExpired, false);
+    isWatching = false;
+    if (timeLimit <= 0) {
+        return;
+    }
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += timeLimit / 1000;
+    deadline.tv_nsec += timeLimit % 1000 * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    isStopped = false;
+    mtx_init(&watchLock, mtx_plain);
+    cnd_init(&watchDone);
+    isWatching = thrd_create(&watchdog, watch, &deadline) == thrd_success;
+    if (!isWatching) {
+        cnd_destroy(&watchDone);
+        mtx_destroy(&watchLock);
+    }
+}
+
+void stopBudget() {
+    if (!isWatching) {
+        return;
+    }
+    mtx_lock(&watchLock);
+    isStopped = true;
+    cnd_signal(&watchDone);
+    mtx_unlock(&watchLock);
+    thrd_join(watchdog, NULL);
+    cnd_destroy(&watchDone);
+    mtx_destroy(&watchLock);
+    isWatching = false;
+}
+
+/* Called when a thread spent its steps: gives it up to STEP_CHUNK more, one of which it spends
+   now. Returns the error that stops the program once the steps or the time ran out. */
+const char *takeSteps(int64_t *steps) {
+    *steps = 0;
+    if (atomic_load_explicit(&isExpired, memory_order_relaxed)) {
+        return "Time Limit Exceeded";
+    }
+    int64_t left = atomic_load_explicit(&stepsLeft, memory_order_relaxed);
+    int64_t take;
+    do {
+        if (left <= 0) {
+            return "Step Limit Exceeded";
+        }
+        take = left < STEP_CHUNK ? left : STEP_CHUNK;
+    } while (!atomic_compare_exchange_weak_explicit(&stepsLeft, &left, left - take,
+                 memory_order_relaxed, memory_order_relaxed));
+    *steps = take - 1;
+    return NULL;
+}
@@ -0,0 +1,14 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdint.h>
+
+/* A step is a loop iteration or a call. The machines only count steps on backward branches and
+   calls, so that straight code carries no check: between two steps they run at most the
+   length of the code. */
+void setBudget(int64_t steps, int64_t milliseconds);
+void startBudget();
+void stopBudget();
+const char *takeSteps(int64_t *steps);
+
+#endif
@@ -1,5 +1,5 @@
 @echo off
 
-cl *.c /link /out:main.exe
+cl /std:c11 /experimental:c11atomics *.c /link /out:main.exe
 
 del *.obj
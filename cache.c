@@ -0,0 +1,264 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cache.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#define makeDir(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDir(path) mkdir(path, 0777)
+#endif
+
+#define PATH_LEN 1024
+#define INDEX_NAME "index"
+
+static void entryPath(Cache *cache, const char *key, char *path) {
+    snprintf(path, PATH_LEN, "%s/%s.plc", cache->dir, key);
+}
+
+static void tempPath(Cache *cache, const char *name, char *path) {
+    static unsigned counter;
+    unsigned salt = (unsigned)time(NULL) ^ (unsigned)(uintptr_t)&salt ^ ++counter;
+    snprintf(path, PATH_LEN, "%s/%s.%08x.tmp", cache->dir, name, salt);
+}
+
+/* Replaces dest with the completely written file temp. rename is atomic where the
+   platform allows replacing an existing file, otherwise the old file is removed first. */
+static bool commitFile(const char *temp, const char *dest) {
+    if (rename(temp, dest) == 0) {
+        return true;
+    }
+    remove(dest);
+    if (rename(temp, dest) == 0) {
+        return true;
+    }
+    remove(temp);
+    return false;
+}
+
+static CacheEntry *findEntry(Cache *cache, const char *key) {
+    for (int i = 0; i < cache->count; i++) {
+        if (!strcmp(cache->entries[i].key, key)) {
+            return &cache->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static CacheEntry *addEntry(Cache *cache, const char *key) {
+    if (cache->count >= cache->capacity) {
+        cache->capacity = cache->capacity ? 2 * cache->capacity : 64;
+        cache->entries = realloc(cache->entries, cache->capacity * sizeof(CacheEntry));
+    }
+    CacheEntry *entry = &cache->entries[cache->count++];
+    strcpy(entry->key, key);
+    entry->size = 0;
+    entry->lastUse = 0;
+    return entry;
+}
+
+static void removeEntry(Cache *cache, CacheEntry *entry) {
+    char path[PATH_LEN];
+    entryPath(cache, entry->key, path);
+    remove(path);
+    *entry = cache->entries[--cache->count];
+}
+
+static bool entryExists(Cache *cache, const char *key) {
+    char path[PATH_LEN];
+    entryPath(cache, key, path);
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fclose(f);
+    }
+    return f != NULL;
+}
+
+/* Merges the index on disk into memory. Entries known to both keep the later use. */
+static void readIndex(Cache *cache) {
+    char path[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/%s", cache->dir, INDEX_NAME);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+    long hits, misses, tick;
+    if (fscanf(f, "plcache %*d hits %ld misses %ld tick %ld", &hits, &misses, &tick) == 3) {
+        cache->oldHits = hits;
+        cache->oldMisses = misses;
+        if (tick > cache->tick) {
+            cache->tick = tick;
+        }
+        char key[KEY_LEN + 1];
+        long size, lastUse;
+        while (fscanf(f, "%16s %ld %ld", key, &size, &lastUse) == 3) {
+            CacheEntry *entry = findEntry(cache, key);
+            if (!entry) {
+                if (!entryExists(cache, key)) {
+                    continue;
+                }
+                entry = addEntry(cache, key);
+            }
+            entry->size = size;
+            if (lastUse > entry->lastUse) {
+                entry->lastUse = lastUse;
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void writeIndex(Cache *cache) {
+    char path[PATH_LEN];
+    char temp[PATH_LEN];
+    snprintf(path, PATH_LEN, "%s/%s", cache->dir, INDEX_NAME);
+    tempPath(cache, INDEX_NAME, temp);
+    FILE *f = fopen(temp, "w");
+    if (!f) {
+        return;
+    }
+    fprintf(f, "plcache %d hits %ld misses %ld tick %ld\n", CODE_VERSION,
+        cache->oldHits + cache->hits, cache->oldMisses + cache->misses, cache->tick);
+    for (int i = 0; i < cache->count; i++) {
+        CacheEntry *entry = &cache->entries[i];
+        fprintf(f, "%s %ld %ld\n", entry->key, entry->size, entry->lastUse);
+    }
+    if (fclose(f) == 0) {
+        commitFile(temp, path);
+    } else {
+        remove(temp);
+    }
+}
+
+/* Removes least recently used entries until the cache fits into its size bound */
+static void evict(Cache *cache) {
+    long total = 0;
+    for (int i = 0; i < cache->count; i++) {
+        total += cache->entries[i].size;
+    }
+    while (total > cache->maxSize && cache->count > 0) {
+        CacheEntry *oldest = &cache->entries[0];
+        for (int i = 1; i < cache->count; i++) {
+            if (cache->entries[i].lastUse < oldest->lastUse) {
+                oldest = &cache->entries[i];
+            }
+        }
+        total -= oldest->size;
+        removeEntry(cache, oldest);
+    }
+}
+
+bool openCache(Cache *cache, const char *dir, long maxSize) {
+    makeDir(dir);
+    cache->dir = malloc(strlen(dir) + 1);
+    strcpy(cache->dir, dir);
+    cache->maxSize = maxSize;
+    cache->entries = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+    cache->tick = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->oldHits = 0;
+    cache->oldMisses = 0;
+    mtx_init(&cache->lock, mtx_plain);
+    readIndex(cache);
+    return true;
+}
+
+/* Writes the index back. Entries added by other processes meanwhile are kept. */
+void closeCache(Cache *cache) {
+    readIndex(cache);
+    evict(cache);
+    writeIndex(cache);
+    mtx_destroy(&cache->lock);
+    free(cache->entries);
+    free(cache->dir);
+}
+
+/* FNV-1a hash of the code version, the options changing the code and the source text */
+void cacheKey(const char *source, const char *flags, char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    char version[64];
+    snprintf(version, sizeof(version), "PL%d:%s:", CODE_VERSION, flags);
+    for (const char *c = version; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    for (const char *c = source; *c; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    }
+    snprintf(key, KEY_LEN + 1, "%016llx", (unsigned long long)hash);
+}
+
+bool cacheLoad(Cache *cache, const char *key, Code *code) {
+    char path[PATH_LEN];
+    entryPath(cache, key, path);
+    FILE *f = fopen(path, "rb");
+    bool hit = f && loadCode(code, f);
+    long size = hit ? ftell(f) : 0;
+    if (f) {
+        fclose(f);
+    }
+    
+    mtx_lock(&cache->lock);
+    CacheEntry *entry = findEntry(cache, key);
+    if (hit) {
+        cache->hits++;
+        if (!entry) {
+            entry = addEntry(cache, key);
+            entry->size = size;
+        }
+        entry->lastUse = ++cache->tick;
+    } else {
+        cache->misses++;
+        if (entry) {
+            removeEntry(cache, entry);
+        }
+    }
+    mtx_unlock(&cache->lock);
+    return hit;
+}
+
+void cacheStore(Cache *cache, const char *key, const Code *code) {
+    char path[PATH_LEN];
+    char temp[PATH_LEN];
+    entryPath(cache, key, path);
+    mtx_lock(&cache->lock);
+    tempPath(cache, key, temp);
+    mtx_unlock(&cache->lock);
+    
+    FILE *f = fopen(temp, "wb");
+    if (!f) {
+        return;
+    }
+    bool ok = saveCode(code, f);
+    long size = ftell(f);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || !commitFile(temp, path)) {
+        remove(temp);
+        return;
+    }
+    
+    mtx_lock(&cache->lock);
+    CacheEntry *entry = findEntry(cache, key);
+    if (!entry) {
+        entry = addEntry(cache, key);
+    }
+    entry->size = size;
+    entry->lastUse = ++cache->tick;
+    evict(cache);
+    mtx_unlock(&cache->lock);
+}
+
+void printCacheStats(Cache *cache, FILE *f) {
+    long total = 0;
+    for (int i = 0; i < cache->count; i++) {
+        total += cache->entries[i].size;
+    }
+    fprintf(f, "cache: %ld hits, %ld misses (%ld hits, %ld misses in total), %d entries, %ld bytes\n",
+        cache->hits, cache->misses, cache->oldHits + cache->hits, cache->oldMisses + cache->misses,
+        cache->count, total);
+}
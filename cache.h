@@ -0,0 +1,39 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <threads.h>
+#include "code.h"
+
+#define KEY_LEN 16
+
+typedef struct {
+    char key[KEY_LEN + 1];
+    long size;
+    long lastUse;
+} CacheEntry;
+
+/* Content addressed store of compiled programs. Safe to share between compile threads. */
+typedef struct {
+    char *dir;
+    long maxSize;
+    CacheEntry *entries;
+    int count;
+    int capacity;
+    long tick;
+    long hits;
+    long misses;
+    long oldHits;
+    long oldMisses;
+    mtx_t lock;
+} Cache;
+
+bool openCache(Cache *cache, const char *dir, long maxSize);
+void closeCache(Cache *cache);
+void cacheKey(const char *source, const char *flags, char *key);
+bool cacheLoad(Cache *cache, const char *key, Code *code);
+void cacheStore(Cache *cache, const char *key, const Code *code);
+void printCacheStats(Cache *cache, FILE *f);
+
+#endif
@@ -0,0 +1,493 @@
+#include <stdlib.h>
+#include <string.h>
+#include "code.h"
+#include "memory.h"
+
+#define CODE_LEN 256
+#define CODE_MAGIC 0x31434C50 // "PLC1"
+
+static const char* opNames[OP_COUNT] = {
+    "?", "ADD", "AND", "ARROW", "ASSIGN", "ASSIGNBITS", "BAR", "BRANCH", "CALL", "CONSTANT", "COPY",
+    "COUNTER", "DIVIDE", "ENDBRANCH", "ENDPROC", "ENDPROG", "EQUAL", "FI", "FILL", "FILLBITS",
+    "GREATER", "INDEX", "INDEXBIT", "JUMPEQUAL", "JUMPFALSE", "JUMPGREATER", "JUMPLESS", "JUMPTRUE",
+    "LESS", "MINUS", "MODULO", "MULTIPLY", "NOT", "OR", "PAR", "PROC", "PROG", "READ", "READARRAY",
+    "SPLIT", "SUBTRACT", "VALUE", "VALUEBIT", "VARIABLE", "WRITE"
+};
+
+/* Words of every instruction, the operation included */
+static const int8_t opLengths[OP_COUNT] = {
+    [OP_ADD]=1, [OP_AND]=1, [OP_ARROW]=2, [OP_ASSIGN]=2, [OP_ASSIGNBITS]=2, [OP_BAR]=2, [OP_BRANCH]=2,
+    [OP_CALL]=3, [OP_CONSTANT]=2, [OP_COPY]=2, [OP_COUNTER]=1, [OP_DIVIDE]=1, [OP_ENDBRANCH]=1,
+    [OP_ENDPROC]=1, [OP_ENDPROG]=1, [OP_EQUAL]=1, [OP_FI]=1, [OP_FILL]=2, [OP_FILLBITS]=2,
+    [OP_GREATER]=1, [OP_INDEX]=2, [OP_INDEXBIT]=2, [OP_JUMPEQUAL]=2, [OP_JUMPFALSE]=2, [OP_JUMPGREATER]=2,
+    [OP_JUMPLESS]=2, [OP_JUMPTRUE]=2, [OP_LESS]=1, [OP_MINUS]=1, [OP_MODULO]=1, [OP_MULTIPLY]=1,
+    [OP_NOT]=1, [OP_OR]=1, [OP_PAR]=2, [OP_PROC]=3, [OP_PROG]=3, [OP_READ]=2, [OP_READARRAY]=2,
+    [OP_SPLIT]=2, [OP_SUBTRACT]=1, [OP_VALUE]=1, [OP_VALUEBIT]=1,
+    [OP_VARIABLE]=3, [OP_WRITE]=2
+};
+
+static void put(Code *code, int32_t word) {
+    if (code->length >= code->capacity) {
+        code->capacity = code->capacity ? 2 * code->capacity : CODE_LEN;
+        code->words = memRealloc(MEM_CODE, code->words, code->capacity * sizeof(int32_t));
+    }
+    code->words[code->length++] = word;
+}
+
+static bool writeWord(FILE *f, int32_t word) {
+    uint32_t w = (uint32_t)word;
+    unsigned char bytes[4] = {w & 0xFF, (w >> 8) & 0xFF, (w >> 16) & 0xFF, w >> 24};
+    return fwrite(bytes, 1, 4, f) == 4;
+}
+
+static bool readWord(FILE *f, int32_t *word) {
+    unsigned char bytes[4];
+    if (fread(bytes, 1, 4, f) != 4) {
+        return false;
+    }
+    *word = (int32_t)(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+    return true;
+}
+
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static uint64_t hashWord(uint64_t hash, int32_t word) {
+    uint32_t w = (uint32_t)word;
+    unsigned char bytes[4] = {w & 0xFF, (w >> 8) & 0xFF, (w >> 16) & 0xFF, w >> 24};
+    return hashBytes(hash, bytes, 4);
+}
+
+/* FNV-1a hash of everything a code file holds, which finds damaged files but not files changed
+   on purpose */
+static uint64_t sumCode(const Code *code) {
+    uint64_t hash = hashWord(0xCBF29CE484222325ULL, code->length);
+    for (int i = 0; i < code->length; i++) {
+        hash = hashWord(hash, code->words[i]);
+    }
+    hash = hashBytes(hashWord(hash, code->lineBytes), code->lineTable, code->lineBytes);
+    hash = hashWord(hash, code->procCount);
+    for (int i = 0; i < code->procCount; i++) {
+        hash = hashWord(hash, code->procs[i].addr);
+        hash = hashBytes(hash, code->procs[i].name, strlen(code->procs[i].name) + 1);
+    }
+    return hash;
+}
+
+static void putLineByte(Code *code, uint8_t byte) {
+    if (code->lineBytes >= code->lineCapacity) {
+        code->lineCapacity = code->lineCapacity ? 2 * code->lineCapacity : CODE_LEN;
+        code->lineTable = memRealloc(MEM_CODE, code->lineTable, code->lineCapacity);
+    }
+    code->lineTable[code->lineBytes++] = byte;
+}
+
+/* Seven bits per byte, the high bit marks that more bytes follow */
+static void putNumber(Code *code, uint32_t value) {
+    while (value >= 0x80) {
+        putLineByte(code, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    putLineByte(code, value);
+}
+
+static uint32_t getNumber(const Code *code, int *pos) {
+    uint32_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *pos < code->lineBytes ? code->lineTable[(*pos)++] : 0;
+        value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 32);
+    return value;
+}
+
+/* Called before the run at pos is added, while lastPc and lastLine hold the run before it */
+static void markRun(Code *code, int pos) {
+    if (code->runCount++ % LINE_MARK_RUNS != 0) {
+        return;
+    }
+    if (code->markCount >= code->markCapacity) {
+        code->markCapacity = code->markCapacity ? 2 * code->markCapacity : 16;
+        code->lineMarks = memRealloc(MEM_CODE, code->lineMarks, code->markCapacity * sizeof(LineMark));
+    }
+    code->lineMarks[code->markCount++] = (LineMark){pos, code->lastPc, code->lastLine};
+}
+
+/* Line differences are stored zigzag encoded: 0, -1, 1, -2, ... become 0, 1, 2, 3, ... */
+static void putLine(Code *code, int pc, int line) {
+    markRun(code, code->lineBytes);
+    int delta = line - code->lastLine;
+    putNumber(code, pc - code->lastPc);
+    putNumber(code, delta < 0 ? 2 * (uint32_t)-delta - 1 : 2 * (uint32_t)delta);
+    code->lastPc = pc;
+    code->lastLine = line;
+}
+
+/* Decodes the run at *pos, advancing *pc and *line to its start and source line */
+static void getLine(const Code *code, int *pos, int *pc, int *line) {
+    *pc += getNumber(code, pos);
+    uint32_t delta = getNumber(code, pos);
+    *line += (delta & 1) ? -(int)((delta + 1) / 2) : (int)(delta / 2);
+}
+
+void initCode(Code *code) {
+    code->words = NULL;
+    code->length = 0;
+    code->capacity = 0;
+    code->line = 0;
+    code->last = -1;
+    code->lineTable = NULL;
+    code->lineBytes = 0;
+    code->lineCapacity = 0;
+    code->lastPc = 0;
+    code->lastLine = 0;
+    code->lineMarks = NULL;
+    code->markCount = 0;
+    code->markCapacity = 0;
+    code->runCount = 0;
+    code->procs = NULL;
+    code->procCount = 0;
+    code->procCapacity = 0;
+    code->spaces = NULL;
+    code->spaceCount = 0;
+    code->spaceCapacity = 0;
+}
+
+void cleanCode(Code *code) {
+    for (int i = 0; i < code->procCount; i++) {
+        memFree(code->procs[i].name);
+    }
+    memFree(code->procs);
+    memFree(code->spaces);
+    memFree(code->lineTable);
+    memFree(code->lineMarks);
+    memFree(code->words);
+    initCode(code);
+}
+
+/* The emit functions return the address of the emitted instruction */
+int emit0(Code *code, OpCode op) {
+    int addr = code->length;
+    if (code->lineBytes == 0 || code->lastLine != code->line) {
+        putLine(code, addr, code->line);
+    }
+    put(code, op);
+    code->last = addr;
+    return addr;
+}
+
+int emit1(Code *code, OpCode op, int32_t arg) {
+    int addr = emit0(code, op);
+    put(code, arg);
+    return addr;
+}
+
+int emit2(Code *code, OpCode op, int32_t arg1, int32_t arg2) {
+    int addr = emit1(code, op, arg1);
+    put(code, arg2);
+    return addr;
+}
+
+/* Appends a copy of the code from address from up to to, which must hold no jumps.
+   Returns the address of the copy; last is not changed. */
+int copyCode(Code *code, int from, int to) {
+    int addr = code->length;
+    if (from >= to) {
+        return addr;
+    }
+    if (code->lineBytes == 0 || code->lastLine != code->line) {
+        putLine(code, addr, code->line);
+    }
+    for (int i = from; i < to; i++) {
+        put(code, code->words[i]);
+    }
+    return addr;
+}
+
+/* Appends words from elsewhere, at the current line. Returns the address of the first. */
+int appendWords(Code *code, const int32_t *words, int count) {
+    int addr = code->length;
+    if (count <= 0) {
+        return addr;
+    }
+    if (code->lineBytes == 0 || code->lastLine != code->line) {
+        putLine(code, addr, code->line);
+    }
+    for (int i = 0; i < count; i++) {
+        put(code, words[i]);
+    }
+    return addr;
+}
+
+/* Drops the code from address length on with the line runs starting there, so that it can be
+   emitted again. last is not known afterwards. */
+void truncateCode(Code *code, int length) {
+    int low = 0;
+    int high = code->markCount - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (code->lineMarks[mid].pc < length) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    LineMark mark = code->markCount > 0 ? code->lineMarks[low] : (LineMark){0, 0, 0};
+    int run = code->markCount > 0 ? low * LINE_MARK_RUNS : 0;
+    int pos = mark.pos;
+    while (pos < code->lineBytes) {
+        int nextPos = pos;
+        int nextPc = mark.pc;
+        int nextLine = mark.line;
+        getLine(code, &nextPos, &nextPc, &nextLine);
+        if (nextPc >= length) {
+            break;
+        }
+        pos = nextPos;
+        mark.pc = nextPc;
+        mark.line = nextLine;
+        run++;
+    }
+    code->lineBytes = pos;
+    code->lastPc = mark.pc;
+    code->lastLine = mark.line;
+    code->runCount = run;
+    code->markCount = (run + LINE_MARK_RUNS - 1) / LINE_MARK_RUNS;
+    code->length = length;
+    code->last = -1;
+}
+
+void patch(Code *code, int addr, int32_t value) {
+    code->words[addr] = value;
+}
+
+/* Forward jumps to one label are chained through their operands until the label is known */
+void patchChain(Code *code, int chain, int32_t value) {
+    while (chain != -1) {
+        int next = code->words[chain];
+        code->words[chain] = value;
+        chain = next;
+    }
+}
+
+/* Instructions emitted from now on belong to the source line */
+void setLine(Code *code, int line) {
+    code->line = line;
+}
+
+/* Sets *pos, *runPc and *runLine to a mark at or before pc, *runLine being the line of pc
+   unless a run after the mark starts at or before pc */
+void seekLine(const Code *code, int pc, int *pos, int *runPc, int *runLine) {
+    int low = 0;
+    int high = code->markCount - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (code->lineMarks[mid].pc <= pc) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    LineMark mark = code->markCount > 0 ? code->lineMarks[low] : (LineMark){0, 0, 0};
+    *pos = mark.pos;
+    *runPc = mark.pc;
+    *runLine = mark.line;
+}
+
+int findLine(const Code *code, int pc) {
+    int pos;
+    int runPc;
+    int runLine;
+    seekLine(code, pc, &pos, &runPc, &runLine);
+    int line = runLine;
+    while (pos < code->lineBytes) {
+        getLine(code, &pos, &runPc, &runLine);
+        if (runPc > pc) {
+            break;
+        }
+        line = runLine;
+    }
+    return line;
+}
+
+/* Steps through the line table from byte *pos, for which *pc and *line must hold the start and
+   line of the run before it. Returns false at the end of the table. */
+bool nextLineRun(const Code *code, int *pos, int *pc, int *line) {
+    if (*pos >= code->lineBytes) {
+        return false;
+    }
+    getLine(code, pos, pc, line);
+    return true;
+}
+
+/* Fills lines[pc] with the source line of every address of the code */
+void expandLines(const Code *code, int *lines) {
+    int pos = 0;
+    int runPc = 0;
+    int runLine = 0;
+    int pc = 0;
+    while (pos < code->lineBytes) {
+        int line = runLine;
+        getLine(code, &pos, &runPc, &runLine);
+        while (pc < runPc && pc < code->length) {
+            lines[pc++] = line;
+        }
+    }
+    while (pc < code->length) {
+        lines[pc++] = runLine;
+    }
+}
+
+void addProc(Code *code, int addr, const char *name) {
+    if (code->procCount >= code->procCapacity) {
+        code->procCapacity = code->procCapacity ? 2 * code->procCapacity : 16;
+        code->procs = memRealloc(MEM_CODE, code->procs, code->procCapacity * sizeof(ProcEntry));
+    }
+    code->procs[code->procCount++] = (ProcEntry){.addr = addr, .name = memString(MEM_CODE, name)};
+}
+
+void addSpace(Code *code, int block, int displ, int words) {
+    if (code->spaceCount >= code->spaceCapacity) {
+        code->spaceCapacity = code->spaceCapacity ? 2 * code->spaceCapacity : 16;
+        code->spaces = memRealloc(MEM_CODE, code->spaces, code->spaceCapacity * sizeof(FrameSpace));
+    }
+    code->spaces[code->spaceCount++] = (FrameSpace){block, displ, words};
+}
+
+/* Returns the index of the block containing addr or -1 */
+int findProc(const Code *code, int addr) {
+    int low = 0;
+    int high = code->procCount - 1;
+    int index = -1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (code->procs[mid].addr <= addr) {
+            index = mid;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return index;
+}
+
+const char *getOpName(OpCode op) {
+    return (op > 0 && op < OP_COUNT) ? opNames[op] : opNames[0];
+}
+
+/* Returns 1 for an invalid operation, so that a walk over the code always advances */
+int getOpLength(OpCode op) {
+    return (op > 0 && op < OP_COUNT) ? opLengths[op] : 1;
+}
+
+/* Jumps hold their target address in the first operand, as do PAR and SPLIT with the end of
+   their statement and BRANCH with the next branch */
+bool isJump(OpCode op) {
+    return op == OP_ARROW || op == OP_BAR || op == OP_BRANCH || op == OP_JUMPEQUAL || op == OP_JUMPFALSE
+        || op == OP_JUMPGREATER || op == OP_JUMPLESS || op == OP_JUMPTRUE || op == OP_PAR || op == OP_SPLIT;
+}
+
+/* Code files are little endian words: magic, version, length, code,
+   line table size, line table bytes padded to words, block count, (addr, name length, name bytes),
+   and the low and high word of the hash of the code */
+bool saveCode(const Code *code, FILE *f) {
+    bool ok = writeWord(f, CODE_MAGIC) && writeWord(f, CODE_VERSION) && writeWord(f, code->length);
+    for (int i = 0; ok && i < code->length; i++) {
+        ok = writeWord(f, code->words[i]);
+    }
+    int padding = (4 - code->lineBytes % 4) % 4;
+    ok = ok && writeWord(f, code->lineBytes)
+        && fwrite(code->lineTable, 1, code->lineBytes, f) == (size_t)code->lineBytes
+        && fwrite("\0\0\0", 1, padding, f) == (size_t)padding;
+    ok = ok && writeWord(f, code->procCount);
+    for (int i = 0; ok && i < code->procCount; i++) {
+        int nameLen = strlen(code->procs[i].name);
+        ok = writeWord(f, code->procs[i].addr) && writeWord(f, nameLen)
+            && fwrite(code->procs[i].name, 1, nameLen, f) == (size_t)nameLen;
+    }
+    uint64_t sum = sumCode(code);
+    return ok && writeWord(f, (int32_t)(uint32_t)sum) && writeWord(f, (int32_t)(uint32_t)(sum >> 32));
+}
+
+/* Bytes from the position of f to its end, 0 if f cannot tell */
+static long bytesLeft(FILE *f) {
+    long pos = ftell(f);
+    if (pos < 0 || fseek(f, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    long end = ftell(f);
+    fseek(f, pos, SEEK_SET);
+    return end > pos ? end - pos : 0;
+}
+
+static bool loadTables(Code *code, FILE *f) {
+    int32_t count;
+    if (!readWord(f, &count) || count < 0) {
+        return false;
+    }
+    int padding = (4 - count % 4) % 4;
+    for (int i = 0; i < count + padding; i++) {
+        int c = fgetc(f);
+        if (c == EOF) {
+            return false;
+        } else if (i < count) {
+            putLineByte(code, c);
+        }
+    }
+    int pos = 0;
+    while (pos < code->lineBytes) {
+        markRun(code, pos);
+        getLine(code, &pos, &code->lastPc, &code->lastLine);
+    }
+    if (!readWord(f, &count) || count < 0) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        int32_t addr, nameLen;
+        if (!readWord(f, &addr) || !readWord(f, &nameLen) || nameLen < 0 || nameLen > bytesLeft(f)) {
+            return false;
+        }
+        char *name = memAlloc(MEM_CODE, nameLen + 1);
+        bool isRead = fread(name, 1, nameLen, f) == (size_t)nameLen;
+        name[nameLen] = '\0';
+        if (isRead) {
+            addProc(code, addr, name);
+        }
+        memFree(name);
+        if (!isRead) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool loadCode(Code *code, FILE *f) {
+    int32_t magic, version, length;
+    if (!readWord(f, &magic) || !readWord(f, &version) || !readWord(f, &length)
+        || magic != CODE_MAGIC || version != CODE_VERSION || length < 0) {
+        return false;
+    }
+    cleanCode(code);
+    for (int i = 0; i < length; i++) {
+        int32_t word;
+        if (!readWord(f, &word)) {
+            cleanCode(code);
+            return false;
+        }
+        put(code, word);
+    }
+    int32_t low, high;
+    if (!loadTables(code, f) || !readWord(f, &low) || !readWord(f, &high)
+        || ((uint64_t)(uint32_t)high << 32 | (uint32_t)low) != sumCode(code)) {
+        cleanCode(code);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "interpreter.h"
+
+/* Changes whenever the meaning of emitted code changes */
+#define CODE_VERSION 12
+
+#define LINE_MARK_RUNS 64
+
+typedef struct {
+    int32_t addr;
+    char *name;
+} ProcEntry;
+
+/* Frame words [displ, displ + words) of the block whose PROC is at block, given to a variable,
+   an array or the variables of an inlined procedure */
+typedef struct {
+    int32_t block;
+    int32_t displ;
+    int32_t words;
+} FrameSpace;
+
+/* Decoding state of the line table before one of its runs */
+typedef struct {
+    int pos;
+    int pc;
+    int line;
+} LineMark;
+
+/* Code image with the debug tables mapping it back to the source.
+   lineTable holds one entry per run of instructions from the same source line: the distance
+   from the start of the previous run and the line difference, both as variable length numbers.
+   It is only decoded to report errors and profiles, so the code itself carries no lines.
+   lineMarks holds the state before every LINE_MARK_RUNS-th run, so that decoding can start
+   close to an address.
+   procs holds the entry address of every block in address order.
+   spaces lists the frame space of every variable while the code is compiled, in the order it
+   was given. It is not saved with the code.
+   last is the address of the last emitted instruction. */
+typedef struct Code {
+    int32_t *words;
+    int length;
+    int capacity;
+    int line;
+    int last;
+    uint8_t *lineTable;
+    int lineBytes;
+    int lineCapacity;
+    int lastPc;
+    int lastLine;
+    LineMark *lineMarks;
+    int markCount;
+    int markCapacity;
+    int runCount;
+    ProcEntry *procs;
+    int procCount;
+    int procCapacity;
+    FrameSpace *spaces;
+    int spaceCount;
+    int spaceCapacity;
+} Code;
+
+void initCode(Code *code);
+void cleanCode(Code *code);
+int emit0(Code *code, OpCode op);
+int emit1(Code *code, OpCode op, int32_t arg);
+int emit2(Code *code, OpCode op, int32_t arg1, int32_t arg2);
+int copyCode(Code *code, int from, int to);
+int appendWords(Code *code, const int32_t *words, int count);
+void truncateCode(Code *code, int length);
+void patch(Code *code, int addr, int32_t value);
+void patchChain(Code *code, int chain, int32_t value);
+void setLine(Code *code, int line);
+int findLine(const Code *code, int pc);
+void seekLine(const Code *code, int pc, int *pos, int *runPc, int *runLine);
+bool nextLineRun(const Code *code, int *pos, int *pc, int *line);
+void expandLines(const Code *code, int *lines);
+void addProc(Code *code, int addr, const char *name);
+int findProc(const Code *code, int addr);
+void addSpace(Code *code, int block, int displ, int words);
+const char *getOpName(OpCode op);
+int getOpLength(OpCode op);
+bool isJump(OpCode op);
+bool saveCode(const Code *code, FILE *f);
+bool loadCode(Code *code, FILE *f);
+
+#endif
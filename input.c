@@ -0,0 +1,176 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "input.h"
+
+#ifdef _WIN32
+#define MAP_INPUT 0
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAP_INPUT 1
+#endif
+
+static const uint8_t *input;
+static size_t inputLength;
+static size_t inputPos;
+static bool isMapped;
+static ProgramIo io;
+static bool hasIo;
+static mtx_t ioLock;
+static once_flag ioOnce = ONCE_FLAG_INIT;
+
+/* Maps the file, or reads it into memory where there is no mmap */
+bool openBinaryInput(const char *path) {
+    closeInput();
+#if MAP_INPUT
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    inputLength = st.st_size;
+    if (inputLength > 0) {
+        void *map = mmap(NULL, inputLength, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        posix_madvise(map, inputLength, POSIX_MADV_SEQUENTIAL);
+        input = map;
+    } else {
+        input = (const uint8_t*)"";
+    }
+    close(fd);
+    isMapped = inputLength > 0;
+#else
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    inputLength = ftell(f);
+    rewind(f);
+    uint8_t *buffer = malloc(inputLength + 1);
+    inputLength = fread(buffer, 1, inputLength, f);
+    fclose(f);
+    input = buffer;
+    isMapped = false;
+#endif
+    inputPos = 0;
+    return true;
+}
+
+void closeInput() {
+    if (!input) {
+        return;
+    }
+#if MAP_INPUT
+    if (isMapped) {
+        munmap((void*)input, inputLength);
+    }
+#else
+    free((void*)input);
+#endif
+    input = NULL;
+    inputLength = 0;
+    inputPos = 0;
+    isMapped = false;
+}
+
+static void initIoLock() {
+    mtx_init(&ioLock, mtx_plain);
+}
+
+/* Sets the callbacks of the runs from now on, or with NULL goes back to the standard streams.
+   Branches of par statements on several threads call them one at a time. */
+void setProgramIo(const ProgramIo *programIo) {
+    call_once(&ioOnce, initIoLock);
+    hasIo = programIo != NULL;
+    io = hasIo ? *programIo : (ProgramIo){NULL, NULL, NULL, NULL};
+}
+
+static bool readCallback(int32_t *target) {
+    mtx_lock(&ioLock);
+    bool isRead = io.read && io.read(io.context, target);
+    mtx_unlock(&ioLock);
+    return isRead;
+}
+
+static int32_t getWord(const uint8_t *bytes) {
+    return (int32_t)(bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+}
+
+void readInteger(int32_t *target) {
+    if (hasIo) {
+        readCallback(target);
+    } else if (!input) {
+        scanf("%d", target);
+    } else if (inputPos + 4 <= inputLength) {
+        *target = getWord(&input[inputPos]);
+        inputPos += 4;
+    }
+}
+
+/* Copies the words straight from the input on a little endian machine */
+void readIntegers(int32_t *target, int count) {
+    if (hasIo) {
+        for (int i = 0; i < count; i++) {
+            if (!readCallback(&target[i])) {
+                break;
+            }
+        }
+        return;
+    }
+    if (!input) {
+        for (int i = 0; i < count; i++) {
+            scanf("%d", &target[i]);
+        }
+        return;
+    }
+    size_t available = (inputLength - inputPos) / 4;
+    if ((size_t)count > available) {
+        count = available;
+    }
+    const uint16_t probe = 1;
+    if (*(const uint8_t*)&probe == 1) {
+        memcpy(target, &input[inputPos], count * sizeof(int32_t));
+    } else {
+        for (int i = 0; i < count; i++) {
+            target[i] = getWord(&input[inputPos + 4 * i]);
+        }
+    }
+    inputPos += 4 * (size_t)count;
+}
+
+void writeInteger(int32_t value) {
+    if (!hasIo) {
+        printf("%d\n", value);
+    } else if (io.write) {
+        mtx_lock(&ioLock);
+        io.write(io.context, value);
+        mtx_unlock(&ioLock);
+    }
+}
+
+void reportError(int line, const char *text) {
+    if (!hasIo) {
+        if (line > 0) {
+            printf("%d: %s\n", line, text);
+        } else {
+            printf("%s\n", text);
+        }
+    } else if (io.fail) {
+        mtx_lock(&ioLock);
+        io.fail(io.context, line, text);
+        mtx_unlock(&ioLock);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Callbacks that take the place of the standard streams for an embedded program. read returns
+   false at the end of the input. line is 0 for errors that have no line. */
+typedef struct {
+    void *context;
+    bool (*read)(void *context, int32_t *value);
+    void (*write)(void *context, int32_t value);
+    void (*fail)(void *context, int line, const char *message);
+} ProgramIo;
+
+/* Program input and output of both machines. Text is read from standard input unless a binary
+   input file of little endian 32 bit integers is opened or callbacks are set. At the end of the
+   input a read leaves its variables unchanged. */
+bool openBinaryInput(const char *path);
+void closeInput();
+void setProgramIo(const ProgramIo *programIo);
+void readInteger(int32_t *target);
+void readIntegers(int32_t *target, int count);
+void writeInteger(int32_t value);
+void reportError(int line, const char *text);
+
+#endif
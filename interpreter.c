@@ -1,239 +1,974 @@
+#include <limits.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "budget.h"
+#include "code.h"
+#include "input.h"
 #include "interpreter.h"
+#include "profile.h"
+#include "trace.h"
+#include "verify.h"
+
+#define MAX_PAR_DEPTH 64
+#define SPLIT_WORK 65536
+#define CHUNKS_PER_THREAD 4
+
+/* The registers of one thread running the program. Each dispatch loop keeps its machine in a
+   local, which stores into the store cannot alias, so that the registers stay in processor
+   registers. counter is the iteration of the split loop the thread runs. While a thread runs
+   iterations of a split loop it is holding: its error is kept in failure and failPc, since an
+   earlier iteration may still fail. */
+typedef struct {
+    int pc;
+    int bp;
+    int sp;
+    int stackLimit;
+    int64_t steps;
+    int counter;
+    int worker;
+    int parDepth;
+    bool isHolding;
+    const char *failure;
+    int failPc;
+} Machine;
+
+/* A loop shared among threads: the first of its iterations that failed, with the error and the
+   address it stopped at, under lock */
+typedef struct {
+    atomic_int failed;
+    const char *failure;
+    int failPc;
+    mtx_t lock;
+} Split;
+
+/* The tasks of a par statement or split loop still running, and the thread that waits for them */
+typedef struct {
+    atomic_int pending;
+    int owner;
+} Join;
+
+/* A branch of the par statement at par that runs from start up to its ENDBRANCH at stop in the
+   frame at bp, or with split set the iterations [first, last) of the loop split at par, whose
+   body is the branch */
+typedef struct {
+    int start;
+    int stop;
+    int bp;
+    int par;
+    Join *join;
+    Split *split;
+    int first;
+    int last;
+} Task;
+
+/* The tasks a thread left to others, under a lock of their own. It takes them back from the
+   tail, others steal from the head. The thread sleeps on joined while it waits for a join. */
+typedef struct {
+    Task *tasks;
+    int head;
+    int tail;
+    int capacity;
+    mtx_t lock;
+    cnd_t joined;
+} TaskDeque;
 
 static int32_t store[MAX_STORE];
-static int pc;
-static int bp;
-static int sp;
-static int32_t stackBottom;
-static bool isRunning;
-
-static void error(int lineNo, const char *text) {
-    printf("%d: %s\n", lineNo, text);
+static int stackBottom;
+static atomic_bool isRunning;
+static atomic_bool hasFailed;
+static const Code *program;
+static int32_t *needs;
+static Trace *trace;
+static volatile int sampledPc;
+static volatile int sampledBp;
+static bool hasPar;
+static bool isParallel;
+static TaskDeque *deques;
+static int workerCount;
+/* Threads without work sleep on workAdded until a task is queued or the program finished */
+static mtx_t idleLock;
+static cnd_t workAdded;
+static atomic_int queuedTasks;
+static int idleWorkers;
+static bool isFinished;
+
+/* Stops the failed program, dumping the trace of a traced run after the message */
+static void stop() {
     isRunning = false;
+    hasFailed = true;
+    if (trace) {
+        fflush(stdout);
+        dumpTrace(trace, 2);
+    }
+}
+
+/* Of threads failing at once only the first reports */
+static void error(Machine *m, const char *text) {
+    if (m->isHolding) {
+        m->failure = text;
+        m->failPc = m->pc;
+        return;
+    }
+    if (atomic_exchange(&isRunning, false)) {
+        reportError(findLine(program, m->pc), text);
+        stop();
+    }
+}
+
+static void refillSteps(Machine *m) {
+    const char *spent = takeSteps(&m->steps);
+    if (spent) {
+        error(m, spent);
+    }
 }
 
-static void allocate(int wordCount) {
-    sp = sp + wordCount;
-    if (sp > MAX_STORE) {
-        printf("Stack Overflow\n");
-        isRunning = false;
+/* Backward branches and calls spend a step of the budget */
+static inline void spendStep(Machine *m) {
+    if (--m->steps < 0) {
+        refillSteps(m);
     }
 }
 
-static void opVariable(int level, int disp) {
-    allocate(1);
-    int x = bp;
+/* Verified code pushes no more than its block reserved on entry */
+static void allocate(Machine *m, int wordCount) {
+    m->sp = m->sp + wordCount;
+}
+
+/* Makes room for the frame of the block at blockAddr and everything it pushes, or for the
+   stack of a branch of the par statement at blockAddr */
+static bool reserve(Machine *m, int blockAddr) {
+    if (m->sp + needs[blockAddr] >= m->stackLimit) {
+        reportError(0, "Stack Overflow");
+        stop();
+        return false;
+    }
+    return true;
+}
+
+static void opVariable(Machine *m, int level, int disp) {
+    allocate(m, 1);
+    int x = m->bp;
     while (level > 0) {
         x = store[x];
         level--;
     }
-    store[sp] = x + disp;
-    pc += 3;
+    store[m->sp] = x + disp;
+    m->pc += 3;
 }
 
-static void opIndex(int bound, int lineNo) {
-    int i = store[sp];
-    sp--;
+static void opIndex(Machine *m, int bound) {
+    int i = store[m->sp];
+    m->sp--;
     if (i < 1 || i > bound) {
-        error(lineNo, "Range Error");
+        error(m, "Range Error");
     } else {
-        store[sp] = store[sp] + i - 1;
+        store[m->sp] = store[m->sp] + i - 1;
     }
-    pc += 3;
+    m->pc += 2;
 }
 
-static void opConstant(int value) {
-    allocate(1);
-    store[sp] = value;
-    pc += 2;
+/* Elements of packed Boolean arrays are addressed by -1 - (32 * word + bit), which keeps them
+   apart from word addresses in a multiple assignment */
+static void opIndexBit(Machine *m, int bound) {
+    int i = store[m->sp];
+    m->sp--;
+    if (i < 1 || i > bound) {
+        error(m, "Range Error");
+    } else {
+        store[m->sp] = -1 - (32 * store[m->sp] + i - 1);
+    }
+    m->pc += 2;
+}
+
+/* Pushes the iteration of the split loop the thread runs */
+static void opCounter(Machine *m) {
+    allocate(m, 1);
+    store[m->sp] = m->counter;
+    m->pc++;
 }
 
-static void opValue() {
-    store[sp] = store[store[sp]];
-    pc++;
+static void opConstant(Machine *m, int value) {
+    allocate(m, 1);
+    store[m->sp] = value;
+    m->pc += 2;
 }
 
-static void opNot() {
-    store[sp] = 1 - store[sp];
-    p++;
+static void opValue(Machine *m) {
+    store[m->sp] = store[store[m->sp]];
+    m->pc++;
 }
 
-static void opMultiply() {
-    pc++;
-    sp--;
-    store[sp] = store[sp] * store[sp + 1];
+static void opValueBit(Machine *m) {
+    int bit = -1 - store[m->sp];
+    store[m->sp] = ((uint32_t)store[bit >> 5] >> (bit & 31)) & 1;
+    m->pc++;
 }
 
-static void opDivide() {
-    pc++;
-    sp--;
-    store[sp] = store[sp] / store[sp + 1];
+static void opNot(Machine *m) {
+    store[m->sp] = 1 - store[m->sp];
+    m->pc++;
 }
 
-static void opModulo() {
-    pc++;
-    sp--;
-    store[sp] = store[sp] % store[sp + 1];
+static void opMultiply(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = store[m->sp] * store[m->sp + 1];
 }
 
-static void opMinus() {
-    store[sp] = -store[sp];
-    pc++;
+static void opDivide(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = store[m->sp] / store[m->sp + 1];
 }
 
-static void opAdd() {
-    pc++;
-    sp--;
-    store[sp] = store[sp] + store[sp + 1];
+static void opModulo(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = store[m->sp] % store[m->sp + 1];
 }
 
-static void opSubtract() {
-    pc++;
-    sp--;
-    store[sp] = store[sp] - store[sp + 1];
+static void opMinus(Machine *m) {
+    store[m->sp] = -store[m->sp];
+    m->pc++;
 }
 
-static void opLess() {
-    pc++;
-    sp--;
-    store[sp] = (store[sp] < store[sp + 1]) ? 1 : 0;
+static void opAdd(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = store[m->sp] + store[m->sp + 1];
 }
 
-static void opEqual() {
-    pc++;
-    sp--;
-    store[sp] = (store[sp] == store[sp + 1]) ? 1 : 0;
+static void opSubtract(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = store[m->sp] - store[m->sp + 1];
 }
 
-static void opGreater() {
-    pc++;
-    sp--;
-    store[sp] = (store[sp] > store[sp + 1]) ? 1 : 0;
+static void opLess(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = (store[m->sp] < store[m->sp + 1]) ? 1 : 0;
 }
 
-static void opAnd() {
-    pc++;
-    sp--;
-    if (store[sp] == 1) {
-        store[sp] = store[sp + 1];
+static void opEqual(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = (store[m->sp] == store[m->sp + 1]) ? 1 : 0;
+}
+
+static void opGreater(Machine *m) {
+    m->pc++;
+    m->sp--;
+    store[m->sp] = (store[m->sp] > store[m->sp + 1]) ? 1 : 0;
+}
+
+static void opAnd(Machine *m) {
+    m->pc++;
+    m->sp--;
+    if (store[m->sp] == 1) {
+        store[m->sp] = store[m->sp + 1];
     }
 }
 
-static void opOr() {
-    pc++;
-    sp--;
-    if (store[sp] == 0) {
-        store[sp] = store[sp + 1];
+static void opOr(Machine *m) {
+    m->pc++;
+    m->sp--;
+    if (store[m->sp] == 0) {
+        store[m->sp] = store[m->sp + 1];
     }        
 }
 
-static void opRead(int num) {
-    pc += 2;
-    sp = sp - num;
-    int x = sp;
-    while (x < sp + num) {
+static void opRead(Machine *m, int num) {
+    m->pc += 2;
+    m->sp = m->sp - num;
+    int x = m->sp;
+    while (x < m->sp + num) {
         x++;
-        scanf("%d", &store[store[x]]);
+        readInteger(&store[store[x]]);
     }
-}    
+}
 
-static void opWrite(int num) {
-    pc += 2;
-    sp = sp - num;
-    int x = sp;
-    while (x < sp + num) {
+/* Reads a whole array in one block */
+static void opReadArray(Machine *m, int count) {
+    readIntegers(&store[store[m->sp]], count);
+    m->sp--;
+    m->pc += 2;
+}
+
+static void opWrite(Machine *m, int num) {
+    m->pc += 2;
+    m->sp = m->sp - num;
+    int x = m->sp;
+    while (x < m->sp + num) {
         x++;
-        printf("%d\n", store[x]);
+        writeInteger(store[x]);
     }
 }
 
-static void opAssign(int num) {
-    pc += 2;
-    sp = sp - 2 * num;
-    int x = sp;
-    while (x < sp + num) {
+static void opAssign(Machine *m, int num) {
+    m->pc += 2;
+    m->sp = m->sp - 2 * num;
+    int x = m->sp;
+    while (x < m->sp + num) {
         x++;
         store[store[x]] = store[x + num];
     }
 }
 
-static void opCall(int level, int addr) {
-    allocate(3);
-    int x = bp;
+static void storeBit(int bit, int32_t value) {
+    uint32_t *word = (uint32_t*)&store[bit >> 5];
+    uint32_t mask = 1u << (bit & 31);
+    *word = value ? *word | mask : *word & ~mask;
+}
+
+/* Same as opAssign with targets that may be elements of packed Boolean arrays */
+static void opAssignBits(Machine *m, int num) {
+    m->pc += 2;
+    m->sp = m->sp - 2 * num;
+    int x = m->sp;
+    while (x < m->sp + num) {
+        x++;
+        if (store[x] < 0) {
+            storeBit(-1 - store[x], store[x + num]);
+        } else {
+            store[store[x]] = store[x + num];
+        }
+    }
+}
+
+/* Both arrays have count elements, checked by the compiler */
+static void opCopy(Machine *m, int count) {
+    m->sp -= 2;
+    memmove(&store[store[m->sp + 1]], &store[store[m->sp + 2]], count * sizeof(int32_t));
+    m->pc += 2;
+}
+
+/* A plain loop, which the C compiler turns into vector stores */
+static void opFill(Machine *m, int count) {
+    int32_t value = store[m->sp];
+    int32_t *element = &store[store[m->sp - 1]];
+    m->sp -= 2;
+    for (int i = 0; i < count; i++) {
+        element[i] = value;
+    }
+    m->pc += 2;
+}
+
+/* Fills the words of a packed Boolean array, the bits after its last element included */
+static void opFillBits(Machine *m, int words) {
+    int32_t value = store[m->sp] ? -1 : 0;
+    int32_t *word = &store[store[m->sp - 1]];
+    m->sp -= 2;
+    for (int i = 0; i < words; i++) {
+        word[i] = value;
+    }
+    m->pc += 2;
+}
+
+static void opCall(Machine *m, int level, int addr) {
+    spendStep(m);
+    allocate(m, 3);
+    int x = m->bp;
     while (level > 0) {
         x = store[x];
         level = level - 1;
     }
-    store[sp - 2] = x;
-    store[sp - 1] = bp;
-    store[sp] = pc + 3;
-    bp = sp - 2;
-    pc = addr;
+    store[m->sp - 2] = x;
+    store[m->sp - 1] = m->bp;
+    store[m->sp] = m->pc + 3;
+    m->bp = m->sp - 2;
+    m->pc = addr;
+}
+
+static void opArrow(Machine *m, int addr) {
+    if (store[m->sp] == 1) {
+        m->pc += 2;
+    } else {
+        m->pc = addr;
+    }
+    m->sp--;
+}
+
+static void opJumpEqual(Machine *m, int addr) {
+    m->sp -= 2;
+    if (store[m->sp + 1] == store[m->sp + 2]) {
+        spendStep(m);
+        m->pc = addr;
+    } else {
+        m->pc += 2;
+    }
 }
 
-static void opArrow(int addr) {
-    if (store[sp] == 1) {
-        pc += 2;
+static void opJumpFalse(Machine *m, int addr) {
+    if (store[m->sp] == 0) {
+        spendStep(m);
+        m->pc = addr;
     } else {
-        pc = addr;
+        m->pc += 2;
     }
-    sp--;
+    m->sp--;
 }
 
-static void opBar(int addr) {
-    pc = addr;
+static void opJumpGreater(Machine *m, int addr) {
+    m->sp -= 2;
+    if (store[m->sp + 1] > store[m->sp + 2]) {
+        spendStep(m);
+        m->pc = addr;
+    } else {
+        m->pc += 2;
+    }
 }
 
-static void opFi(int line) {
-    error(line, "If Statement Fails");
+static void opJumpLess(Machine *m, int addr) {
+    m->sp -= 2;
+    if (store[m->sp + 1] < store[m->sp + 2]) {
+        spendStep(m);
+        m->pc = addr;
+    } else {
+        m->pc += 2;
+    }
 }
 
-static void opProc(int varLen, int addr) {
-    allocate(varLen);
-    pc = addr;
+static void opJumpTrue(Machine *m, int addr) {
+    if (store[m->sp] == 1) {
+        spendStep(m);
+        m->pc = addr;
+    } else {
+        m->pc += 2;
+    }
+    m->sp--;
 }
 
-static void opEndProc() {
-    sp = bp - 1;
-    pc = store[bp + 2];
-    bp = store[bp + 1];
+/* Jumps back to the guards of a loop or forward past an if statement */
+static void opBar(Machine *m, int addr) {
+    if (addr < m->pc) {
+        spendStep(m);
+    }
+    m->pc = addr;
 }
 
-static void opEndProg() {
+static void opFi(Machine *m) {
+    error(m, "If Statement Fails");
+}
+
+static void opProc(Machine *m, int varLen, int addr) {
+    if (reserve(m, m->pc)) {
+        allocate(m, varLen);
+        m->pc = addr;
+    }
+}
+
+static void opProg(Machine *m, int varLen, int addr) {
+    m->bp = stackBottom;
+    store[m->bp] = 0;
+    store[m->bp + 1] = 0;
+    store[m->bp + 2] = 0;
+    m->sp = m->bp + 2;
+    if (reserve(m, m->pc)) {
+        allocate(m, varLen);
+        m->pc = addr;
+    }
+}
+
+static void opEndProc(Machine *m) {
+    m->sp = m->bp - 1;
+    m->pc = store[m->bp + 2];
+    m->bp = store[m->bp + 1];
+}
+
+static void opEndProg(Machine *m) {
     isRunning = false;
 }
 
-static void loadProgram() {
-    //TODO: How to load program?
+static void runBranches(Machine *m, int end);
+
+/* The branches of a par statement run one after another unless runParallel runs them on
+   several threads */
+static void opPar(Machine *m, int end) {
+    if (isParallel && m->parDepth < MAX_PAR_DEPTH) {
+        runBranches(m, end);
+    } else {
+        m->pc += 2;
+    }
 }
 
-static void runProgram() {
+static void runChunks(Machine *m, int counterAddr, int first, int last, int end);
+
+/* SPLIT end takes the address of a loop's counter and its limit. The loop runs its iterations
+   itself unless runParallel has the threads for enough work, in which case the branch after
+   SPLIT runs every iteration and the counter is left at the limit. */
+static void opSplit(Machine *m, int end) {
+    int counterAddr = store[m->sp - 1];
+    int last = store[m->sp];
+    int first = store[counterAddr];
+    m->sp -= 2;
+    if (isParallel && m->parDepth < MAX_PAR_DEPTH && ((int64_t)last - first) * (end - m->pc) >= SPLIT_WORK) {
+        runChunks(m, counterAddr, first, last, end);
+    }
+    m->pc = end;
+}
+
+static void opBranch(Machine *m) {
+    m->pc += 2;
+}
+
+static void opEndBranch(Machine *m) {
+    m->pc++;
+}
+
+/* The code stays referenced for the line numbers of run time errors. It is verified first, so
+   that the stack only needs checking on block entry. */
+bool loadProgram(const Code *code) {
+    if (code->length >= MAX_STORE) {
+        reportError(0, "Program too big");
+        return false;
+    }
+    needs = realloc(needs, (code->length + 1) * sizeof(int32_t));
+    int at;
+    const char *error = verifyCode(code, needs, &at);
+    if (error) {
+        char text[128];
+        snprintf(text, sizeof(text), "Invalid code at %d: %s", at, error);
+        reportError(0, text);
+        return false;
+    }
+    memcpy(store, code->words, code->length * sizeof(int32_t));
+    stackBottom = code->length;
+    program = code;
+    hasPar = false;
+    for (int i = 0; i < code->length; i += getOpLength(code->words[i])) {
+        hasPar = hasPar || code->words[i] == OP_PAR || code->words[i] == OP_SPLIT;
+    }
+    return true;
+}
+
+/* Clears the store above the code, so that a run of the loaded program starts as its first
+   run did */
+void resetProgram() {
+    memset(&store[stackBottom], 0, (MAX_STORE - stackBottom) * sizeof(int32_t));
+}
+
+static inline void execute(Machine *m, OpCode op) {
+    switch (op) {
+        case OP_ADD: opAdd(m); break;
+        case OP_AND: opAnd(m); break;
+        case OP_ARROW: opArrow(m, store[m->pc + 1]); break;
+        case OP_ASSIGN: opAssign(m, store[m->pc + 1]); break;
+        case OP_ASSIGNBITS: opAssignBits(m, store[m->pc + 1]); break;
+        case OP_BAR: opBar(m, store[m->pc + 1]); break;
+        case OP_BRANCH: opBranch(m); break;
+        case OP_CALL: opCall(m, store[m->pc + 1], store[m->pc + 2]); break;
+        case OP_CONSTANT: opConstant(m, store[m->pc + 1]); break;
+        case OP_COPY: opCopy(m, store[m->pc + 1]); break;
+        case OP_COUNTER: opCounter(m); break;
+        case OP_DIVIDE: opDivide(m); break;
+        case OP_ENDBRANCH: opEndBranch(m); break;
+        case OP_ENDPROC: opEndProc(m); break;
+        case OP_ENDPROG: opEndProg(m); break;
+        case OP_EQUAL: opEqual(m); break;
+        case OP_FI: opFi(m); break;
+        case OP_FILL: opFill(m, store[m->pc + 1]); break;
+        case OP_FILLBITS: opFillBits(m, store[m->pc + 1]); break;
+        case OP_GREATER: opGreater(m); break;
+        case OP_INDEX: opIndex(m, store[m->pc + 1]); break;
+        case OP_INDEXBIT: opIndexBit(m, store[m->pc + 1]); break;
+        case OP_JUMPEQUAL: opJumpEqual(m, store[m->pc + 1]); break;
+        case OP_JUMPFALSE: opJumpFalse(m, store[m->pc + 1]); break;
+        case OP_JUMPGREATER: opJumpGreater(m, store[m->pc + 1]); break;
+        case OP_JUMPLESS: opJumpLess(m, store[m->pc + 1]); break;
+        case OP_JUMPTRUE: opJumpTrue(m, store[m->pc + 1]); break;
+        case OP_LESS: opLess(m); break;
+        case OP_MINUS: opMinus(m); break;
+        case OP_MODULO: opModulo(m); break;
+        case OP_MULTIPLY: opMultiply(m); break;
+        case OP_NOT: opNot(m); break;
+        case OP_OR: opOr(m); break;
+        case OP_PAR: opPar(m, store[m->pc + 1]); break;
+        case OP_PROC: opProc(m, store[m->pc + 1], store[m->pc + 2]); break;
+        case OP_PROG: opProg(m, store[m->pc + 1], store[m->pc + 2]); break;
+        case OP_READ: opRead(m, store[m->pc + 1]); break;
+        case OP_READARRAY: opReadArray(m, store[m->pc + 1]); break;
+        case OP_SPLIT: opSplit(m, store[m->pc + 1]); break;
+        case OP_SUBTRACT: opSubtract(m); break;
+        case OP_VALUE: opValue(m); break;
+        case OP_VALUEBIT: opValueBit(m); break;
+        case OP_VARIABLE: opVariable(m, store[m->pc + 1], store[m->pc + 2]); break;
+        case OP_WRITE: opWrite(m, store[m->pc + 1]); break;
+        default:
+            printf("Invalid instruction %d at %d\n", op, m->pc);
+            stop();
+            break;
+    }
+}
+
+/* Machine of a run on the calling thread with its stack below stackLimit */
+static Machine startRun(int stackLimit) {
     isRunning = true;
-    pc = 0;
+    hasFailed = false;
+    startBudget();
+    return (Machine){.pc = 0, .stackLimit = stackLimit};
+}
+
+/* Runs from the pc of m up to stop, or until the program stops or m is holding an error */
+static void runUntil(Machine *m, int stop) {
+    Machine local = *m;
+    while (isRunning && !local.failure && local.pc != stop) {
+        execute(&local, store[local.pc]);
+    }
+    *m = local;
+}
+
+static bool runMain(int stackLimit) {
+    Machine m = startRun(stackLimit);
     while (isRunning) {
-        OpCode op = store[pc];
-        if (op <= OP_BAR) {
-            switch(op) {
-                case OP_ADD:
-                    opAdd();
-                    break;
-                case OP_AND:
-                    opAnd();
-                    break;
-                case OP_ARROW:
-                    opArrow(store[p + 1]);
-                    break;
-                case OP_ASSIGN:
-                    opAssign(store[p + 1]);
-                    break;
-                case OP_BAR:
-                    opBar(store[p + 1]);
-                    break;
+        execute(&m, store[m.pc]);
+    }
+    stopBudget();
+    return !hasFailed;
+}
+
+/* Returns false if the program stopped with a run time error */
+bool runProgram() {
+    return runMain(MAX_STORE);
+}
+
+/* Same as runProgram but counts every instruction and block activation. Kept
+   apart so that runProgram carries no profiling code. */
+bool profileProgram(Profile *profile) {
+    Machine m = startRun(MAX_STORE);
+    enterBlock(profile, 0);
+    while (isRunning) {
+        OpCode op = store[m.pc];
+        if (op > 0 && op < OP_COUNT && m.pc < profile->codeLength) {
+            profile->opCounts[op]++;
+            profile->pcCounts[m.pc]++;
+        }
+        if (op == OP_CALL) {
+            enterBlock(profile, store[m.pc + 2]);
+        } else if (op == OP_ENDPROC) {
+            leaveBlock(profile);
+        }
+        execute(&m, op);
+    }
+    stopBudget();
+    while (profile->depth > 0) {
+        leaveBlock(profile);
+    }
+    return !hasFailed;
+}
+
+/* Same as runProgram but leaves the address and frame of every instruction where
+   readCallStack finds them */
+bool sampleProgram() {
+    Machine m = startRun(MAX_STORE);
+    while (isRunning) {
+        sampledPc = m.pc;
+        sampledBp = m.bp;
+        execute(&m, store[m.pc]);
+    }
+    stopBudget();
+    return !hasFailed;
+}
+
+/* Walks the dynamic links of a run of sampleProgram for the sampling profiler. The block of a
+   frame is the target of the CALL before its return address; the frames of deep stacks above
+   max are left out. */
+int readCallStack(int32_t *blocks, int max, int *at) {
+    if (!isRunning) {
+        return 0;
+    }
+    *at = sampledPc;
+    int depth = 0;
+    int frame = sampledBp;
+    while (frame > stackBottom && frame + 2 < MAX_STORE && depth < max - 1) {
+        int ret = store[frame + 2];
+        if (ret < 3 || ret > program->length) {
+            break;
+        }
+        blocks[depth++] = store[ret - 1];
+        frame = store[frame + 1];
+    }
+    blocks[depth++] = 0;
+    return depth;
+}
+
+/* Same as runProgram but records every instruction in the ring of traceRing, which is dumped
+   when the program fails */
+bool traceProgram(Trace *traceRing) {
+    trace = traceRing;
+    Machine m = startRun(MAX_STORE);
+    while (isRunning) {
+        traceStep(traceRing, m.pc, m.sp, store[m.sp]);
+        execute(&m, store[m.pc]);
+    }
+    stopBudget();
+    trace = NULL;
+    return !hasFailed;
+}
+
+/* Queues a task of the calling thread and wakes one thread without work */
+static void pushTask(Machine *m, Task task) {
+    TaskDeque *deque = &deques[m->worker];
+    mtx_lock(&deque->lock);
+    if (deque->tail >= deque->capacity) {
+        deque->capacity = deque->capacity ? 2 * deque->capacity : 16;
+        deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(Task));
+    }
+    deque->tasks[deque->tail++] = task;
+    mtx_unlock(&deque->lock);
+    
+    mtx_lock(&idleLock);
+    queuedTasks++;
+    if (idleWorkers > 0) {
+        cnd_signal(&workAdded);
+    }
+    mtx_unlock(&idleLock);
+}
+
+/* Takes back the last task a thread left if it belongs to join. The deque is locked. */
+static bool takeTask(TaskDeque *deque, const Join *join, Task *task) {
+    if (deque->tail == deque->head || deque->tasks[deque->tail - 1].join != join) {
+        return false;
+    }
+    *task = deque->tasks[--deque->tail];
+    if (deque->tail == deque->head) {
+        deque->head = deque->tail = 0;
+    }
+    queuedTasks--;
+    return true;
+}
+
+/* Steals the oldest task of the first thread after this one that has any */
+static bool stealTask(const Machine *m, Task *task) {
+    for (int i = 1; i <= workerCount; i++) {
+        TaskDeque *deque = &deques[(m->worker + i) % workerCount];
+        mtx_lock(&deque->lock);
+        bool isStolen = deque->tail > deque->head;
+        if (isStolen) {
+            *task = deque->tasks[deque->head++];
+            if (deque->tail == deque->head) {
+                deque->head = deque->tail = 0;
+            }
+            queuedTasks--;
+        }
+        mtx_unlock(&deque->lock);
+        if (isStolen) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Counts a task as done, waking the thread that joins its statement after the last one. The
+   join may be gone once it is counted, so its owner is read first. */
+static void finishTask(const Task *task) {
+    TaskDeque *owner = &deques[task->join->owner];
+    if (atomic_fetch_sub(&task->join->pending, 1) == 1) {
+        mtx_lock(&owner->lock);
+        cnd_signal(&owner->joined);
+        mtx_unlock(&owner->lock);
+    }
+}
+
+/* Runs iterations [first, last) of a split loop, each of them from the branch at start up to
+   its ENDBRANCH at stop, until one fails or an earlier one failed. The first iteration failing
+   is kept in split. Every iteration spends the step its loop would have spent branching back. */
+static void runIterations(Machine *m, Split *split, int start, int stop, int first, int last) {
+    bool wasHolding = m->isHolding;
+    m->isHolding = true;
+    for (int i = first; i < last && isRunning && i < atomic_load_explicit(&split->failed, memory_order_relaxed); i++) {
+        m->counter = i;
+        m->pc = start;
+        spendStep(m);
+        runUntil(m, stop);
+        if (m->failure) {
+            mtx_lock(&split->lock);
+            if (i < split->failed) {
+                split->failed = i;
+                split->failure = m->failure;
+                split->failPc = m->failPc;
             }
-        } else if (op <= OP_LESS) {
-            //TODO: Complete
+            mtx_unlock(&split->lock);
+            m->failure = NULL;
+            break;
+        }
+    }
+    m->isHolding = wasHolding;
+}
+
+/* Runs a task on the stack of this thread above what it holds. A task taken once the program
+   stopped is only counted as done. */
+static void runTask(Machine *m, const Task *task) {
+    Machine saved = *m;
+    if (isRunning && reserve(m, task->par)) {
+        m->pc = task->start;
+        m->bp = task->bp;
+        m->parDepth++;
+        if (task->split) {
+            runIterations(m, task->split, task->start, task->stop, task->first, task->last);
+        } else {
+            runUntil(m, task->stop);
+        }
+        m->parDepth--;
+    }
+    m->counter = saved.counter;
+    m->pc = saved.pc;
+    m->bp = saved.bp;
+    m->sp = saved.sp;
+    finishTask(task);
+}
+
+/* Waits until the tasks counted by join are done, running those no other thread took */
+static void joinTasks(Machine *m, Join *join) {
+    TaskDeque *deque = &deques[m->worker];
+    Task task;
+    mtx_lock(&deque->lock);
+    while (atomic_load(&join->pending) > 0) {
+        if (takeTask(deque, join, &task)) {
+            mtx_unlock(&deque->lock);
+            runTask(m, &task);
+            mtx_lock(&deque->lock);
+        } else {
+            cnd_wait(&deque->joined, &deque->lock);
+        }
+    }
+    mtx_unlock(&deque->lock);
+}
+
+/* Leaves every branch of the par statement at pc but the first to whichever thread takes it
+   first, runs the first one and waits for the others. Meanwhile the thread runs the branches no
+   other thread took itself. */
+static void runBranches(Machine *m, int end) {
+    int par = m->pc;
+    Join join = {.owner = m->worker};
+    atomic_init(&join.pending, 0);
+    for (int branch = store[par + 3]; branch < end; branch = store[branch + 1]) {
+        atomic_fetch_add(&join.pending, 1);
+        pushTask(m, (Task){branch + 2, store[branch + 1] - 1, m->bp, par, &join, NULL, 0, 0});
+    }
+    
+    m->parDepth++;
+    m->pc = par + 4;
+    runUntil(m, store[par + 3] - 1);
+    m->parDepth--;
+    joinTasks(m, &join);
+    m->pc = end;
+}
+
+/* Cuts the iterations [first, last) of the loop split at pc into chunks, leaves all but the
+   first to other threads and runs the first one. Once all are done the error of the first
+   iteration that failed is reported, as running them in order would have, or else the counter
+   at counterAddr is set to last. */
+static void runChunks(Machine *m, int counterAddr, int first, int last, int end) {
+    int at = m->pc;
+    int chunks = workerCount * CHUNKS_PER_THREAD;
+    int64_t count = (int64_t)last - first;
+    if (chunks > count) {
+        chunks = count;
+    }
+    Split split = {.failure = NULL, .failPc = 0};
+    atomic_init(&split.failed, INT_MAX);
+    mtx_init(&split.lock, mtx_plain);
+    Join join = {.owner = m->worker};
+    atomic_init(&join.pending, 0);
+    for (int i = 1; i < chunks; i++) {
+        int from = first + count * i / chunks;
+        int to = first + count * (i + 1) / chunks;
+        atomic_fetch_add(&join.pending, 1);
+        pushTask(m, (Task){at + 4, end - 1, m->bp, at, &join, &split, from, to});
+    }
+    
+    int savedCounter = m->counter;
+    m->parDepth++;
+    runIterations(m, &split, at + 4, end - 1, first, first + count / chunks);
+    m->parDepth--;
+    joinTasks(m, &join);
+    m->counter = savedCounter;
+    mtx_destroy(&split.lock);
+    if (split.failure) {
+        m->pc = split.failPc;
+        error(m, split.failure);
+    } else {
+        store[counterAddr] = last;
+    }
+}
+
+/* Thread that steals branches of par statements and runs them on its own stack until the
+   program ends, sleeping while no task is queued */
+static int runWorker(void *arg) {
+    int mainLimit = stackBottom + (MAX_STORE - stackBottom) / 2;
+    int size = (MAX_STORE - mainLimit) / (workerCount - 1);
+    Machine m = {.worker = (int)(intptr_t)arg};
+    m.sp = mainLimit + (m.worker - 1) * size - 1;
+    m.stackLimit = m.sp + 1 + size;
+    Task task;
+    while (true) {
+        if (stealTask(&m, &task)) {
+            runTask(&m, &task);
+            continue;
         }
+        mtx_lock(&idleLock);
+        bool isDone = isFinished;
+        if (!isDone && queuedTasks == 0) {
+            idleWorkers++;
+            cnd_wait(&workAdded, &idleLock);
+            idleWorkers--;
+        }
+        mtx_unlock(&idleLock);
+        if (isDone) {
+            return 0;
+        }
+    }
+}
+
+/* Same as runProgram but runs the branches of par statements on up to threadCount threads,
+   which steal them from each other. The thread running the program keeps half of the store
+   above the code for its stack, the others share the rest. */
+bool runParallel(int threadCount) {
+    if (threadCount < 2 || !hasPar) {
+        return runProgram();
     }
-}
\ No newline at end of file
+    workerCount = threadCount;
+    deques = calloc(workerCount, sizeof(TaskDeque));
+    for (int i = 0; i < workerCount; i++) {
+        mtx_init(&deques[i].lock, mtx_plain);
+        cnd_init(&deques[i].joined);
+    }
+    mtx_init(&idleLock, mtx_plain);
+    cnd_init(&workAdded);
+    queuedTasks = 0;
+    idleWorkers = 0;
+    isFinished = false;
+    isParallel = true;
+    thrd_t *threads = malloc(workerCount * sizeof(thrd_t));
+    int started = 1;
+    while (started < workerCount
+           && thrd_create(&threads[started], runWorker, (void*)(intptr_t)started) == thrd_success) {
+        started++;
+    }
+    bool success = runMain(stackBottom + (MAX_STORE - stackBottom) / 2);
+    
+    mtx_lock(&idleLock);
+    isFinished = true;
+    cnd_broadcast(&workAdded);
+    mtx_unlock(&idleLock);
+    for (int i = 1; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    free(threads);
+    for (int i = 0; i < workerCount; i++) {
+        free(deques[i].tasks);
+        cnd_destroy(&deques[i].joined);
+        mtx_destroy(&deques[i].lock);
+    }
+    free(deques);
+    cnd_destroy(&workAdded);
+    mtx_destroy(&idleLock);
+    isParallel = false;
+    return success;
+}
@@ -1,36 +1,70 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
-#define MAX_STORE 4000
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_STORE 1000000
 
 typedef enum {
     OP_ADD = 1,
     OP_AND,
     OP_ARROW,
     OP_ASSIGN,
+    OP_ASSIGNBITS,
     OP_BAR,
+    OP_BRANCH,
     OP_CALL,
     OP_CONSTANT,
+    OP_COPY,
+    OP_COUNTER,
     OP_DIVIDE,
+    OP_ENDBRANCH,
     OP_ENDPROC,
     OP_ENDPROG,
     OP_EQUAL,
     OP_FI,
+    OP_FILL,
+    OP_FILLBITS,
     OP_GREATER,
     OP_INDEX,
+    OP_INDEXBIT,
+    OP_JUMPEQUAL,
+    OP_JUMPFALSE,
+    OP_JUMPGREATER,
+    OP_JUMPLESS,
+    OP_JUMPTRUE,
     OP_LESS,
     OP_MINUS,
     OP_MODULO,
     OP_MULTIPLY,
     OP_NOT,
     OP_OR,
+    OP_PAR,
     OP_PROC,
     OP_PROG,
     OP_READ,
+    OP_READARRAY,
+    OP_SPLIT,
     OP_SUBTRACT,
     OP_VALUE,
+    OP_VALUEBIT,
     OP_VARIABLE,
-    OP_WRITE
+    OP_WRITE,
+    OP_COUNT
 } OpCode;
 
+typedef struct Code Code;
+typedef struct Profile Profile;
+typedef struct Trace Trace;
+
+bool loadProgram(const Code *code);
+void resetProgram();
+bool runProgram();
+bool runParallel(int threadCount);
+bool profileProgram(Profile *profile);
+bool sampleProgram();
+bool traceProgram(Trace *traceRing);
+int readCallStack(int32_t *blocks, int max, int *at);
+
 #endif
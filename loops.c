@@ -0,0 +1,314 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loops.h"
+
+#define INCREMENT_WORDS 12
+
+/* How an address on the stack of a loop body selects its variable or array element */
+typedef enum {
+    SELECT_NONE,
+    SELECT_COUNTER,
+    SELECT_OTHER
+} Selector;
+
+/* What the analysis of a loop body knows of a word on the stack: a value, a constant, the
+   counter or the address of the variable levelDiff, displ selected by select */
+typedef struct {
+    enum {
+        ENTRY_VALUE,
+        ENTRY_CONSTANT,
+        ENTRY_COUNTER,
+        ENTRY_ADDRESS
+    } kind;
+    int value;
+    int levelDiff;
+    int displ;
+    Selector select;
+} Entry;
+
+/* A read or write of a variable or array by a loop body */
+typedef struct {
+    int levelDiff;
+    int displ;
+    Selector select;
+    bool isWrite;
+} Use;
+
+/* A counted loop do i < N -> S; i := i + 1 od with one guarded command, compiled by the parser
+   as VARIABLE i VALUE N LESS ARROW end; S; i := i + 1; VARIABLE i VALUE N JUMPLESS body. The
+   counter i is the variable levelDiff, displ, the limit N runs from limit up to the LESS at test
+   and S from body up to increment. */
+typedef struct {
+    int start;
+    int limit;
+    int test;
+    int body;
+    int increment;
+    int end;
+    int levelDiff;
+    int displ;
+} CountedLoop;
+
+typedef struct {
+    Entry *stack;
+    int depth;
+    Use *uses;
+    int useCount;
+} Analysis;
+
+static bool isCounter(const CountedLoop *loop, const int32_t *words) {
+    return words[0] == OP_VARIABLE && words[1] == loop->levelDiff && words[2] == loop->displ;
+}
+
+/* Finds the parts of the counted loop from start up to the end of code */
+static bool findCountedLoop(const Code *code, int start, CountedLoop *loop) {
+    const int32_t *words = code->words;
+    int end = code->length;
+    if (end - start < 4 || words[start] != OP_VARIABLE || words[start + 3] != OP_VALUE) {
+        return false;
+    }
+    *loop = (CountedLoop){start, start + 4, -1, -1, -1, end, words[start + 1], words[start + 2]};
+    int pc = loop->limit;
+    while (pc < end && words[pc] != OP_ARROW) {
+        if (isJump(words[pc]) || isCounter(loop, &words[pc])) {
+            return false;
+        }
+        loop->test = pc;
+        pc += getOpLength(words[pc]);
+    }
+    if (pc + 1 >= end || loop->test < loop->limit || words[loop->test] != OP_LESS || words[pc + 1] != end) {
+        return false;
+    }
+    loop->body = pc + 2;
+    int guardWords = loop->test - start;
+    int guard = end - guardWords - 2;
+    loop->increment = guard - INCREMENT_WORDS;
+    if (loop->increment < loop->body || memcmp(&words[guard], &words[start], guardWords * sizeof(int32_t)) != 0
+        || words[end - 2] != OP_JUMPLESS || words[end - 1] != loop->body) {
+        return false;
+    }
+    const int32_t *inc = &words[loop->increment];
+    return isCounter(loop, inc) && isCounter(loop, &inc[3]) && inc[6] == OP_VALUE && inc[7] == OP_CONSTANT
+        && inc[8] == 1 && inc[9] == OP_ADD && inc[10] == OP_ASSIGN && inc[11] == 1;
+}
+
+static void push(Analysis *a, Entry entry) {
+    a->stack[a->depth++] = entry;
+}
+
+static void addUse(Analysis *a, const Entry *address, bool isWrite) {
+    a->uses[a->useCount++] = (Use){address->levelDiff, address->displ, address->select, isWrite};
+}
+
+static bool isInBody(const CountedLoop *loop, int target) {
+    return target >= loop->body && target <= loop->increment;
+}
+
+/* Follows the stack through one instruction of the body, false if the instruction may keep
+   iterations from running independently */
+static bool analyzeInstruction(Analysis *a, const CountedLoop *loop, const int32_t *words) {
+    OpCode op = words[0];
+    int pops = op == OP_ASSIGN ? 2 * words[1] : 0;
+    if (op == OP_ADD || op == OP_AND || op == OP_DIVIDE || op == OP_EQUAL || op == OP_GREATER
+        || op == OP_INDEX || op == OP_INDEXBIT || op == OP_LESS || op == OP_MODULO || op == OP_MULTIPLY
+        || op == OP_OR || op == OP_SUBTRACT || op == OP_JUMPEQUAL || op == OP_JUMPGREATER || op == OP_JUMPLESS) {
+        pops = 2;
+    } else if (op == OP_MINUS || op == OP_NOT || op == OP_VALUE || op == OP_VALUEBIT || op == OP_ARROW
+               || op == OP_JUMPFALSE || op == OP_JUMPTRUE) {
+        pops = 1;
+    }
+    if (a->depth < pops) {
+        return false;
+    }
+    Entry *top = a->depth > 0 ? &a->stack[a->depth - 1] : NULL;
+    switch (op) {
+        case OP_VARIABLE:
+            if (isCounter(loop, words) && words[3] != OP_VALUE) {
+                return false;
+            }
+            push(a, isCounter(loop, words) ? (Entry){ENTRY_COUNTER, 0, 0, 0, SELECT_NONE}
+                                           : (Entry){ENTRY_ADDRESS, 0, words[1], words[2], SELECT_NONE});
+            return true;
+        case OP_CONSTANT:
+            push(a, (Entry){ENTRY_CONSTANT, words[1], 0, 0, SELECT_NONE});
+            return true;
+        case OP_VALUE: case OP_VALUEBIT:
+            if (top->kind == ENTRY_COUNTER) {
+                return op == OP_VALUE;
+            } else if (top->kind != ENTRY_ADDRESS) {
+                return false;
+            }
+            addUse(a, top, false);
+            *top = (Entry){ENTRY_VALUE, 0, 0, 0, SELECT_NONE};
+            return true;
+        case OP_INDEX: case OP_INDEXBIT:
+            if (top[-1].kind != ENTRY_ADDRESS || top[-1].select != SELECT_NONE) {
+                return false;
+            }
+            top[-1].select = top->kind == ENTRY_COUNTER ? SELECT_COUNTER : SELECT_OTHER;
+            a->depth--;
+            return true;
+        case OP_DIVIDE: case OP_MODULO:
+            // A divisor of 0 or -1 may trap, which must not happen out of order
+            if (top->kind != ENTRY_CONSTANT || top->value == 0 || top->value == -1) {
+                return false;
+            }
+            a->depth--;
+            a->stack[a->depth - 1] = (Entry){ENTRY_VALUE, 0, 0, 0, SELECT_NONE};
+            return true;
+        case OP_ADD: case OP_AND: case OP_EQUAL: case OP_GREATER: case OP_LESS: case OP_MULTIPLY:
+        case OP_OR: case OP_SUBTRACT:
+            a->depth--;
+            a->stack[a->depth - 1] = (Entry){ENTRY_VALUE, 0, 0, 0, SELECT_NONE};
+            return true;
+        case OP_MINUS: case OP_NOT:
+            *top = (Entry){ENTRY_VALUE, 0, 0, 0, SELECT_NONE};
+            return true;
+        case OP_ASSIGN:
+            for (int i = a->depth - pops; i < a->depth - pops / 2; i++) {
+                if (a->stack[i].kind != ENTRY_ADDRESS) {
+                    return false;
+                }
+                addUse(a, &a->stack[i], true);
+            }
+            a->depth -= pops;
+            return true;
+        case OP_ARROW: case OP_BAR: case OP_JUMPEQUAL: case OP_JUMPFALSE: case OP_JUMPGREATER:
+        case OP_JUMPLESS: case OP_JUMPTRUE:
+            a->depth -= pops;
+            return isInBody(loop, words[1]);
+        case OP_FI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Iterations are independent when the body writes nothing but elements of arrays selected by
+   the counter, and reads those arrays only at the same element. Other variables and arrays are
+   only read, so neither the body nor the limit sees a change from another iteration. Calls,
+   input and output, and divisions that may trap keep a loop in order. */
+static bool isIndependent(const Code *code, const CountedLoop *loop) {
+    const int32_t *words = code->words;
+    int size = loop->increment - loop->limit + 1;
+    Analysis a = {malloc(size * sizeof(Entry)), 0, malloc(size * sizeof(Use)), 0};
+    bool ok = true;
+    for (int pc = loop->limit; ok && pc < loop->test; pc += getOpLength(words[pc])) {
+        ok = analyzeInstruction(&a, loop, &words[pc]);
+    }
+    ok = ok && a.depth == 1;
+    int limitUses = a.useCount;
+    a.depth = 0;
+    for (int pc = loop->body; ok && pc < loop->increment; pc += getOpLength(words[pc])) {
+        ok = analyzeInstruction(&a, loop, &words[pc]);
+    }
+    ok = ok && a.depth == 0;
+    for (int i = limitUses; ok && i < a.useCount; i++) {
+        const Use *use = &a.uses[i];
+        if (use->isWrite && use->select != SELECT_COUNTER) {
+            ok = false;
+        }
+        for (int j = 0; ok && j < a.useCount; j++) {
+            const Use *other = &a.uses[j];
+            if (use->isWrite && other->levelDiff == use->levelDiff && other->displ == use->displ) {
+                ok = j >= limitUses && other->select == SELECT_COUNTER;
+            }
+        }
+    }
+    free(a.stack);
+    free(a.uses);
+    return ok;
+}
+
+/* Fills lines[pc - start] with the source line of every address from start up to the end */
+static void getLines(const Code *code, int start, int *lines) {
+    int pos;
+    int runPc;
+    int runLine;
+    seekLine(code, start, &pos, &runPc, &runLine);
+    int line = runLine;
+    bool isRun = nextLineRun(code, &pos, &runPc, &runLine);
+    for (int pc = start; pc < code->length; pc++) {
+        while (isRun && runPc <= pc) {
+            line = runLine;
+            isRun = nextLineRun(code, &pos, &runPc, &runLine);
+        }
+        lines[pc - start] = line;
+    }
+}
+
+/* Words of the instruction at words, or of VARIABLE i VALUE reading the counter */
+static int getStep(const CountedLoop *loop, const int32_t *words) {
+    return isCounter(loop, words) ? 4 : getOpLength(words[0]);
+}
+
+/* Emits a copy of the instruction at words with its first operand set to arg */
+static void emitAt(Code *code, const int32_t *words, int line, int32_t arg) {
+    setLine(code, line);
+    int length = getOpLength(words[0]);
+    if (length == 1) {
+        emit0(code, words[0]);
+    } else if (length == 2) {
+        emit1(code, words[0], arg);
+    } else {
+        emit2(code, words[0], arg, words[2]);
+    }
+}
+
+/* Splits the counted loop from start up to the end of code if its iterations are independent.
+   The loop is emitted again after VARIABLE i N SPLIT end and a branch holding a copy of its
+   statements without the increment, where COUNTER stands for the value of i. SPLIT may run that
+   branch once for every iteration on several threads and leave i at N, so that the loop itself
+   ends at once. Returns whether the loop was split. */
+bool splitLoop(Code *code, int start) {
+    CountedLoop loop;
+    if (!findCountedLoop(code, start, &loop) || !isIndependent(code, &loop)) {
+        return false;
+    }
+    int length = loop.end - start;
+    int32_t *words = malloc(length * sizeof(int32_t));
+    int *lines = malloc(length * sizeof(int));
+    memcpy(words, &code->words[start], length * sizeof(int32_t));
+    getLines(code, start, lines);
+    int savedLine = code->line;
+    truncateCode(code, start);
+
+    setLine(code, lines[0]);
+    emit2(code, OP_VARIABLE, loop.levelDiff, loop.displ);
+    for (int pc = loop.limit; pc < loop.test; pc += getOpLength(words[pc - start])) {
+        emitAt(code, &words[pc - start], lines[pc - start], words[pc - start + 1]);
+    }
+    int split = emit1(code, OP_SPLIT, 0);
+    int branch = emit1(code, OP_BRANCH, 0);
+    int *map = malloc((loop.increment - loop.body + 1) * sizeof(int));
+    int addr = code->length;
+    for (int pc = loop.body; pc < loop.increment; pc += getStep(&loop, &words[pc - start])) {
+        map[pc - loop.body] = addr;
+        addr += isCounter(&loop, &words[pc - start]) ? 1 : getOpLength(words[pc - start]);
+    }
+    map[loop.increment - loop.body] = addr;
+    for (int pc = loop.body; pc < loop.increment; pc += getStep(&loop, &words[pc - start])) {
+        const int32_t *w = &words[pc - start];
+        if (isCounter(&loop, w)) {
+            setLine(code, lines[pc - start]);
+            emit0(code, OP_COUNTER);
+        } else {
+            emitAt(code, w, lines[pc - start], isJump(w[0]) ? map[w[1] - loop.body] : w[1]);
+        }
+    }
+    emit0(code, OP_ENDBRANCH);
+    patch(code, split + 1, code->length);
+    patch(code, branch + 1, code->length);
+
+    int shift = code->length - start;
+    for (int pc = start; pc < loop.end; pc += getOpLength(words[pc - start])) {
+        const int32_t *w = &words[pc - start];
+        emitAt(code, w, lines[pc - start], isJump(w[0]) ? w[1] + shift : w[1]);
+    }
+    setLine(code, savedLine);
+    free(map);
+    free(words);
+    free(lines);
+    return true;
+}
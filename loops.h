@@ -0,0 +1,9 @@
+#ifndef LOOPS_H
+#define LOOPS_H
+
+#include <stdbool.h>
+#include "code.h"
+
+bool splitLoop(Code *code, int start);
+
+#endif
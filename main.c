@@ -1,33 +1,569 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "blocks.h"
+#include "budget.h"
+#include "cache.h"
+#include "code.h"
+#include "input.h"
+#include "interpreter.h"
+#include "memory.h"
 #include "scanner.h"
 #include "parser.h"
+#include "profile.h"
+#include "regvm.h"
+#include "sampler.h"
+#include "trace.h"
 
-int main(int argc, char* argv[]) {
-    if (argc >= 2) {
-        FILE *f = fopen(argv[1], "rb");
-        fseek(f, 0, SEEK_END);
-        int srcLen = ftell(f);
-        rewind(f);
-        char *src = (char*)malloc(srcLen+1);
-        size_t last = fread(src, 1, srcLen+1, f);
-        src[last] = '\0';
-        fclose(f);
-
-        initScan(src);
-        /*SymbolType type = scanNext();
-        while (type != T_EOF) {
-            printf("%d ", type);
-            type = scanNext();
-        }
-        putchar('\n');*/
-        if (parse()) {
-            puts("Success");
+#define CACHE_SIZE (64L * 1024 * 1024)
+
+typedef struct {
+    int threadCount;
+    int parThreads;
+    bool run;
+    bool profile;
+    bool registers;
+    const char *cacheDir;
+    long cacheSize;
+    bool cacheStats;
+    int inlineLimit;
+    bool removeDead;
+    bool deadStats;
+    const char *inputPath;
+    int traceCount;
+    int sampleRate;
+    const char *foldedPath;
+    bool watch;
+    bool stats;
+    int64_t maxSteps;
+    int64_t timeLimit;
+} Options;
+
+typedef struct {
+    const char *path;
+    FILE *log;
+    bool success;
+} Job;
+
+typedef struct {
+    Job *jobs;
+    int count;
+    int next;
+    Cache *cache;
+    const Options *options;
+    mtx_t lock;
+} JobQueue;
+
+static char *readSource(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    int srcLen = ftell(f);
+    rewind(f);
+    char *src = (char*)malloc(srcLen+1);
+    size_t last = fread(src, 1, srcLen+1, f);
+    src[last] = '\0';
+    fclose(f);
+    return src;
+}
+
+static void printRemoval(const char *path, const Removal *removal) {
+    fprintf(stderr, "%s: %d of %d procedures removed, %d bytes of code, %d frame words\n", path,
+        removal->procs, removal->procCount, removal->words * 4, removal->frameWords);
+}
+
+static double readSeconds() {
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Scans the whole source once more, without diagnostics, and returns the time it took */
+static double timeScan(char *src, long *tokens) {
+#ifdef _WIN32
+    FILE *quiet = fopen("NUL", "w");
+#else
+    FILE *quiet = fopen("/dev/null", "w");
+#endif
+    double start = readSeconds();
+    Scanner scanner;
+    initScan(&scanner, src, quiet ? quiet : stderr);
+    *tokens = 0;
+    while (scanNext(&scanner).type != T_EOF) {
+        (*tokens)++;
+    }
+    cleanScan(&scanner);
+    double seconds = readSeconds() - start;
+    if (quiet) {
+        fclose(quiet);
+    }
+    return seconds;
+}
+
+/* Compiles like parse, removing dead code apart to time it, and prints how long each phase
+   took and the memory the compiler used. The parser scans and emits code as it goes, so the
+   scanner is timed by scanning the source again once the memory is read, and that time is
+   taken off the parse. */
+static bool compileMeasured(Parser *parser, char *src, const char *path, bool removeDead) {
+    double start = readSeconds();
+    parser->removeDead = false;
+    bool success = parse(parser);
+    double parsed = readSeconds();
+    if (success && removeDead) {
+        removeDeadCode(&parser->code, &parser->removal);
+    }
+    double done = readSeconds();
+    MemUse uses[MEM_KINDS + 1];
+    for (int kind = 0; kind < MEM_KINDS; kind++) {
+        readMemUse(kind, &uses[kind]);
+    }
+    readMemTotal(&uses[MEM_KINDS]);
+    
+    long tokens;
+    double scanTime = timeScan(src, &tokens);
+    double parseTime = parsed - start > scanTime ? parsed - start - scanTime : 0;
+    fprintf(stderr, "%s: scan %.3f ms, parse and analysis %.3f ms, code passes %.3f ms\n", path,
+        scanTime * 1e3, parseTime * 1e3, (done - parsed) * 1e3);
+    fprintf(stderr, "%s: %ld tokens, %d names, %d object records, %d spelling bytes, "
+        "scope depth %d\n", path, tokens, parser->scanner.nameCount, parser->scope.recordCount,
+        parser->scanner.spelStore.loaded, parser->scope.maxLevel);
+    for (int kind = 0; kind <= MEM_KINDS; kind++) {
+        MemUse *use = &uses[kind];
+        fprintf(stderr, "%s: %s %lld bytes in %lld allocations, at most %lld held\n", path,
+            kind < MEM_KINDS ? getMemKindName(kind) : "total", use->allocated, use->allocations,
+            use->peak);
+    }
+    return success;
+}
+
+/* Compiles a source file into code, which may be NULL if the code is not needed, with its
+   procedure bodies spread over up to threadCount threads. Programs found in the cache are not
+   compiled again. */
+static bool compileFile(const char *path, FILE *log, const Options *options, int threadCount,
+        Cache *cache, Code *code) {
+    char *src = readSource(path);
+    if (!src) {
+        fprintf(log, "Cannot open '%s'\n", path);
+        return false;
+    }
+    char key[KEY_LEN + 1];
+    if (cache) {
+        char flags[32];
+        snprintf(flags, sizeof(flags), "inline=%d dead=%d", options->inlineLimit, options->removeDead);
+        cacheKey(src, flags, key);
+        Code cached;
+        initCode(&cached);
+        if (cacheLoad(cache, key, &cached)) {
+            if (code) {
+                *code = cached;
+            } else {
+                cleanCode(&cached);
+            }
+            free(src);
+            return true;
+        }
+    }
+    
+    Parser parser;
+    initParser(&parser, src, log);
+    parser.inlineLimit = options->inlineLimit;
+    parser.removeDead = options->removeDead;
+    bool success = options->stats ? compileMeasured(&parser, src, path, options->removeDead)
+                                  : parseParallel(&parser, threadCount);
+    if (success && options->deadStats) {
+        printRemoval(path, &parser.removal);
+    }
+    if (success && cache) {
+        cacheStore(cache, key, &parser.code);
+    }
+    if (success && code) {
+        *code = parser.code;
+        initCode(&parser.code);
+    }
+    cleanParser(&parser);
+    free(src);
+    return success;
+}
+
+static int compileWorker(void *arg) {
+    JobQueue *queue = arg;
+    while (true) {
+        mtx_lock(&queue->lock);
+        int i = queue->next++;
+        mtx_unlock(&queue->lock);
+        if (i >= queue->count) {
+            return 0;
+        }
+        Job *job = &queue->jobs[i];
+        job->success = compileFile(job->path, job->log, queue->options, 1, queue->cache, NULL);
+    }
+}
+
+/* Copies the diagnostics of a job to stdout prefixing every line with the file name */
+static void printJob(Job *job) {
+    rewind(job->log);
+    bool lineStart = true;
+    int c;
+    while ((c = fgetc(job->log)) != EOF) {
+        if (lineStart) {
+            printf("%s:", job->path);
+        }
+        putchar(c);
+        lineStart = (c == '\n');
+    }
+    printf("%s: %s\n", job->path, job->success ? "Success" : "Fail");
+    fclose(job->log);
+}
+
+/* Compiles every file with up to threadCount files in flight. Returns the number of failures. */
+static int compileAll(const char **paths, int count, const Options *options, Cache *cache) {
+    JobQueue queue = {.jobs = calloc(count, sizeof(Job)), .count = count, .next = 0, .cache = cache,
+                      .options = options};
+    int threadCount = options->threadCount;
+    mtx_init(&queue.lock, mtx_plain);
+    for (int i = 0; i < count; i++) {
+        queue.jobs[i].path = paths[i];
+        queue.jobs[i].log = tmpfile();
+        if (!queue.jobs[i].log) {
+            queue.jobs[i].log = stdout;
+        }
+    }
+    if (threadCount > count) {
+        threadCount = count;
+    }
+    thrd_t *threads = malloc(threadCount * sizeof(thrd_t));
+    int started = 0;
+    while (started < threadCount - 1
+           && thrd_create(&threads[started], compileWorker, &queue) == thrd_success) {
+        started++;
+    }
+    compileWorker(&queue);
+    for (int i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (!queue.jobs[i].success) {
+            failed++;
+        }
+        if (queue.jobs[i].log != stdout) {
+            printJob(&queue.jobs[i]);
+        }
+    }
+    mtx_destroy(&queue.lock);
+    free(threads);
+    free(queue.jobs);
+    return failed;
+}
+
+static void writeSampleStacks(const Sampler *sampler, const char *path) {
+    if (!path) {
+        return;
+    }
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Cannot write folded stacks to '%s'\n", path);
+        return;
+    }
+    writeFolded(sampler, f);
+    fclose(f);
+}
+
+static int compileOne(const char *path, Options *options, Cache *cache) {
+    if (!options->run) {
+        bool success = compileFile(path, stdout, options, options->threadCount, cache, NULL);
+        puts(success ? "Success" : "Fail");
+        return success ? 0 : 1;
+    }
+    Code code;
+    if (!compileFile(path, stdout, options, options->threadCount, cache, &code)) {
+        puts("Fail");
+        return 1;
+    }
+    if (options->inputPath && !openBinaryInput(options->inputPath)) {
+        printf("Cannot open input file '%s'\n", options->inputPath);
+        cleanCode(&code);
+        return 1;
+    }
+    Sampler sampler;
+    if (options->sampleRate > 0) {
+        initSampler(&sampler, &code, options->registers ? readRegisterCallStack : readCallStack);
+        if (!startSampler(&sampler, options->sampleRate)) {
+            puts("Cannot start the sampling profiler");
+        }
+    }
+    bool success = loadProgram(&code);
+    if (!success) {
+        // Nothing to run
+    } else if (options->registers) {
+        RegCode regCode;
+        initRegCode(&regCode);
+        if (translateCode(&code, &regCode) && loadRegisters(&regCode)) {
+            success = runRegisters();
         } else {
-            puts("Fail");
+            puts("Cannot translate program for the register machine");
+            success = false;
         }
-        cleanScan();
+        cleanRegCode(&regCode);
+    } else if (options->traceCount > 0) {
+        Trace *trace = malloc(sizeof(Trace));
+        initTrace(trace, &code, options->traceCount);
+        watchSignals(trace);
+        success = traceProgram(trace);
+        unwatchSignals();
+        free(trace);
+    } else if (options->profile) {
+        Profile profile;
+        initProfile(&profile, code.length);
+        success = profileProgram(&profile);
+        fflush(stdout);
+        printProfile(&profile, &code, stderr);
+        cleanProfile(&profile);
+    } else if (options->sampleRate > 0) {
+        success = sampleProgram();
     } else {
-        printf("Usage: %s <source file> [log file]\n", argv[0]);
+        success = runParallel(options->parThreads);
+    }
+    if (options->sampleRate > 0) {
+        stopSampler(&sampler);
+        fflush(stdout);
+        printSamples(&sampler, stderr);
+        writeSampleStacks(&sampler, options->foldedPath);
+        cleanSampler(&sampler);
     }
+    closeInput();
+    cleanCode(&code);
+    return success ? 0 : 1;
+}
+
+/* Modification time and size of a file, 0 if it cannot be read */
+static int64_t fileStamp(const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+#ifdef _WIN32
+    int64_t nanoseconds = (int64_t)st.st_mtime * 1000000000;
+#else
+    int64_t nanoseconds = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return nanoseconds ^ ((int64_t)st.st_size << 40);
+}
+
+static bool compileBlocks(const char *path, const Options *options, BlockCache *blocks) {
+    char *src = readSource(path);
+    if (!src) {
+        printf("Cannot open '%s'\n", path);
+        return false;
+    }
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    Parser parser;
+    initParser(&parser, src, stdout);
+    parser.inlineLimit = options->inlineLimit;
+    parser.removeDead = options->removeDead;
+    parser.blocks = blocks;
+    blocks->reused = 0;
+    blocks->compiled = 0;
+    bool success = parse(&parser);
+    finishBlocks(blocks, success);
+    timespec_get(&end, TIME_UTC);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf("%s in %.2f ms, %d procedures compiled, %d reused\n", success ? "Success" : "Fail", ms,
+        blocks->compiled, blocks->reused);
+    fflush(stdout);
+    if (success && options->deadStats) {
+        printRemoval(path, &parser.removal);
+    }
+    cleanParser(&parser);
+    free(src);
+    return success;
+}
+
+/* Compiles the file again whenever it changes. The procedure blocks of the last successful
+   compilation stay in memory, and those whose text and scope did not change are reused. */
+static int watchFile(const char *path, const Options *options) {
+    BlockCache blocks;
+    initBlockCache(&blocks);
+    int64_t stamp = fileStamp(path);
+    compileBlocks(path, options, &blocks);
+    while (true) {
+        thrd_sleep(&(struct timespec){.tv_nsec = 100000000}, NULL);
+        int64_t now = fileStamp(path);
+        if (now != stamp) {
+            stamp = now;
+            compileBlocks(path, options, &blocks);
+        }
+    }
+    cleanBlockCache(&blocks);
     return 0;
-}
\ No newline at end of file
+}
+
+/* Processors the program may run on, 1 if that is not known */
+static int countProcessors() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+static void printUsage(const char *name) {
+    printf("Usage: %s [options] <source file>...\n", name);
+    printf("  -j <jobs>            compile up to <jobs> files, or procedures of one file, concurrently\n");
+    printf("  -r                   run the program after compiling it\n");
+    printf("  --profile            run the program and report where it spends its time\n");
+    printf("  --vm <stack|register> machine that runs the program, stack by default\n");
+    printf("  --par-threads <n>    run the branches of par statements on up to <n> threads, one per processor by default\n");
+    printf("  --sample <rate>      run the program sampling it <rate> times per second of processor time\n");
+    printf("  --folded <file>      write the sampled call stacks to <file> for flame graphs\n");
+    printf("  --trace <entries>    run the program keeping a trace dumped on errors and signals\n");
+    printf("  --binary-input <file> run the program reading little endian 32 bit integers from <file>\n");
+    printf("  --max-steps <n>      run the program stopping it after <n> loop iterations and calls\n");
+    printf("  --time-limit <ms>    run the program stopping it after <ms> milliseconds\n");
+    printf("  --inline <words>     inline procedures of at most <words> words, 0 disables it\n");
+    printf("  --keep-dead          keep the procedures the program cannot call\n");
+    printf("  --dead-stats         print the procedures and frame words removed\n");
+    printf("  --watch              compile the file again whenever it changes, reusing unchanged procedures\n");
+    printf("  --cache <dir>        reuse compiled programs stored in <dir>\n");
+    printf("  --cache-size <bytes> bound the size of the cache directory\n");
+    printf("  --cache-stats        print cache hits and misses\n");
+    printf("  --stats              print the time and memory of each compiler phase, compiling on one thread without the cache\n");
+}
+
+int main(int argc, char* argv[]) {
+    Options options = {.threadCount = 1, .parThreads = countProcessors(), .run = false, .profile = false, .registers = false,
+                       .cacheDir = NULL, .cacheSize = CACHE_SIZE, .cacheStats = false,
+                       .inlineLimit = INLINE_LIMIT, .removeDead = true, .deadStats = false, .inputPath = NULL,
+                       .traceCount = 0, .sampleRate = 0, .foldedPath = NULL,
+                       .watch = false, .stats = false, .maxSteps = 0, .timeLimit = 0};
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        const char *arg = argv[first];
+        bool hasValue = first + 1 < argc;
+        if (!strcmp(arg, "-j") && hasValue) {
+            options.threadCount = atoi(argv[++first]);
+        } else if (!strncmp(arg, "-j", 2) && arg[2]) {
+            options.threadCount = atoi(arg + 2);
+        } else if (!strcmp(arg, "-r")) {
+            options.run = true;
+        } else if (!strcmp(arg, "--profile")) {
+            options.run = true;
+            options.profile = true;
+        } else if (!strcmp(arg, "--vm") && hasValue && !strcmp(argv[first + 1], "stack")) {
+            options.registers = false;
+            first++;
+        } else if (!strcmp(arg, "--vm") && hasValue && !strcmp(argv[first + 1], "register")) {
+            options.registers = true;
+            first++;
+        } else if (!strcmp(arg, "--par-threads") && hasValue) {
+            options.parThreads = atoi(argv[++first]);
+        } else if (!strcmp(arg, "--sample") && hasValue) {
+            options.run = true;
+            options.sampleRate = atoi(argv[++first]);
+        } else if (!strcmp(arg, "--folded") && hasValue) {
+            options.foldedPath = argv[++first];
+        } else if (!strcmp(arg, "--trace") && hasValue) {
+            options.run = true;
+            options.traceCount = atoi(argv[++first]);
+        } else if (!strcmp(arg, "--binary-input") && hasValue) {
+            options.run = true;
+            options.inputPath = argv[++first];
+        } else if (!strcmp(arg, "--max-steps") && hasValue) {
+            options.run = true;
+            options.maxSteps = atoll(argv[++first]);
+        } else if (!strcmp(arg, "--time-limit") && hasValue) {
+            options.run = true;
+            options.timeLimit = atoll(argv[++first]);
+        } else if (!strcmp(arg, "--inline") && hasValue) {
+            options.inlineLimit = atoi(argv[++first]);
+        } else if (!strcmp(arg, "--keep-dead")) {
+            options.removeDead = false;
+        } else if (!strcmp(arg, "--dead-stats")) {
+            options.deadStats = true;
+        } else if (!strcmp(arg, "--watch")) {
+            options.watch = true;
+        } else if (!strcmp(arg, "--cache") && hasValue) {
+            options.cacheDir = argv[++first];
+        } else if (!strcmp(arg, "--cache-size") && hasValue) {
+            options.cacheSize = atol(argv[++first]);
+        } else if (!strcmp(arg, "--cache-stats")) {
+            options.cacheStats = true;
+        } else if (!strcmp(arg, "--stats")) {
+            options.stats = true;
+        } else {
+            printf("Unknown option '%s'\n", arg);
+            printUsage(argv[0]);
+            return 1;
+        }
+        first++;
+    }
+    if (options.traceCount > 0 && (options.registers || options.profile)) {
+        puts("--trace runs on the stack machine without --profile");
+        return 1;
+    }
+    if (options.profile && options.registers) {
+        puts("--profile runs on the stack machine");
+        return 1;
+    }
+    if (options.threadCount < 1) {
+        options.threadCount = 1;
+    }
+    setBudget(options.maxSteps, options.timeLimit);
+    
+    int count = argc - first;
+    if (count < 1 || (options.run && count > 1)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (options.stats) {
+        if (count > 1 || options.watch) {
+            puts("--stats measures one compilation of one file");
+            return 1;
+        }
+        trackMemory();
+        options.threadCount = 1;
+        options.cacheDir = NULL;
+    }
+    if (options.watch) {
+        if (count > 1 || options.run) {
+            puts("--watch compiles one file without running it");
+            return 1;
+        }
+        return watchFile(argv[first], &options);
+    }
+    Cache cache;
+    if (options.cacheDir) {
+        openCache(&cache, options.cacheDir, options.cacheSize);
+    }
+    Cache *cachePtr = options.cacheDir ? &cache : NULL;
+    int status;
+    if (count == 1) {
+        status = compileOne(argv[first], &options, cachePtr);
+    } else {
+        status = compileAll((const char **)&argv[first], count, &options, cachePtr) ? 1 : 0;
+    }
+    if (cachePtr) {
+        if (options.cacheStats) {
+            printCacheStats(cachePtr, stderr);
+        }
+        closeCache(cachePtr);
+    }
+    return status;
+}
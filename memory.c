@@ -0,0 +1,125 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memory.h"
+
+/* Precedes every block, aligned like any object the block may hold. kind is MEM_KINDS for a
+   block that is not counted. */
+typedef union {
+    struct {
+        size_t size;
+        MemKind kind;
+    } block;
+    max_align_t align;
+} Header;
+
+/* Counters of every kind and, after them, of all kinds together */
+typedef struct {
+    atomic_llong allocated;
+    atomic_llong held;
+    atomic_llong peak;
+    atomic_llong allocations;
+} Counter;
+
+static const char *kindNames[MEM_KINDS] = {"scanner", "parser", "scope", "code"};
+
+static Counter counters[MEM_KINDS + 1];
+static bool isTracking;
+
+static void addTo(Counter *counter, long long allocated, long long change) {
+    atomic_fetch_add_explicit(&counter->allocated, allocated, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counter->allocations, allocated > 0, memory_order_relaxed);
+    long long held = atomic_fetch_add_explicit(&counter->held, change, memory_order_relaxed) + change;
+    long long peak = atomic_load_explicit(&counter->peak, memory_order_relaxed);
+    while (held > peak
+           && !atomic_compare_exchange_weak_explicit(&counter->peak, &peak, held,
+                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/* allocated bytes were handed out and the bytes held changed by change */
+static void note(MemKind kind, long long allocated, long long change) {
+    if (kind < MEM_KINDS) {
+        addTo(&counters[kind], allocated, change);
+        addTo(&counters[MEM_KINDS], allocated, change);
+    }
+}
+
+/* Counts the blocks handed out from now on, but not those handed out before. Call it before
+   any other thread starts. */
+void trackMemory() {
+    isTracking = true;
+}
+
+void *memAlloc(MemKind kind, size_t size) {
+    Header *header = malloc(sizeof(Header) + size);
+    if (!header) {
+        return NULL;
+    }
+    header->block.size = size;
+    header->block.kind = isTracking ? kind : MEM_KINDS;
+    note(header->block.kind, size, size);
+    return header + 1;
+}
+
+void *memCalloc(MemKind kind, size_t count, size_t size) {
+    Header *header = calloc(1, sizeof(Header) + count * size);
+    if (!header) {
+        return NULL;
+    }
+    header->block.size = count * size;
+    header->block.kind = isTracking ? kind : MEM_KINDS;
+    note(header->block.kind, count * size, count * size);
+    return header + 1;
+}
+
+/* A block keeps the kind it was first handed out for */
+void *memRealloc(MemKind kind, void *block, size_t size) {
+    if (!block) {
+        return memAlloc(kind, size);
+    }
+    Header *header = (Header*)block - 1;
+    size_t oldSize = header->block.size;
+    header = realloc(header, sizeof(Header) + size);
+    if (!header) {
+        return NULL;
+    }
+    header->block.size = size;
+    note(header->block.kind, size, (long long)size - (long long)oldSize);
+    return header + 1;
+}
+
+void memFree(void *block) {
+    if (!block) {
+        return;
+    }
+    Header *header = (Header*)block - 1;
+    note(header->block.kind, 0, -(long long)header->block.size);
+    free(header);
+}
+
+char *memString(MemKind kind, const char *text) {
+    size_t size = strlen(text) + 1;
+    char *copy = memAlloc(kind, size);
+    memcpy(copy, text, size);
+    return copy;
+}
+
+static void readCounter(Counter *counter, MemUse *use) {
+    use->allocated = atomic_load_explicit(&counter->allocated, memory_order_relaxed);
+    use->held = atomic_load_explicit(&counter->held, memory_order_relaxed);
+    use->peak = atomic_load_explicit(&counter->peak, memory_order_relaxed);
+    use->allocations = atomic_load_explicit(&counter->allocations, memory_order_relaxed);
+}
+
+void readMemUse(MemKind kind, MemUse *use) {
+    readCounter(&counters[kind], use);
+}
+
+void readMemTotal(MemUse *use) {
+    readCounter(&counters[MEM_KINDS], use);
+}
+
+const char *getMemKindName(MemKind kind) {
+    return kindNames[kind];
+}
@@ -0,0 +1,35 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Parts of the compiler whose memory is accounted apart */
+typedef enum {
+    MEM_SCANNER,
+    MEM_PARSER,
+    MEM_SCOPE,
+    MEM_CODE,
+    MEM_KINDS
+} MemKind;
+
+/* Memory of one part: bytes handed out in total, where growing a block hands out a block of the
+   new size, the bytes held now and at most at once, and the number of blocks handed out */
+typedef struct {
+    long long allocated;
+    long long held;
+    long long peak;
+    long long allocations;
+} MemUse;
+
+void trackMemory();
+void *memAlloc(MemKind kind, size_t size);
+void *memCalloc(MemKind kind, size_t count, size_t size);
+void *memRealloc(MemKind kind, void *block, size_t size);
+void memFree(void *block);
+char *memString(MemKind kind, const char *text);
+void readMemUse(MemKind kind, MemUse *use);
+void readMemTotal(MemUse *use);
+const char *getMemKindName(MemKind kind);
+
+#endif
@@ -1,21 +1,23 @@
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "code.h"
+#include "loops.h"
+#include "memory.h"
 #include "parser.h"
 #include "scanner.h"
 #include "scope.h"
 
-static bool syntaxError;
-static SymbolType sym;
-static int symArg;
-
 typedef struct _AccessList{
     int type;
     struct _AccessList *next;
 } AccessList;
 
 static AccessList *newAccessList(int type, AccessList *srcList) {
-    AccessList *list = malloc(sizeof(AccessList));
+    AccessList *list = memAlloc(MEM_PARSER, sizeof(AccessList));
     memset(list, 0, sizeof(AccessList));
     list->type = type;
     list->next = NULL;
@@ -34,7 +36,7 @@ static AccessList *newAccessList(int type, AccessList *srcList) {
 static void cleanAccessList(AccessList *list) {
     while (list) {
         AccessList *next = list->next;
-        free(list);
+        memFree(list);
         list = next;
     }
 }
@@ -43,12 +45,27 @@ typedef struct {
     bool arr[T_COUNT];
 } SymSet;
 
-static SymSet endSet;
-static SymSet defFirst;
-static SymSet stmtFirst;
-static SymSet constFirst;
-static SymSet exprFirst;
-static SymSet termFirst;
+static const SymSet endSet = {{
+    [T_EOF]=true
+}};
+static const SymSet defFirst = {{
+    [T_EOF]=true, [T_CONST]=true, [T_INTEGER]=true, [T_BOOLEAN]=true, [T_PROC]=true
+}};
+static const SymSet stmtFirst = {{
+    [T_EOF]=true, [T_SKIP]=true, [T_WRITE]=true, [T_NAME]=true, [T_CALL]=true, [T_IF]=true,
+    [T_DO]=true, [T_READ]=true, [T_PAR]=true
+}};
+static const SymSet constFirst = {{
+    [T_EOF]=true, [T_NUM]=true, [T_NAME]=true, [T_FALSE]=true, [T_TRUE]=true
+}};
+static const SymSet exprFirst = {{
+    [T_EOF]=true, [T_MINUS]=true, [T_NUM]=true, [T_NAME]=true, [T_FALSE]=true, [T_TRUE]=true,
+    [T_LPAREN]=true, [T_NOT]=true
+}};
+static const SymSet termFirst = {{
+    [T_EOF]=true, [T_NUM]=true, [T_NAME]=true, [T_FALSE]=true, [T_TRUE]=true, [T_LPAREN]=true,
+    [T_NOT]=true
+}};
 
 static bool inSet(SymSet set, SymbolType sym) {
     return set.arr[sym];
@@ -76,66 +93,68 @@ static SymSet unionSet(SymSet a, SymSet b) {
     return set;
 }
 
-static void next() {
-    if (sym != T_EOF) {
-        Symbol s = scanNext();
-        sym = s.type;
-        symArg = s.arg;
+/* Code emitted after a symbol is consumed belongs to the line of that symbol */
+static void next(Parser *parser) {
+    setLine(&parser->code, parser->scanner.symLine);
+    if (parser->sym != T_EOF) {
+        Symbol s = scanNext(&parser->scanner);
+        parser->sym = s.type;
+        parser->symArg = s.arg;
     }
 }
 
-static void markError(SymSet stop) {
-    syntaxError = true;  
+static void markError(Parser *parser, SymSet stop) {
+    parser->syntaxError = true;  
         
-    while (!inSet(stop, sym)) {
-        next();
+    while (!inSet(stop, parser->sym)) {
+        next(parser);
     }
 }
 
-static void skipUntil(SymSet stop) {
-    if (!inSet(stop, sym)) {
-        printf("%d: Expected ", getLine());
+static void skipUntil(Parser *parser, SymSet stop) {
+    if (!inSet(stop, parser->sym)) {
+        fprintf(parser->scanner.log, "%d: Expected ", getLine(&parser->scanner));
         for (int i = 0; i < T_COUNT; i++) {
             if (stop.arr[i]) {
-                printf("%s ", getSymName(i));
+                fprintf(parser->scanner.log, "%s ", getSymName(i));
             }
         }
-        printf("but found %s\n", getSymName(sym));
+        fprintf(parser->scanner.log, "but found %s\n", getSymName(parser->sym));
         
-        markError(stop);
+        markError(parser, stop);
     }
 }
 
-static void expect(SymbolType exp, SymSet stop) {
-    if (sym == exp) {
-        next();
-        skipUntil(stop);
+static void expect(Parser *parser, SymbolType exp, SymSet stop) {
+    if (parser->sym == exp) {
+        next(parser);
+        skipUntil(parser, stop);
     } else {
-        markError(stop);
-        printf("%d: Expected %s but found %s\n", getLine(), getSymName(exp), getSymName(sym));
+        markError(parser, stop);
+        fprintf(parser->scanner.log, "%d: Expected %s but found %s\n", getLine(&parser->scanner), getSymName(exp), getSymName(parser->sym));
     }
 }
 
-static int expectName(SymSet stop) {
-    if (sym == T_NAME) {
-        int name = symArg;
-        next();
-        skipUntil(stop);
+static int expectName(Parser *parser, SymSet stop) {
+    if (parser->sym == T_NAME) {
+        int name = parser->symArg;
+        next(parser);
+        skipUntil(parser, stop);
         return name;
     } else {
-        markError(stop);
-        printf("%d: Expected identifier but found %s\n", getLine(), getSymName(sym));
+        markError(parser, stop);
+        fprintf(parser->scanner.log, "%d: Expected identifier but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
         return NO_NAME;
     }
 }   
 
 /* Returns true if the input symbol has any of passed types */
-static bool check(int count, ...) {
+static bool check(Parser *parser, int count, ...) {
     va_list types;
     va_start(types, count);
     for (int i = 0; i < count; i++) {
         SymbolType type = va_arg(types, SymbolType);
-        if (sym == type) {
+        if (parser->sym == type) {
             return true;
         }
     }
@@ -143,166 +162,208 @@ static bool check(int count, ...) {
     return false;
 }
 
-static void parseBlock(SymSet stop);
-static void parseExpression(SymSet stop, int *type);
-static AccessList *parseExpressionList(SymSet stop);
-static AccessList *parseVariableAccessList(SymSet stop);
-static void parseStatementPart(SymSet stop);
+static void parseBlock(Parser *parser, SymSet stop, OpCode start, OpCode end, ObjectRecord *proc);
+static void parseExpression(Parser *parser, SymSet stop, int *type);
+static AccessList *parseExpressionList(Parser *parser, SymSet stop);
+static AccessList *parseVariableAccessList(Parser *parser, SymSet stop);
+static void parseStatementPart(Parser *parser, SymSet stop);
+static PendingProc *findPending(Parser *parser, ObjectRecord *obj);
+static void emitPendingCall(Parser *parser, ObjectRecord *obj, PendingProc *pending);
 
 /* BooleanSymbol -> "false" | "true" */
-static int parseBooleanSymbol(SymSet stop) {
+static int parseBooleanSymbol(Parser *parser, SymSet stop) {
     int value = 0;
-    if (sym == T_TRUE) {
-        value = T_TRUE;
-        expect(T_TRUE, stop);
-    } else if (sym == T_FALSE) {
-        value = T_FALSE;
-        expect(T_FALSE, stop);
+    if (parser->sym == T_TRUE) {
+        value = 1;
+        expect(parser, T_TRUE, stop);
+    } else if (parser->sym == T_FALSE) {
+        value = 0;
+        expect(parser, T_FALSE, stop);
     } else {
-        printf("%d: Expected boolean value but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected boolean value but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
     return value;
 }
 
 /* Constant -> Numeral | BooleanSymbol | Name */
-static int parseConstant(SymSet stop, int *type) {
+static int parseConstant(Parser *parser, SymSet stop, int *type) {
     int value = 0;
-    if (sym == T_NUM) {
+    if (parser->sym == T_NUM) {
         *type = T_INTEGER;
-        value = symArg;
-        expect(T_NUM, stop);
-    } else if (check(2, T_TRUE, T_FALSE)) {
+        value = parser->symArg;
+        expect(parser, T_NUM, stop);
+    } else if (check(parser, 2, T_TRUE, T_FALSE)) {
         *type = T_BOOLEAN;
-        value = parseBooleanSymbol(stop);
-    } else if (sym == T_NAME) {
-        ObjectRecord *obj = findName(symArg);
+        value = parseBooleanSymbol(parser, stop);
+    } else if (parser->sym == T_NAME) {
+        ObjectRecord *obj = findName(&parser->scope, parser->symArg);
         if (obj->kind == OBJ_CONST) {
             *type = obj->as.constant.type;
             value = obj->as.constant.value;
         } else {
-            kindError(obj);
+            kindError(&parser->scope, obj);
             *type = NO_NAME;
         }
-        expectName(stop);
+        expectName(parser, stop);
     } else {
-        printf("%d: Expected constant but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected constant but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
         *type = NO_NAME;
     }
     return value;
 }
 
+/* Frame words of an array. A Boolean array is packed 32 elements to a word. */
+static int getArrayWords(const ObjectRecord *obj) {
+    return obj->as.arr.isPacked ? (obj->as.arr.count + 31) / 32 : obj->as.arr.count;
+}
+
 /* IndexedSelector -> "[" Expression "]" */
-static int parseIndexedSelector(SymSet stop, ObjectRecord *obj) {
+static void parseIndexedSelector(Parser *parser, SymSet stop, ObjectRecord *obj) {
     SymSet stop1 = newSet(stop, 1, T_RSQUAR);
     SymSet stop2 = unionSet(stop, exprFirst);
     
-    expect(T_LSQUAR, stop2);
+    expect(parser, T_LSQUAR, stop2);
     int type;
-    parseExpression(stop1, &type);
-    expect(T_RSQUAR, stop);
-    
-    if (obj->kind != OBJ_ARR) {
-        kindError(obj);
-        return NO_NAME;
+    parseExpression(parser, stop1, &type);
+    if (type != T_INTEGER) {
+        typeError(&parser->scope, type);
+    }
+    if (obj->kind == OBJ_ARR) {
+        emit1(&parser->code, obj->as.arr.isPacked ? OP_INDEXBIT : OP_INDEX, obj->as.arr.count);
+    } else {
+        kindError(&parser->scope, obj);
     }
+    expect(parser, T_RSQUAR, stop);
 }
 
-/* VariableAccess -> Name [ IndexedSelector ] */
-static int parseVariableAccess(SymSet stop, int *type) {
+/* VariableAccess -> Name [ IndexedSelector ]
+   Pushes the address of a variable. Constants push nothing and are left to the caller. */
+static ObjectRecord *parseVariableAccess(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 1, T_LSQUAR);
     
+    bool allowWhole = parser->allowWholeArray;
+    parser->allowWholeArray = false;
     ObjectRecord *obj = NULL;
-    if (sym == T_NAME) {
-        obj = findName(symArg);
+    if (parser->sym == T_NAME) {
+        obj = findName(&parser->scope, parser->symArg);
     }
-    expectName(stop1);
-    int itemType = NO_NAME;
-    if (sym == T_LSQUAR) {
-        parseIndexedSelector(stop, obj);
+    expectName(parser, stop1);
+    if (!obj) {
+        *type = NO_NAME;
+        return NULL;
+    }
+    
+    int level = parser->scope.blockLevel;
+    if (obj->kind == OBJ_VAR) {
+        emit2(&parser->code, OP_VARIABLE, level - obj->as.var.level, obj->as.var.displ);
+        noteAccess(&parser->scope, obj, ACCESS_READ, -1);
+    } else if (obj->kind == OBJ_ARR) {
+        emit2(&parser->code, OP_VARIABLE, level - obj->as.arr.level, obj->as.arr.displ);
+        noteAccess(&parser->scope, obj, ACCESS_READ, -1);
+    }
+    if (parser->sym == T_LSQUAR) {
+        parseIndexedSelector(parser, stop, obj);
+    } else if (obj->kind == OBJ_ARR && allowWhole) {
+        parser->wholeArray = obj;
+    } else if (obj->kind == OBJ_ARR) {
+        kindError(&parser->scope, obj);
     }
     
     if (obj->kind == OBJ_CONST) {
         *type = obj->as.constant.type;
-        return obj->as.constant.value;
     } else if (obj->kind == OBJ_VAR) {
         *type = obj->as.var.type;
-        return 0;
     } else if (obj->kind == OBJ_ARR) {
         *type = obj->as.arr.type;
-        return 0;
     } else {
-        kindError(obj);
+        kindError(&parser->scope, obj);
         *type = NO_NAME;
-        return 0;
     }
+    return obj;
 }
 
 /* Factor -> Numeral | BooleanSymbol | VariableAccess | "(" Expression ")" | "~" Factor */
-static int parseFactor(SymSet stop, int *type) {
+static void parseFactor(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 1, T_RPAREN);
     SymSet stop2 = unionSet(stop1, exprFirst);
     SymSet stop3 = unionSet(stop, termFirst);
     *type = NO_NAME;
     
-    if (sym == T_NUM) {
-        return parseConstant(stop, type);
-    } else if (check(2, T_TRUE, T_FALSE)) {
+    if (parser->sym == T_NUM) {
+        int value = parseConstant(parser, stop, type);
+        emit1(&parser->code, OP_CONSTANT, value);
+    } else if (check(parser, 2, T_TRUE, T_FALSE)) {
         *type = T_BOOLEAN;
-        return parseBooleanSymbol(stop);
-    } else if (sym == T_NAME) {
-        parseVariableAccess(stop, type);
-    } else if (sym == T_LPAREN) {
-        expect(T_LPAREN, stop2);
-        parseExpression(stop1, type);
-        expect(T_RPAREN, stop);
-    } else if (sym == T_NOT) {
-        expect(T_NOT, stop3);
-        parseFactor(stop, type);
+        int value = parseBooleanSymbol(parser, stop);
+        emit1(&parser->code, OP_CONSTANT, value);
+    } else if (parser->sym == T_NAME) {
+        ObjectRecord *obj = parseVariableAccess(parser, stop, type);
+        if (obj && obj->kind == OBJ_CONST) {
+            emit1(&parser->code, OP_CONSTANT, obj->as.constant.value);
+        } else if (obj && obj == parser->wholeArray) {
+            // The address of the array is the value
+        } else if (obj && obj->kind == OBJ_ARR && obj->as.arr.isPacked) {
+            emit0(&parser->code, OP_VALUEBIT);
+        } else if (obj && (obj->kind == OBJ_VAR || obj->kind == OBJ_ARR)) {
+            emit0(&parser->code, OP_VALUE);
+        }
+    } else if (parser->sym == T_LPAREN) {
+        expect(parser, T_LPAREN, stop2);
+        parseExpression(parser, stop1, type);
+        expect(parser, T_RPAREN, stop);
+    } else if (parser->sym == T_NOT) {
+        expect(parser, T_NOT, stop3);
+        parseFactor(parser, stop, type);
         if (*type != T_BOOLEAN) {
-            typeError(*type);
+            typeError(&parser->scope, *type);
         }
+        emit0(&parser->code, OP_NOT);
     } else {
-        printf("%d: Expected number, boolean value, identifier, ( or ~ but found %s\n",
-            getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected number, boolean value, identifier, ( or ~ but found %s\n",
+            getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
-    return 0;
 }
 
 /* MultiplyingOperator -> "*" | "/" | "\" */
-static void parseMultiplyingOperator(SymSet stop) {
-    if (sym == T_MULT) {
-        expect(T_MULT, stop);
-    } else if (sym == T_DIV) {
-        expect(T_DIV, stop);
-    } else if (sym == T_MOD) {
-        expect(T_MOD, stop);
+static OpCode parseMultiplyingOperator(Parser *parser, SymSet stop) {
+    if (parser->sym == T_MULT) {
+        expect(parser, T_MULT, stop);
+        return OP_MULTIPLY;
+    } else if (parser->sym == T_DIV) {
+        expect(parser, T_DIV, stop);
+        return OP_DIVIDE;
+    } else if (parser->sym == T_MOD) {
+        expect(parser, T_MOD, stop);
+        return OP_MODULO;
     } else {
-        printf("%d: Expected * / or \\ but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected * / or \\ but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
+        return OP_MULTIPLY;
     }
 }
 
 /* Term -> Factor { MultiplyingOperator Factor } */
-static void parseTerm(SymSet stop, int *type) {
+static void parseTerm(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 3, T_MULT, T_DIV, T_MOD);
     SymSet stop2 = unionSet(stop1, termFirst);
     
     int leftType = NO_NAME;
     int rightType = NO_NAME;
-    parseFactor(stop1, &leftType);
-    while (check(3, T_MULT, T_DIV, T_MOD)) {
-        parseMultiplyingOperator(stop2);
-        parseFactor(stop1, &rightType);
+    parseFactor(parser, stop1, &leftType);
+    while (check(parser, 3, T_MULT, T_DIV, T_MOD)) {
+        OpCode op = parseMultiplyingOperator(parser, stop2);
+        parseFactor(parser, stop1, &rightType);
+        emit0(&parser->code, op);
 
         if (leftType != T_INTEGER) {
-            typeError(leftType);
+            typeError(&parser->scope, leftType);
             leftType = NO_NAME;
         }
         if (rightType != T_INTEGER) {
-            typeError(rightType);
+            typeError(&parser->scope, rightType);
             leftType = NO_NAME;
         }
     }
@@ -310,39 +371,52 @@ static void parseTerm(SymSet stop, int *type) {
 }
 
 /* AddingOperator -> "+" | "-" */
-static void parseAddingOperator(SymSet stop) {
-    if (sym == T_PLUS) {
-        expect(T_PLUS, stop);
-    } else if (sym == T_MINUS) {
-        expect(T_MINUS, stop);
+static OpCode parseAddingOperator(Parser *parser, SymSet stop) {
+    if (parser->sym == T_PLUS) {
+        expect(parser, T_PLUS, stop);
+        return OP_ADD;
+    } else if (parser->sym == T_MINUS) {
+        expect(parser, T_MINUS, stop);
+        return OP_SUBTRACT;
     } else {
-        printf("%d: Expected + or - but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected + or - but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
+        return OP_ADD;
     }
 }
 
 /* SimpleExpression -> ["-"] Term { AddingOperator Term } */
-static void parseSimpleExpression(SymSet stop, int *type) {
+static void parseSimpleExpression(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 2, T_PLUS, T_MINUS);
     SymSet stop2 = unionSet(stop1, termFirst);
     
-    if (sym == T_MINUS) {
-        expect(T_MINUS, stop2);
+    bool negate = false;
+    if (parser->sym == T_MINUS) {
+        expect(parser, T_MINUS, stop2);
+        negate = true;
     }
     
     int leftType = NO_NAME;
     int rightType = NO_NAME;
-    parseTerm(stop1, &leftType);
-    while (check(2, T_PLUS, T_MINUS)) {
-        parseAddingOperator(stop2);
-        parseTerm(stop1, &rightType);
+    parseTerm(parser, stop1, &leftType);
+    if (negate) {
+        if (leftType != T_INTEGER) {
+            typeError(&parser->scope, leftType);
+            leftType = NO_NAME;
+        }
+        emit0(&parser->code, OP_MINUS);
+    }
+    while (check(parser, 2, T_PLUS, T_MINUS)) {
+        OpCode op = parseAddingOperator(parser, stop2);
+        parseTerm(parser, stop1, &rightType);
+        emit0(&parser->code, op);
         
         if (leftType != T_INTEGER) {
-            typeError(leftType);
+            typeError(&parser->scope, leftType);
             leftType = NO_NAME;
         }
         if (rightType != T_INTEGER) {
-            typeError(rightType);
+            typeError(&parser->scope, rightType);
             leftType = NO_NAME;
         }
     }
@@ -350,48 +424,55 @@ static void parseSimpleExpression(SymSet stop, int *type) {
 }
 
 /* RelationalOperator -> "<" | "=" | ">" */
-static int parseRelationalOperator(SymSet stop) {
-    if (sym == T_LES) {
-        expect(T_LES, stop);
+static int parseRelationalOperator(Parser *parser, SymSet stop) {
+    if (parser->sym == T_LES) {
+        expect(parser, T_LES, stop);
         return T_LES;
-    } else if (sym == T_EQ) {
-        expect(T_EQ, stop);
+    } else if (parser->sym == T_EQ) {
+        expect(parser, T_EQ, stop);
         return T_EQ;
-    } else if (sym == T_GRE) {
-        expect(T_GRE, stop);
+    } else if (parser->sym == T_GRE) {
+        expect(parser, T_GRE, stop);
         return T_GRE;
     } else {
-        printf("%d: Expected < = or > but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected < = or > but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
         return NO_NAME;
     }
 }
 
 /* PrimaryExpression -> SimpleExpression [ RelationalOperator SimpleExpression ] */
-static void parsePrimaryExpression(SymSet stop, int *type) {
+static void parsePrimaryExpression(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 3, T_LES, T_EQ, T_GRE);
     SymSet stop2 = unionSet(stop1, exprFirst);
     
     int rightType = NO_NAME;
     int leftType = NO_NAME;
-    parseSimpleExpression(stop1, &leftType);
-    if (check(3, T_LES, T_EQ, T_GRE)) {
-        int oper = parseRelationalOperator(stop2);
-        parseSimpleExpression(stop1, &rightType);
+    parseSimpleExpression(parser, stop1, &leftType);
+    if (check(parser, 3, T_LES, T_EQ, T_GRE)) {
+        int oper = parseRelationalOperator(parser, stop2);
+        parseSimpleExpression(parser, stop1, &rightType);
+        if (oper == T_LES) {
+            emit0(&parser->code, OP_LESS);
+        } else if (oper == T_EQ) {
+            emit0(&parser->code, OP_EQUAL);
+        } else {
+            emit0(&parser->code, OP_GREATER);
+        }
         if (oper == T_EQ) {
             if (leftType != rightType) {
-                typeError(rightType);
+                typeError(&parser->scope, rightType);
                 leftType = NO_NAME;
             } else if (leftType != NO_NAME) {
                 leftType = T_BOOLEAN;
             }
         } else {
             if (leftType != T_INTEGER) {
-                typeError(leftType);
+                typeError(&parser->scope, leftType);
                 leftType = NO_NAME;
             }
             if (rightType != T_INTEGER) {
-                typeError(rightType);
+                typeError(&parser->scope, rightType);
                 leftType = NO_NAME;
             }
             if (leftType == T_INTEGER && rightType == T_INTEGER) {
@@ -403,385 +484,1272 @@ static void parsePrimaryExpression(SymSet stop, int *type) {
 }
 
 /* PrimaryOperator -> "&" | "|" */
-static void parsePrimaryOperator(SymSet stop) {
-    if (sym == T_AND) {
-        expect(T_AND, stop);
-    } else if (sym == T_OR) {
-        expect(T_OR, stop);
+static OpCode parsePrimaryOperator(Parser *parser, SymSet stop) {
+    if (parser->sym == T_AND) {
+        expect(parser, T_AND, stop);
+        return OP_AND;
+    } else if (parser->sym == T_OR) {
+        expect(parser, T_OR, stop);
+        return OP_OR;
     } else {
-        printf("%d: Expected & or | but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected & or | but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
+        return OP_AND;
     }
 }
 
 /* Expression -> PrimaryExpression { PrimaryOperator PrimaryExpression } */
-static void parseExpression(SymSet stop, int *type) {
+static void parseExpression(Parser *parser, SymSet stop, int *type) {
     SymSet stop1 = newSet(stop, 2, T_AND, T_OR);
     SymSet stop2 = unionSet(stop1, exprFirst);
     
     int leftType = NO_NAME;
     int rightType = NO_NAME;
     
-    parsePrimaryExpression(stop1, &leftType);
-    while (check(2, T_AND, T_OR)) {
-        parsePrimaryOperator(stop2);
-        parsePrimaryExpression(stop1, &rightType);
+    parsePrimaryExpression(parser, stop1, &leftType);
+    while (check(parser, 2, T_AND, T_OR)) {
+        OpCode op = parsePrimaryOperator(parser, stop2);
+        parsePrimaryExpression(parser, stop1, &rightType);
+        emit0(&parser->code, op);
         
         if (leftType != T_BOOLEAN) {
-            typeError(leftType);
+            typeError(&parser->scope, leftType);
             leftType = NO_NAME;
         }
         if (rightType != T_BOOLEAN) {
-            typeError(rightType);
+            typeError(&parser->scope, rightType);
             leftType = NO_NAME;
         }
     }
     *type = leftType;
 }
 
-/* GuardedCommand -> Expression "->" StatementPart */
-static void parseGuardedCommand(SymSet stop) {
+/* GuardedCommand -> Expression "->" StatementPart
+   The closing jump of the command is added to the chain barChain. */
+static void parseGuardedCommand(Parser *parser, SymSet stop, int *barChain) {
     SymSet stop1 = unionSet(stop, stmtFirst);
     SymSet stop2 = newSet(stop1, 1, T_ARROW);
     
     int type;
-    parseExpression(stop2, &type);
-    expect(T_ARROW, stop1);
-    parseStatementPart(stop);
+    parseExpression(parser, stop2, &type);
+    if (type != T_BOOLEAN) {
+        typeError(&parser->scope, type);
+    }
+    int arrow = emit1(&parser->code, OP_ARROW, 0);
+    expect(parser, T_ARROW, stop1);
+    parseStatementPart(parser, stop);
+    *barChain = emit1(&parser->code, OP_BAR, *barChain) + 1;
+    patch(&parser->code, arrow + 1, parser->code.length);
 }
 
 /* GuardedCommandList -> GuardedCommand { "[]" GuardedCommand } */
-static void parseGuardedCommandList(SymSet stop) {
+static void parseGuardedCommandList(Parser *parser, SymSet stop, int *barChain) {
     SymSet stop1 = newSet(stop, 1, T_GUARD);
     SymSet stop2 = unionSet(stop1, exprFirst);
     
-    parseGuardedCommand(stop1);
-    while (sym == T_GUARD) {
-        expect(T_GUARD, stop2);
-        parseGuardedCommand(stop1);
+    parseGuardedCommand(parser, stop1, barChain);
+    while (parser->sym == T_GUARD) {
+        expect(parser, T_GUARD, stop2);
+        parseGuardedCommand(parser, stop1, barChain);
+    }
+}
+
+/* Emits a copy of the guard code from guard up to end that branches to target when the guard
+   holds. A final comparison or negation of the guard at test is fused into the branch. */
+static void emitGuardBranch(Parser *parser, int guard, int test, int end, int line, int target) {
+    int saved = parser->code.line;
+    setLine(&parser->code, line);
+    
+    OpCode op = test >= guard && test < end ? parser->code.words[test] : OP_COUNT;
+    if (op == OP_LESS || op == OP_EQUAL || op == OP_GREATER || op == OP_NOT) {
+        copyCode(&parser->code, guard, test);
+    } else {
+        copyCode(&parser->code, guard, end);
+    }
+    if (op == OP_LESS) {
+        emit1(&parser->code, OP_JUMPLESS, target);
+    } else if (op == OP_EQUAL) {
+        emit1(&parser->code, OP_JUMPEQUAL, target);
+    } else if (op == OP_GREATER) {
+        emit1(&parser->code, OP_JUMPGREATER, target);
+    } else if (op == OP_NOT) {
+        emit1(&parser->code, OP_JUMPFALSE, target);
+    } else {
+        emit1(&parser->code, OP_JUMPTRUE, target);
+    }
+    setLine(&parser->code, saved);
+}
+
+/* A guarded command of a do statement. The statements are followed by a copy of their guard
+   that branches back to them, so a command that fired runs again without testing the guards
+   before it. Only when its guard fails the loop tests all guards again from start. */
+static void parseLoopCommand(Parser *parser, SymSet stop, int start, bool isFirst) {
+    SymSet stop1 = unionSet(stop, stmtFirst);
+    SymSet stop2 = newSet(stop1, 1, T_ARROW);
+    
+    int type;
+    int guard = parser->code.length;
+    parseExpression(parser, stop2, &type);
+    if (type != T_BOOLEAN) {
+        typeError(&parser->scope, type);
+    }
+    int end = parser->code.length;
+    int line = parser->code.line;
+    int test = parser->code.last;
+    int arrow = emit1(&parser->code, OP_ARROW, 0);
+    expect(parser, T_ARROW, stop1);
+    int body = parser->code.length;
+    parseStatementPart(parser, stop);
+    emitGuardBranch(parser, guard, test, end, line, body);
+    if (!isFirst || parser->sym == T_GUARD) {
+        emit1(&parser->code, OP_BAR, start);
     }
+    patch(&parser->code, arrow + 1, parser->code.length);
 }
 
-/* DoStatement -> "do" GuardedCommandList "od" */
-static void parseDoStatement(SymSet stop) {
+/* DoStatement -> "do" GuardedCommandList "od"
+   A loop with one guard G and statements S becomes G ARROW exit; S; G JUMPTRUE S; exit.
+   A counted loop whose iterations are independent is split for runParallel. */
+static void parseDoStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_OD);
     SymSet stop2 = unionSet(stop1, exprFirst);
+    SymSet stop3 = newSet(stop1, 1, T_GUARD);
     
-    expect(T_DO, stop2);
-    parseGuardedCommandList(stop1);
-    expect(T_OD, stop);
+    int start = parser->code.length;
+    expect(parser, T_DO, stop2);
+    parseLoopCommand(parser, stop3, start, true);
+    bool isSingle = parser->sym != T_GUARD;
+    while (parser->sym == T_GUARD) {
+        expect(parser, T_GUARD, unionSet(stop3, exprFirst));
+        parseLoopCommand(parser, stop3, start, false);
+    }
+    if (isSingle) {
+        splitLoop(&parser->code, start);
+    }
+    expect(parser, T_OD, stop);
 }
 
 /* IfStatement -> "if" GuardedCommandList "fi" */
-static void parseIfStatement(SymSet stop) {
+static void parseIfStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_FI);
     SymSet stop2 = unionSet(stop1, exprFirst);
     
-    expect(T_IF, stop2);
-    parseGuardedCommandList(stop1);
-    expect(T_FI, stop);
+    int barChain = -1;
+    expect(parser, T_IF, stop2);
+    parseGuardedCommandList(parser, stop1, &barChain);
+    emit0(&parser->code, OP_FI);
+    patchChain(&parser->code, barChain, parser->code.length);
+    expect(parser, T_FI, stop);
+}
+
+static void logInlined(Parser *parser, ObjectRecord *obj) {
+    if (parser->inlinedCount >= parser->inlinedCapacity) {
+        parser->inlinedCapacity = parser->inlinedCapacity ? 2 * parser->inlinedCapacity : 64;
+        parser->inlined = memRealloc(MEM_PARSER, parser->inlined, parser->inlinedCapacity * sizeof(ProcAddress));
+    }
+    parser->inlined[parser->inlinedCount++] = (ProcAddress){obj->as.proc.addr, obj};
+}
+
+/* A procedure is inlined when it is compiled, its statements take at most inlineLimit words
+   and call neither itself nor a procedure defined inside it. Recursive calls are never inlined
+   because the procedure is still being compiled. proc holds the code from its PROC at addr. */
+static bool isInlinable(const int32_t *proc, int addr, int end, int limit) {
+    if (proc[end - addr] != OP_ENDPROC || end - proc[2] > limit) {
+        return false;
+    }
+    for (int pc = proc[2]; pc < end; pc += getOpLength(proc[pc - addr])) {
+        if (proc[pc - addr] == OP_CALL && (proc[pc - addr + 1] == 0 || proc[pc - addr + 2] == addr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool canInline(Parser *parser, ObjectRecord *obj) {
+    int addr = obj->as.proc.addr;
+    return obj->as.proc.end >= 0
+        && isInlinable(&parser->code.words[addr], addr, obj->as.proc.end, parser->inlineLimit);
+}
+
+/* Gives words of the frame of the running block and notes them for removeDeadCode */
+static int allocateSpace(Parser *parser, int words) {
+    int displ = allocateVariable(&parser->scope, words);
+    if (words > 0) {
+        addSpace(&parser->code, parser->blockAddr, displ, words);
+    }
+    return displ;
+}
+
+/* Copies the statements of a procedure to the call from the code from, where the procedure
+   runs from addr to end. Its variables get their own place in the frame of the calling block,
+   other frame references are moved by the difference of levels and jumps by the distance of
+   the copy. The copy keeps the source lines of the procedure. */
+static void emitInline(Parser *parser, ObjectRecord *obj, const Code *from, int addr, int end) {
+    Code *code = &parser->code;
+    int start = from->words[addr + 2];
+    int shift = code->length - start;
+    int base = allocateSpace(parser, from->words[addr + 1]) - 3;
+    int lift = parser->scope.blockLevel - (obj->as.proc.level + 1);
+    int line = code->line;
+    if (parser->blocks || parser->bodies) {
+        logInlined(parser, obj);
+    }
+    int pos;
+    int runPc;
+    int runLine;
+    seekLine(from, start, &pos, &runPc, &runLine);
+    int copyLine = runLine;
+    bool isRun = nextLineRun(from, &pos, &runPc, &runLine);
+    
+    for (int pc = start; pc < end; pc += getOpLength(from->words[pc])) {
+        OpCode op = from->words[pc];
+        while (isRun && runPc <= pc) {
+            copyLine = runLine;
+            isRun = nextLineRun(from, &pos, &runPc, &runLine);
+        }
+        setLine(code, copyLine);
+        if (op == OP_VARIABLE && from->words[pc + 1] == 0) {
+            emit2(code, op, 0, from->words[pc + 2] + base);
+        } else if (op == OP_VARIABLE || op == OP_CALL) {
+            emit2(code, op, from->words[pc + 1] + lift, from->words[pc + 2]);
+        } else if (isJump(op)) {
+            emit1(code, op, from->words[pc + 1] + shift);
+        } else if (getOpLength(op) == 2) {
+            emit1(code, op, from->words[pc + 1]);
+        } else {
+            emit0(code, op);
+        }
+    }
+    setLine(code, line);
 }
 
 /* ProcedureStatement -> "call" Name */
-static void parseProcedureStatement(SymSet stop) {
+static void parseProcedureStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_NAME);
     
-    expect(T_CALL, stop1);
-    if (sym == T_NAME) {
-        findName(symArg);
+    expect(parser, T_CALL, stop1);
+    ObjectRecord *obj = NULL;
+    if (parser->sym == T_NAME) {
+        obj = findName(&parser->scope, parser->symArg);
+    }
+    expectName(parser, stop);
+    PendingProc *pending = NULL;
+    if (obj && obj->kind == OBJ_PROC && parser->bodies) {
+        pending = findPending(parser, obj);
+    }
+    if (obj && obj->kind == OBJ_PROC) {
+        noteCall(&parser->scope, obj);
     }
-    int procName = expectName(stop);
-    ObjectRecord *obj = findName(procName);
-    if (obj->kind != OBJ_PROC) {
-        kindError(obj);
+    if (!obj) {
+        return;
+    } else if (pending) {
+        emitPendingCall(parser, obj, pending);
+    } else if (obj->kind == OBJ_PROC && canInline(parser, obj)) {
+        emitInline(parser, obj, &parser->code, obj->as.proc.addr, obj->as.proc.end);
+    } else if (obj->kind == OBJ_PROC) {
+        emit2(&parser->code, OP_CALL, parser->scope.blockLevel - obj->as.proc.level, obj->as.proc.addr);
+    } else {
+        kindError(&parser->scope, obj);
+    }
+}
+
+/* A whole array is assigned from an array of the same type and bound or filled with the value
+   of an expression, which allowWholeArray lets the parser tell apart */
+static void parseArrayAssignment(Parser *parser, SymSet stop, ObjectRecord *target) {
+    int start = parser->code.length;
+    int type = NO_NAME;
+    parser->allowWholeArray = true;
+    parseExpression(parser, stop, &type);
+    parser->allowWholeArray = false;
+    
+    ObjectRecord *source = parser->wholeArray;
+    parser->wholeArray = NULL;
+    if (source && parser->code.length != start + 3) {
+        kindError(&parser->scope, source);
+    } else if (source) {
+        if (source->as.arr.type != target->as.arr.type) {
+            typeError(&parser->scope, source->as.arr.type);
+        } else if (source->as.arr.count != target->as.arr.count) {
+            fprintf(parser->scanner.log, "%d: Array bounds must match!\n", getLine(&parser->scanner));
+            parser->scope.analysisError = true;
+        }
+        emit1(&parser->code, OP_COPY, getArrayWords(target));
+    } else if (target->as.arr.isPacked) {
+        if (type != target->as.arr.type) {
+            typeError(&parser->scope, type);
+        }
+        emit1(&parser->code, OP_FILLBITS, getArrayWords(target));
+    } else {
+        if (type != target->as.arr.type) {
+            typeError(&parser->scope, type);
+        }
+        emit1(&parser->code, OP_FILL, target->as.arr.count);
     }
 }
 
-/* AssignmentStatement -> VariableAccessList ":=" ExpressionList */
-static void parseAssignmentStatement(SymSet stop) {
+/* AssignmentStatement -> VariableAccessList ":=" ExpressionList
+   A single target naming an array without index assigns the whole array. */
+static void parseAssignmentStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = unionSet(stop, exprFirst);
     SymSet stop2 = newSet(stop1, 1, T_ASSIGN);
     
-    AccessList *list = parseVariableAccessList(stop2);
-    expect(T_ASSIGN, stop1);
-    AccessList *srcList = parseExpressionList(stop);
+    parser->wholeArray = NULL;
+    parser->allowWholeArray = true;
+    parser->hasBitTarget = false;
+    AccessList *list = parseVariableAccessList(parser, stop2);
+    parser->allowWholeArray = false;
+    ObjectRecord *target = parser->wholeArray;
+    parser->wholeArray = NULL;
+    expect(parser, T_ASSIGN, stop1);
+    if (target && !list->next) {
+        parseArrayAssignment(parser, stop, target);
+        cleanAccessList(list);
+        return;
+    } else if (target) {
+        kindError(&parser->scope, target);
+    }
+    AccessList *srcList = parseExpressionList(parser, stop);
     
     AccessList *tmp1 = list;
     AccessList *tmp2 = srcList;
-    while (tmp2) {
-        if (!tmp1) {
-            //TODO: Number doesn't match
-            break;
-        } else if (tmp1->type != tmp2 -> type) {
-            //TODO: Types doesn't match
+    int count = 0;
+    while (tmp1 && tmp2) {
+        if (tmp1->type != NO_NAME && tmp1->type != tmp2->type) {
+            typeError(&parser->scope, tmp2->type);
         }
         
         tmp1 = tmp1->next;
         tmp2 = tmp2->next;
+        count++;
+    }
+    if (tmp1 || tmp2) {
+        countError(&parser->scope);
     }
+    emit1(&parser->code, parser->hasBitTarget ? OP_ASSIGNBITS : OP_ASSIGN, count);
     cleanAccessList(list);
     cleanAccessList(srcList);
 }
 
 /* ExpressionList -> Expression { "," Expression } */
-static AccessList *parseExpressionList(SymSet stop) {
+static AccessList *parseExpressionList(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_COMMA);
     SymSet stop2 = unionSet(stop1, exprFirst);
     
     int type = NO_NAME;
-    parseExpression(stop1, &type);
+    parseExpression(parser, stop1, &type);
     AccessList *list  = newAccessList(type, NULL);
-    while (sym == T_COMMA) {
-        expect(T_COMMA, stop2);
-        parseExpression(stop1, &type);
+    while (parser->sym == T_COMMA) {
+        expect(parser, T_COMMA, stop2);
+        parseExpression(parser, stop1, &type);
         list = newAccessList(type, list);
     }
     return list;
 }
 
 /* WriteStatement -> "write" ExpressionList */
-static void parseWriteStatement(SymSet stop) {
+static void parseWriteStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = unionSet(stop, exprFirst);
     
-    expect(T_WRITE, stop1);
-    AccessList *list = parseExpressionList(stop);
+    expect(parser, T_WRITE, stop1);
+    AccessList *list = parseExpressionList(parser, stop);
     AccessList *tmp = list;
+    int count = 0;
     while (tmp) {
         if (tmp->type != T_INTEGER) {
-            typeError(tmp->type);
+            typeError(&parser->scope, tmp->type);
         }
         tmp = tmp->next;
+        count++;
     }
+    emit1(&parser->code, OP_WRITE, count);
+    noteAccess(&parser->scope, &parser->scope.output, ACCESS_WRITE, -1);
     cleanAccessList(list);
 }
 
+/* A variable access that is assigned to must denote a variable */
+static void parseVariableTarget(Parser *parser, SymSet stop, int *type) {
+    ObjectRecord *obj = parseVariableAccess(parser, stop, type);
+    if (obj && obj->kind == OBJ_CONST) {
+        kindError(&parser->scope, obj);
+        *type = NO_NAME;
+    } else if (obj && obj->kind == OBJ_ARR && obj->as.arr.isPacked && obj != parser->wholeArray) {
+        parser->hasBitTarget = true;
+    }
+    if (obj && (obj->kind == OBJ_VAR || obj->kind == OBJ_ARR)) {
+        noteAccess(&parser->scope, obj, ACCESS_WRITE, -1);
+    }
+}
+
 /* VariableAccessList -> VariableAccess { "," VariableAccess } */
-static AccessList *parseVariableAccessList(SymSet stop) {
+static AccessList *parseVariableAccessList(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_COMMA);
     SymSet stop2 = newSet(stop1, 1, T_NAME);
     
     int type = 0;
-    parseVariableAccess(stop1, &type);
+    parseVariableTarget(parser, stop1, &type);
     AccessList *accList = newAccessList(type, NULL);
-    while (sym == T_COMMA) {
-        expect(T_COMMA, stop2);
-        parseVariableAccess(stop1, &type);
+    while (parser->sym == T_COMMA) {
+        expect(parser, T_COMMA, stop2);
+        parseVariableTarget(parser, stop1, &type);
         accList = newAccessList(type, accList);
     }
     return accList;
 }
 
-/* ReadStatement -> "read" VariableAccessList */
-static void parseReadStatement(SymSet stop) {
+/* ReadStatement -> "read" VariableAccessList
+   A single array without index reads the whole array in one block. */
+static void parseReadStatement(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_NAME);
     
-    expect(T_READ, stop1);
-    AccessList *list = parseVariableAccessList(stop);
+    expect(parser, T_READ, stop1);
+    parser->wholeArray = NULL;
+    parser->allowWholeArray = true;
+    AccessList *list = parseVariableAccessList(parser, stop);
+    parser->allowWholeArray = false;
+    ObjectRecord *target = parser->wholeArray;
+    parser->wholeArray = NULL;
+    if (target && list->next) {
+        kindError(&parser->scope, target);
+    }
     AccessList *tmp = list;
+    int count = 0;
     while (tmp) {
         if (tmp->type != T_INTEGER) {
-            typeError(tmp->type);
+            typeError(&parser->scope, tmp->type);
         }
         tmp = tmp->next;
+        count++;
+    }
+    if (target && count == 1) {
+        emit1(&parser->code, OP_READARRAY, target->as.arr.count);
+    } else {
+        emit1(&parser->code, OP_READ, count);
     }
+    noteAccess(&parser->scope, &parser->scope.input, ACCESS_WRITE, -1);
     cleanAccessList(list);
 }
 
+/* ParallelStatement -> "par" StatementPart { "[]" StatementPart } "rap"
+   PAR end is followed by the branches, each of them BRANCH next, its statements and ENDBRANCH,
+   where next is the address after ENDBRANCH. The branches may run at once, so none of them may
+   use what another writes. */
+static void parseParallelStatement(Parser *parser, SymSet stop) {
+    SymSet stop1 = newSet(stop, 2, T_GUARD, T_RAP);
+    SymSet stop2 = unionSet(stop1, stmtFirst);
+    
+    expect(parser, T_PAR, stop2);
+    int par = emit1(&parser->code, OP_PAR, 0);
+    int *starts = NULL;
+    int count = 0;
+    while (true) {
+        starts = memRealloc(MEM_PARSER, starts, (count + 1) * sizeof(int));
+        starts[count++] = parser->scope.accessCount;
+        int branch = emit1(&parser->code, OP_BRANCH, 0);
+        parseStatementPart(parser, stop1);
+        emit0(&parser->code, OP_ENDBRANCH);
+        patch(&parser->code, branch + 1, parser->code.length);
+        if (parser->sym != T_GUARD) {
+            break;
+        }
+        expect(parser, T_GUARD, stop2);
+    }
+    patch(&parser->code, par + 1, parser->code.length);
+    checkBranches(&parser->scope, starts, count);
+    memFree(starts);
+    expect(parser, T_RAP, stop);
+}
+
 /* EmptyStatement -> "skip" */
-static void parseEmptyStatement(SymSet stop) {
-    expect(T_SKIP, stop);
-}
-
-/* Statement -> EmptyStatement | ReadStatement | WriteStatement | AssignmentStatement | ProcedureStatement | IfStatement | DoStatement */
-static void parseStatement(SymSet stop) {
-    if (sym == T_SKIP) {
-        parseEmptyStatement(stop);
-    } else if (sym == T_READ) {
-        parseReadStatement(stop);
-    } else if (sym == T_WRITE) {
-        parseWriteStatement(stop);
-    } else if (sym == T_NAME) {
-        parseAssignmentStatement(stop);
-    } else if (sym == T_CALL) {
-        parseProcedureStatement(stop);
-    } else if (sym == T_IF) {
-        parseIfStatement(stop);
-    } else if (sym == T_DO) {
-        parseDoStatement(stop);
+static void parseEmptyStatement(Parser *parser, SymSet stop) {
+    expect(parser, T_SKIP, stop);
+}
+
+/* Statement -> EmptyStatement | ReadStatement | WriteStatement | AssignmentStatement | ProcedureStatement | IfStatement | DoStatement | ParallelStatement */
+static void parseStatement(Parser *parser, SymSet stop) {
+    parser->statementCount++;
+    if (parser->sym == T_SKIP) {
+        parseEmptyStatement(parser, stop);
+    } else if (parser->sym == T_READ) {
+        parseReadStatement(parser, stop);
+    } else if (parser->sym == T_WRITE) {
+        parseWriteStatement(parser, stop);
+    } else if (parser->sym == T_NAME) {
+        parseAssignmentStatement(parser, stop);
+    } else if (parser->sym == T_CALL) {
+        parseProcedureStatement(parser, stop);
+    } else if (parser->sym == T_IF) {
+        parseIfStatement(parser, stop);
+    } else if (parser->sym == T_DO) {
+        parseDoStatement(parser, stop);
+    } else if (parser->sym == T_PAR) {
+        parseParallelStatement(parser, stop);
     } else {
-        printf("%d: Expected start of statement but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected start of statement but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
 }
 
 /* StatementPart -> { Statement ";" } */
-static void parseStatementPart(SymSet stop) {
+static void parseStatementPart(Parser *parser, SymSet stop) {
     SymSet stop1 = unionSet(stop, stmtFirst);
     SymSet stop2 = newSet(stop1, 1, T_SEMI);
     
-    skipUntil(stop1);
-    while (inSet(stmtFirst, sym)) {
-        parseStatement(stop2);
-        expect(T_SEMI, stop1);
+    skipUntil(parser, stop1);
+    while (inSet(stmtFirst, parser->sym)) {
+        parseStatement(parser, stop2);
+        expect(parser, T_SEMI, stop1);
+    }
+}
+
+static bool hasErrors(Parser *parser) {
+    return parser->scanner.lexError || parser->syntaxError || parser->scope.analysisError;
+}
+
+static int addCallee(CachedBlock *block, Parser *parser, ObjectRecord *obj, bool isInlined, int beginLine) {
+    for (int i = 0; i < block->calleeCount; i++) {
+        if (block->callees[i].level == obj->as.proc.level
+                && !strcmp(block->callees[i].spelling, getNameSpel(&parser->scanner, obj->name))) {
+            return i;
+        }
+    }
+    block->callees = memRealloc(MEM_PARSER, block->callees, (block->calleeCount + 1) * sizeof(Callee));
+    const char *spelling = getNameSpel(&parser->scanner, obj->name);
+    block->callees[block->calleeCount] = (Callee){.spelling = memString(MEM_PARSER, spelling), .level = obj->as.proc.level,
+        .isInlined = isInlined, .signature = obj->as.proc.signature, .line = obj->as.proc.line - beginLine};
+    return block->calleeCount++;
+}
+
+/* Names the accesses of proc, whose block starts at base, that do not go through a call of a
+   procedure outside the block */
+static void recordAccesses(Parser *parser, CachedBlock *block, const ObjectRecord *proc, int base) {
+    Scope *scope = &parser->scope;
+    block->accesses = memAlloc(MEM_PARSER, (proc->as.proc.accessCount + 1) * sizeof(BlockAccess));
+    for (int i = 0; i < proc->as.proc.accessCount; i++) {
+        const Access *access = &proc->as.proc.accesses[i];
+        if (access->via >= 0 && (access->via < base || access->via >= base + block->length)) {
+            continue;
+        }
+        BlockAccess *kept = &block->accesses[block->accessCount++];
+        *kept = (BlockAccess){.spelling = NULL, .level = levelOf(access->obj), .kind = access->kind,
+            .via = access->via >= 0 ? access->via - base : -1};
+        if (access->obj == &scope->output) {
+            kept->level = -2;
+        } else if (access->obj != &scope->input) {
+            const char *spelling = getNameSpel(&parser->scanner, access->obj->name);
+            kept->spelling = memString(MEM_PARSER, spelling);
+        }
+    }
+}
+
+/* Finds the objects of the accesses of a block again, returns false if one is gone */
+static bool findAccesses(Parser *parser, const CachedBlock *block, ObjectRecord **objects) {
+    Scope *scope = &parser->scope;
+    for (int i = 0; i < block->accessCount; i++) {
+        const BlockAccess *access = &block->accesses[i];
+        if (!access->spelling) {
+            objects[i] = access->level == -1 ? &scope->input : &scope->output;
+        } else {
+            int name = lookupName(&parser->scanner, access->spelling);
+            objects[i] = name >= 0 ? findNameAt(scope, name, access->level) : NULL;
+        }
+        if (!objects[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static ObjectRecord *findProcAt(Parser *parser, int addr) {
+    int low = 0;
+    int high = parser->procAddrCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (parser->procAddrs[mid].addr == addr) {
+            return parser->procAddrs[mid].obj;
+        } else if (parser->procAddrs[mid].addr < addr) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+/* Copies the block just compiled from base, with its line runs from the line table position
+   linePos on, and names the procedures outside it that it calls or inlines. Returns NULL if a
+   called procedure is unknown. */
+static CachedBlock *recordBlock(Parser *parser, uint64_t context, const char *text, int beginLine,
+        int base, int linePos, int runPc, int runLine, int inlinedStart, int statementStart) {
+    Code *code = &parser->code;
+    CachedBlock *block = memCalloc(MEM_PARSER, 1, sizeof(CachedBlock));
+    block->context = context;
+    block->textLength = parser->blockEnd - text;
+    block->text = memAlloc(MEM_PARSER, block->textLength + 1);
+    memcpy(block->text, text, block->textLength);
+    block->text[block->textLength] = '\0';
+    block->length = code->length - base;
+    block->words = memAlloc(MEM_PARSER, block->length * sizeof(int32_t));
+    memcpy(block->words, &code->words[base], block->length * sizeof(int32_t));
+    block->wordsBase = base;
+    block->base = base;
+    block->endLine = parser->blockEndLine - beginLine;
+    block->statementCount = parser->statementCount - statementStart;
+    
+    int capacity = 0;
+    while (nextLineRun(code, &linePos, &runPc, &runLine)) {
+        if (runPc <= base) {
+            continue;
+        }
+        if (block->lineCount >= capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            block->lines = memRealloc(MEM_PARSER, block->lines, capacity * sizeof(LineRun));
+        }
+        block->lines[block->lineCount++] = (LineRun){runPc - base, runLine - beginLine};
+    }
+    int first = code->procCount;
+    while (first > 0 && code->procs[first - 1].addr > base) {
+        first--;
+    }
+    block->procCount = code->procCount - first;
+    block->procs = memAlloc(MEM_PARSER, block->procCount * sizeof(ProcEntry));
+    for (int i = 0; i < block->procCount; i++) {
+        const ProcEntry *proc = &code->procs[first + i];
+        block->procs[i] = (ProcEntry){.addr = proc->addr - base, .name = memString(MEM_PARSER, proc->name)};
+    }
+    first = code->spaceCount;
+    while (first > 0 && code->spaces[first - 1].block >= base) {
+        first--;
+    }
+    block->spaceCount = code->spaceCount - first;
+    block->spaces = memAlloc(MEM_PARSER, block->spaceCount * sizeof(FrameSpace));
+    for (int i = 0; i < block->spaceCount; i++) {
+        const FrameSpace *space = &code->spaces[first + i];
+        block->spaces[i] = (FrameSpace){space->block - base, space->displ, space->words};
+    }
+    
+    int end = base + block->length;
+    for (int i = inlinedStart; i < parser->inlinedCount; i++) {
+        const ProcAddress *inlined = &parser->inlined[i];
+        if (inlined->addr < base || inlined->addr >= end) {
+            addCallee(block, parser, inlined->obj, true, beginLine);
+        }
+    }
+    capacity = 0;
+    for (int pc = base; pc < end; pc += getOpLength(code->words[pc])) {
+        if (code->words[pc] != OP_CALL) {
+            continue;
+        }
+        int target = code->words[pc + 2];
+        if (target >= base && target < end) {
+            continue;
+        }
+        ObjectRecord *obj = findProcAt(parser, target);
+        if (!obj) {
+            freeBlock(block);
+            return NULL;
+        }
+        if (block->callCount >= capacity) {
+            capacity = capacity ? 2 * capacity : 16;
+            block->calls = memRealloc(MEM_PARSER, block->calls, capacity * sizeof(CallSite));
+        }
+        block->calls[block->callCount++] = (CallSite){pc + 2 - base, addCallee(block, parser, obj, false, beginLine)};
+    }
+    ObjectRecord *proc = findProcAt(parser, base);
+    if (!proc || !proc->as.proc.isKnown) {
+        freeBlock(block);
+        return NULL;
+    }
+    recordAccesses(parser, block, proc, base);
+    
+    uint64_t signature = hashWords(context, block->text, block->textLength);
+    for (int i = 0; i < block->calleeCount; i++) {
+        const Callee *callee = &block->callees[i];
+        signature = hashWords(signature, callee->spelling, strlen(callee->spelling) + 1);
+        int32_t fields[3] = {callee->level, callee->isInlined, callee->line};
+        signature = hashWords(signature, fields, sizeof(fields));
+        signature = hashWords(signature, &callee->signature, sizeof(callee->signature));
+    }
+    block->signature = signature;
+    return block;
+}
+
+static ObjectRecord *findCallee(Parser *parser, const Callee *callee) {
+    int name = lookupName(&parser->scanner, callee->spelling);
+    ObjectRecord *obj = name >= 0 ? findNameAt(&parser->scope, name, callee->level) : NULL;
+    return obj && obj->kind == OBJ_PROC ? obj : NULL;
+}
+
+/* Appends the code of a block with its lines, moves its addresses by the distance to its new
+   place and points its calls of outer procedures at the callees */
+static void copyBlock(Code *code, const CachedBlock *block, int beginLine, ObjectRecord **callees) {
+    int base = code->length;
+    int shift = base - block->wordsBase;
+    int start = 3;
+    appendWords(code, block->words, start);
+    setLine(code, beginLine);
+    for (int i = 0; i < block->lineCount; i++) {
+        appendWords(code, &block->words[start], block->lines[i].pc - start);
+        setLine(code, beginLine + block->lines[i].line);
+        start = block->lines[i].pc;
+    }
+    appendWords(code, &block->words[start], block->length - start);
+    
+    int end = block->wordsBase + block->length;
+    for (int pc = base; pc < code->length; pc += getOpLength(code->words[pc])) {
+        OpCode op = code->words[pc];
+        if (isJump(op)) {
+            code->words[pc + 1] += shift;
+        } else if (op == OP_PROC || (op == OP_CALL && code->words[pc + 2] >= block->wordsBase && code->words[pc + 2] < end)) {
+            code->words[pc + 2] += shift;
+        }
+    }
+    for (int i = 0; i < block->callCount; i++) {
+        code->words[base + block->calls[i].offset] = callees[block->calls[i].callee]->as.proc.addr;
+    }
+    code->last = code->length - 1;
+}
+
+/* A cached block is only reused if every procedure it depends on is still inlined or called as
+   it was. Its code is then appended with its lines, and its addresses are moved. The accesses
+   of its procedure proc are those it made itself and those of its callees now. */
+static bool spliceBlock(Parser *parser, CachedBlock *block, ObjectRecord *proc, int beginLine) {
+    Code *code = &parser->code;
+    ObjectRecord **objects = memAlloc(MEM_PARSER, (block->accessCount + 1) * sizeof(ObjectRecord*));
+    if (!findAccesses(parser, block, objects)) {
+        memFree(objects);
+        return false;
+    }
+    ObjectRecord **callees = memAlloc(MEM_PARSER, block->calleeCount * sizeof(ObjectRecord*));
+    for (int i = 0; i < block->calleeCount; i++) {
+        const Callee *callee = &block->callees[i];
+        ObjectRecord *obj = findCallee(parser, callee);
+        bool isSame = obj && (callee->isInlined
+            ? obj->as.proc.signature == callee->signature && obj->as.proc.line - beginLine == callee->line
+            : !canInline(parser, obj));
+        if (!isSame) {
+            memFree(callees);
+            memFree(objects);
+            return false;
+        }
+        callees[i] = obj;
+    }
+    
+    int base = code->length;
+    copyBlock(code, block, beginLine, callees);
+    for (int i = 0; i < block->procCount; i++) {
+        addProc(code, base + block->procs[i].addr, block->procs[i].name);
+    }
+    for (int i = 0; i < block->spaceCount; i++) {
+        addSpace(code, base + block->spaces[i].block, block->spaces[i].displ, block->spaces[i].words);
+    }
+    for (int i = 0; i < block->calleeCount; i++) {
+        if (block->callees[i].isInlined) {
+            logInlined(parser, callees[i]);
+        }
+    }
+    int start = parser->scope.accessCount;
+    for (int i = 0; i < block->accessCount; i++) {
+        int via = block->accesses[i].via;
+        noteAccess(&parser->scope, objects[i], block->accesses[i].kind, via >= 0 ? base + via : -1);
+    }
+    for (int i = 0; i < block->calleeCount; i++) {
+        noteCall(&parser->scope, callees[i]);
+    }
+    keepAccesses(&parser->scope, proc, start);
+    memFree(objects);
+    memFree(callees);
+    parser->statementCount += block->statementCount;
+    keepBlock(parser->blocks, block, base);
+    return true;
+}
+
+static PendingProc *findPending(Parser *parser, ObjectRecord *obj) {
+    int low = 0;
+    int high = parser->pendingCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (parser->pending[mid].addr == obj->as.proc.addr) {
+            return &parser->pending[mid];
+        } else if (parser->pending[mid].addr < obj->as.proc.addr) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+/* Calls or inlines a procedure whose body another thread compiles, once it is done. An inlined
+   body is copied into a code of its own first, with its calls pointing at this compilation. */
+static void emitPendingCall(Parser *parser, ObjectRecord *obj, PendingProc *pending) {
+    if (!pending->isResolved) {
+        CachedBlock *block = waitBody(parser->bodies, pending->body);
+        pending->isResolved = block != NULL;
+        if (block && isInlinable(block->words, block->wordsBase, block->wordsBase + block->length - 1,
+                parser->inlineLimit)) {
+            ObjectRecord **callees = memAlloc(MEM_PARSER, block->calleeCount * sizeof(ObjectRecord*));
+            for (int i = 0; i < block->calleeCount; i++) {
+                callees[i] = findCallee(parser, &block->callees[i]);
+                pending->isResolved = pending->isResolved && callees[i];
+            }
+            if (pending->isResolved) {
+                pending->copy = memAlloc(MEM_PARSER, sizeof(Code));
+                initCode(pending->copy);
+                copyBlock(pending->copy, block, obj->as.proc.line, callees);
+            }
+            memFree(callees);
+        }
+        obj->as.proc.signature = block ? block->signature : 0;
+    }
+    parser->bodyFailed = parser->bodyFailed || !pending->isResolved;
+    if (pending->copy) {
+        emitInline(parser, obj, pending->copy, 0, pending->copy->last);
+    } else {
+        emit2(&parser->code, OP_CALL, parser->scope.blockLevel - obj->as.proc.level, obj->as.proc.addr);
+    }
+}
+
+/* Compiles a procedure body of the program block if it is the one claimed and goes on to claim
+   the next, or skips it and leaves a procedure without statements in its place. A body the
+   parser went past without compiling it is given up. */
+static void parseBody(Parser *parser, SymSet stop, ObjectRecord *obj, int index) {
+    Scanner *scanner = &parser->scanner;
+    Code *code = &parser->code;
+    BodyQueue *queue = parser->bodies;
+    const Body *body = &queue->bodies[index];
+    const char *text = scanner->source;
+    int beginLine = scanner->symLine;
+    obj->as.proc.line = beginLine;
+    while (parser->bodyTask < index) {
+        finishBody(queue, parser->bodyTask, NULL);
+        parser->bodyTask = claimBody(queue);
+    }
+    
+    if (parser->bodyTask != index) {
+        int addr = obj->as.proc.addr;
+        int32_t words[4] = {OP_PROC, 0, addr + 3, OP_ENDPROC};
+        appendWords(code, words, 4);
+        code->last = code->length - 1;
+        obj->as.proc.end = code->last;
+        if (parser->pendingCount >= parser->pendingCapacity) {
+            parser->pendingCapacity = parser->pendingCapacity ? 2 * parser->pendingCapacity : 64;
+            parser->pending = memRealloc(MEM_PARSER, parser->pending, parser->pendingCapacity * sizeof(PendingProc));
+        }
+        parser->pending[parser->pendingCount++] = (PendingProc){addr, index, false, NULL};
+        skipText(scanner, body->length);
+        parser->sym = T_END;
+        scanner->symLine = body->endLine;
+        expect(parser, T_END, stop);
+        return;
+    }
+    
+    uint64_t context = scopeHash(&parser->scope);
+    context = hashWords(context, &parser->inlineLimit, sizeof(int));
+    int base = code->length;
+    int linePos = code->lineBytes;
+    int runPc = code->lastPc;
+    int runLine = code->lastLine;
+    int inlinedStart = parser->inlinedCount;
+    int statementStart = parser->statementCount;
+    bool hadErrors = hasErrors(parser);
+    parser->blockEnd = NULL;
+    parser->bodyFailed = false;
+    parseBlock(parser, stop, OP_PROC, OP_ENDPROC, obj);
+    obj->as.proc.end = code->last;
+    CachedBlock *block = NULL;
+    if (!hadErrors && !hasErrors(parser) && !parser->bodyFailed && parser->blockEnd) {
+        block = recordBlock(parser, context, text, beginLine, base, linePos, runPc, runLine,
+            inlinedStart, statementStart);
+    }
+    if (block) {
+        obj->as.proc.signature = block->signature;
+    }
+    finishBody(queue, index, block);
+    parser->bodyTask = claimBody(queue);
+}
+
+/* Reuses the block compiled before when its text and the names visible to it are unchanged,
+   otherwise compiles it and keeps it for the next compilation */
+static void parseCachedBlock(Parser *parser, SymSet stop, ObjectRecord *obj) {
+    Scanner *scanner = &parser->scanner;
+    Code *code = &parser->code;
+    const char *text = scanner->source;
+    int beginLine = scanner->symLine;
+    uint64_t context = scopeHash(&parser->scope);
+    context = hashWords(context, &parser->inlineLimit, sizeof(int));
+    obj->as.proc.line = beginLine;
+    
+    CachedBlock *block = findBlock(parser->blocks, context, text);
+    if (block && spliceBlock(parser, block, obj, beginLine)) {
+        parser->blocks->reused++;
+        obj->as.proc.end = code->last;
+        obj->as.proc.signature = block->signature;
+        skipText(scanner, block->textLength);
+        parser->sym = T_END;
+        scanner->symLine = beginLine + block->endLine;
+        expect(parser, T_END, stop);
+        return;
+    }
+    
+    int base = code->length;
+    int linePos = code->lineBytes;
+    int runPc = code->lastPc;
+    int runLine = code->lastLine;
+    int inlinedStart = parser->inlinedCount;
+    int statementStart = parser->statementCount;
+    bool hadErrors = hasErrors(parser);
+    parser->blockEnd = NULL;
+    parseBlock(parser, stop, OP_PROC, OP_ENDPROC, obj);
+    obj->as.proc.end = code->last;
+    parser->blocks->compiled++;
+    if (hadErrors || hasErrors(parser) || !parser->blockEnd) {
+        return;
+    }
+    block = recordBlock(parser, context, text, beginLine, base, linePos, runPc, runLine,
+        inlinedStart, statementStart);
+    if (block) {
+        obj->as.proc.signature = block->signature;
+        addBlock(parser->blocks, block);
     }
 }
 
 /* ProcedureDefinition -> "proc" Name Block */
-static void parseProcedureDefinition(SymSet stop) {
+static void parseProcedureDefinition(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_BEGIN);
     SymSet stop2 = newSet(stop1, 1, T_NAME);
     
-    expect(T_PROC, stop2);
-    int name = expectName(stop1);
-    defineName(name, OBJ_PROC);
-    parseBlock(stop);
+    expect(parser, T_PROC, stop2);
+    int name = expectName(parser, stop1);
+    ObjectRecord *obj = defineName(&parser->scope, name, OBJ_PROC);
+    obj->as.proc.level = parser->scope.blockLevel;
+    obj->as.proc.addr = parser->code.length;
+    obj->as.proc.end = -1;
+    obj->as.proc.line = 0;
+    obj->as.proc.signature = 0;
+    obj->as.proc.accesses = NULL;
+    obj->as.proc.accessCount = 0;
+    obj->as.proc.isKnown = false;
+    const char *spelling = getNameSpel(&parser->scanner, name);
+    addProc(&parser->code, parser->code.length, spelling ? spelling : "?");
+    int body = -1;
+    if (parser->bodies && parser->sym == T_BEGIN) {
+        body = findBody(parser->bodies, parser->scanner.source);
+    }
+    if ((parser->blocks || body >= 0) && parser->sym == T_BEGIN) {
+        if (parser->procAddrCount >= parser->procAddrCapacity) {
+            parser->procAddrCapacity = parser->procAddrCapacity ? 2 * parser->procAddrCapacity : 64;
+            parser->procAddrs = memRealloc(MEM_PARSER, parser->procAddrs, parser->procAddrCapacity * sizeof(ProcAddress));
+        }
+        parser->procAddrs[parser->procAddrCount++] = (ProcAddress){obj->as.proc.addr, obj};
+    }
+    if (body >= 0) {
+        parseBody(parser, stop, obj, body);
+    } else if (parser->blocks && parser->sym == T_BEGIN) {
+        parseCachedBlock(parser, stop, obj);
+    } else {
+        parseBlock(parser, stop, OP_PROC, OP_ENDPROC, obj);
+        obj->as.proc.end = parser->code.last;
+    }
+}
+
+static void defineVariable(Parser *parser, int name, int type) {
+    ObjectRecord *obj = defineName(&parser->scope, name, OBJ_VAR);
+    obj->as.var.type = type;
+    obj->as.var.level = parser->scope.blockLevel;
+    obj->as.var.displ = allocateSpace(parser, 1);
 }
 
 /* VariableList -> Name { "," Name } */
-static void parseVariableList(SymSet stop, int type) {
+static void parseVariableList(Parser *parser, SymSet stop, int type) {
     SymSet stop1 = newSet(stop, 1, T_COMMA);
     SymSet stop2 = newSet(stop1, 1, T_NAME);
     
-    int name = expectName(stop1);
-    ObjectRecord *obj = defineName(name, OBJ_VAR);
-    obj->as.var.type = type;
-    while (sym == T_COMMA) {
-        expect(T_COMMA, stop2);
-        name = expectName(stop1);
-        obj = defineName(name, OBJ_VAR);
-        obj->as.var.type = type;
+    int name = expectName(parser, stop1);
+    defineVariable(parser, name, type);
+    while (parser->sym == T_COMMA) {
+        expect(parser, T_COMMA, stop2);
+        name = expectName(parser, stop1);
+        defineVariable(parser, name, type);
     }
 }
 
 /* TypeSymbol -> "Integer" | "Boolean" */
-static int parseTypeSymbol(SymSet stop) {
+static int parseTypeSymbol(Parser *parser, SymSet stop) {
     int type = NO_NAME;
-    if (sym == T_INTEGER) {
+    if (parser->sym == T_INTEGER) {
         type = T_INTEGER;
-        expect(T_INTEGER, stop);
-    } else if (sym == T_BOOLEAN) {
+        expect(parser, T_INTEGER, stop);
+    } else if (parser->sym == T_BOOLEAN) {
         type = T_BOOLEAN;
-        expect(T_BOOLEAN, stop);
+        expect(parser, T_BOOLEAN, stop);
     } else {
-        printf("%d: Expected Integer or Boolean but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected Integer or Boolean but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
     return type;
 }
 
 /* ArrVarList -> Name ("," ArrVarList | "[" Constant "]") */
-static int parseArrVarList(SymSet stop, int type) {
+static int parseArrVarList(Parser *parser, SymSet stop, int type) {
     SymSet stop1 = newSet(stop, 1, T_RSQUAR);
     SymSet stop2 = unionSet(stop1, constFirst);
     SymSet stop3 = newSet(stop, 2, T_COMMA, T_LSQUAR);
     
-    int name = expectName(stop3);
-    ObjectRecord *obj = defineName(name, OBJ_ARR);
+    int name = expectName(parser, stop3);
+    ObjectRecord *obj = defineName(&parser->scope, name, OBJ_ARR);
     int constValue = 0;
-    if (sym == T_COMMA) {
-        expect(T_COMMA, stop);
-        constValue = parseArrVarList(stop3, type);
-    } else if (sym == T_LSQUAR) {
-        expect(T_LSQUAR, stop2);
+    if (parser->sym == T_COMMA) {
+        expect(parser, T_COMMA, stop);
+        constValue = parseArrVarList(parser, stop3, type);
+    } else if (parser->sym == T_LSQUAR) {
+        expect(parser, T_LSQUAR, stop2);
         int constType;
-        constValue = parseConstant(stop1, &constType);
-        expect(T_RSQUAR, stop);
+        constValue = parseConstant(parser, stop1, &constType);
+        if (constType != T_INTEGER) {
+            typeError(&parser->scope, constType);
+            constValue = 0;
+        } else if (constValue < 1) {
+            fprintf(parser->scanner.log, "%d: Array bound must be positive!\n", getLine(&parser->scanner));
+            parser->scope.analysisError = true;
+            constValue = 0;
+        }
+        expect(parser, T_RSQUAR, stop);
     }
     obj->as.arr.type = type;
     obj->as.arr.count = constValue;
+    obj->as.arr.level = parser->scope.blockLevel;
+    obj->as.arr.isPacked = (type == T_BOOLEAN);
+    obj->as.arr.displ = allocateSpace(parser, getArrayWords(obj));
     return constValue;
 }
 
 /* VariableDefinition -> TypeSymbol ( VariableList | "array" ArrVarList ) */
-static void parseVariableDefinition(SymSet stop) {
+static void parseVariableDefinition(Parser *parser, SymSet stop) {
     SymSet stop1 = newSet(stop, 1, T_NAME);
     SymSet stop2 = newSet(stop1, 1, T_ARRAY);
     
-    int type = parseTypeSymbol(stop2);
-    if (sym == T_ARRAY) {
-        expect(T_ARRAY, stop1);
-        parseArrVarList(stop, type);
-    } else if (sym == T_NAME) {
-        parseVariableList(stop, type);
+    int type = parseTypeSymbol(parser, stop2);
+    if (parser->sym == T_ARRAY) {
+        expect(parser, T_ARRAY, stop1);
+        parseArrVarList(parser, stop, type);
+    } else if (parser->sym == T_NAME) {
+        parseVariableList(parser, stop, type);
     } else {
-        printf("%d: Expected array or identifier but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected array or identifier but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
 }
 
 /* ConstantDefinition -> "const" Name "=" Constant */
-static void parseConstantDefinition(SymSet stop) {
+static void parseConstantDefinition(Parser *parser, SymSet stop) {
     SymSet stop1 = unionSet(stop, constFirst);
     SymSet stop2 = newSet(stop1, 1, T_EQ);
     
-    expect(T_CONST, stop2);
-    int name = expectName(stop2);
-    expect(T_EQ, stop1);
+    expect(parser, T_CONST, stop2);
+    int name = expectName(parser, stop2);
+    expect(parser, T_EQ, stop1);
     int type = 0;
-    int value = parseConstant(stop, &type);
+    int value = parseConstant(parser, stop, &type);
     
-    ObjectRecord *obj = defineName(name, OBJ_CONST);
+    ObjectRecord *obj = defineName(&parser->scope, name, OBJ_CONST);
     obj->as.constant.value = value;
     obj->as.constant.type = type;
 }
 
 /* Definition -> ConstantDefinition | VariableDefinition | ProcedureDefinition */
-static void parseDefinition(SymSet stop) {
-    if (sym == T_CONST) {
-        parseConstantDefinition(stop);
-    } else if (check(2, T_INTEGER, T_BOOLEAN)) {
-        parseVariableDefinition(stop);
-    } else if (sym == T_PROC) {
-        parseProcedureDefinition(stop);
+static void parseDefinition(Parser *parser, SymSet stop) {
+    if (parser->sym == T_CONST) {
+        parseConstantDefinition(parser, stop);
+    } else if (check(parser, 2, T_INTEGER, T_BOOLEAN)) {
+        parseVariableDefinition(parser, stop);
+    } else if (parser->sym == T_PROC) {
+        parseProcedureDefinition(parser, stop);
     } else {
-        printf("%d: Expected const Integer Boolean or proc but found %s\n", getLine(), getSymName(sym));
-        markError(stop);
+        fprintf(parser->scanner.log, "%d: Expected const Integer Boolean or proc but found %s\n", getLine(&parser->scanner), getSymName(parser->sym));
+        markError(parser, stop);
     }
 }
 
 /* DefinitionPart -> { Definition ";"} */
-static void parseDefinitionPart(SymSet stop) {
+static void parseDefinitionPart(Parser *parser, SymSet stop) {
     SymSet stop1 = unionSet(defFirst, stop);
     SymSet stop2 = newSet(stop1, 1, T_SEMI);
     
-    skipUntil(stop1);
-    while (inSet(defFirst, sym)) {
-        parseDefinition(stop2);
-        expect(T_SEMI, stop1);
+    skipUntil(parser, stop1);
+    while (inSet(defFirst, parser->sym)) {
+        parseDefinition(parser, stop2);
+        expect(parser, T_SEMI, stop1);
     }
 }
 
-/* Block -> "begin" DefinitionPart StatementPart "end" */
-static void parseBlock(SymSet stop) {
+/* Block -> "begin" DefinitionPart StatementPart "end"
+   The block starts with instruction start(varLength, statementAddr) and ends with end. It is
+   the block of procedure proc, NULL for the program. */
+static void parseBlock(Parser *parser, SymSet stop, OpCode start, OpCode end, ObjectRecord *proc) {
     SymSet stop1 = newSet(stop, 1, T_END);
     SymSet stop2 = unionSet(stop1, stmtFirst);
     SymSet stop3 = unionSet(stop2, defFirst);
     
-    startBlock();
-    expect(T_BEGIN, stop3);
-    parseDefinitionPart(stop2);
-    parseStatementPart(stop1);
-    expect(T_END, stop);
-    finishBlock();
+    startBlock(&parser->scope, proc);
+    int outerAddr = parser->blockAddr;
+    int blockAddr = emit2(&parser->code, start, 0, 0);
+    parser->blockAddr = blockAddr;
+    expect(parser, T_BEGIN, stop3);
+    parseDefinitionPart(parser, stop2);
+    patch(&parser->code, blockAddr + 2, parser->code.length);
+    parseStatementPart(parser, stop1);
+    patch(&parser->code, blockAddr + 1, parser->scope.blockTable[parser->scope.blockLevel].varLength);
+    emit0(&parser->code, end);
+    if (parser->sym == T_END) {
+        parser->blockEnd = parser->scanner.source;
+        parser->blockEndLine = parser->scanner.symLine;
+    }
+    expect(parser, T_END, stop);
+    finishBlock(&parser->scope);
+    parser->blockAddr = outerAddr;
 }
 
 /* Program -> Block "." */
-static void parseProgram(SymSet stop) {
-    parseBlock(newSet(stop, 1, T_POINT));
-    expect(T_POINT, stop);
+static void parseProgram(Parser *parser, SymSet stop) {
+    addProc(&parser->code, parser->code.length, "program");
+    parseBlock(parser, newSet(stop, 1, T_POINT), OP_PROG, OP_ENDPROG, NULL);
+    expect(parser, T_POINT, stop);
 }
 
-bool parse() {
-    syntaxError = false;
-    
-    endSet = newSet((SymSet){0}, 1, T_EOF);
-    defFirst = newSet(endSet, 4, T_CONST, T_INTEGER, T_BOOLEAN, T_PROC);
-    stmtFirst = newSet(endSet, 7, T_SKIP, T_WRITE, T_NAME, T_CALL, T_IF, T_DO, T_READ);
-    constFirst = newSet(endSet, 4, T_NUM, T_NAME, T_FALSE, T_TRUE);
-    exprFirst = newSet(endSet, 7, T_MINUS, T_NUM, T_NAME, T_FALSE, T_TRUE, T_LPAREN, T_NOT);
-    termFirst = newSet(endSet, 6, T_NUM, T_NAME, T_FALSE, T_TRUE, T_LPAREN, T_NOT);
+void initParser(Parser *parser, char *source, FILE *log) {
+    initScan(&parser->scanner, source, log);
+    initScope(&parser->scope, &parser->scanner);
+    initCode(&parser->code);
+    parser->syntaxError = false;
+    parser->statementCount = 0;
+    parser->inlineLimit = INLINE_LIMIT;
+    parser->allowWholeArray = false;
+    parser->wholeArray = NULL;
+    parser->hasBitTarget = false;
+    parser->sym = 0;
+    parser->symArg = 0;
+    parser->blocks = NULL;
+    parser->blockEnd = NULL;
+    parser->blockEndLine = 0;
+    parser->procAddrs = NULL;
+    parser->procAddrCount = 0;
+    parser->procAddrCapacity = 0;
+    parser->inlined = NULL;
+    parser->inlinedCount = 0;
+    parser->inlinedCapacity = 0;
+    parser->bodies = NULL;
+    parser->bodyTask = 0;
+    parser->bodyFailed = false;
+    parser->pending = NULL;
+    parser->pendingCount = 0;
+    parser->pendingCapacity = 0;
+    parser->blockAddr = 0;
+    parser->removeDead = true;
+    parser->removal = (Removal){0};
+}
+
+void cleanParser(Parser *parser) {
+    while (parser->scope.blockLevel > 0) {
+        finishBlock(&parser->scope);
+    }
+    cleanScope(&parser->scope);
+    cleanScan(&parser->scanner);
+    cleanCode(&parser->code);
+    memFree(parser->procAddrs);
+    memFree(parser->inlined);
+    for (int i = 0; i < parser->pendingCount; i++) {
+        if (parser->pending[i].copy) {
+            cleanCode(parser->pending[i].copy);
+            memFree(parser->pending[i].copy);
+        }
+    }
+    memFree(parser->pending);
+}
+
+bool parse(Parser *parser) {
+    next(parser);
+    parseProgram(parser, endSet);
+    bool success = !parser->scanner.lexError && !parser->syntaxError && !parser->scope.analysisError;
+    if (success && parser->removeDead) {
+        removeDeadCode(&parser->code, &parser->removal);
+    }
+    return success;
+}
+
+static int compileBodies(void *arg) {
+    BodyQueue *queue = arg;
+    Parser parser;
+    initParser(&parser, queue->source, queue->log);
+    parser.inlineLimit = queue->inlineLimit;
+    parser.bodies = queue;
+    parser.removeDead = false;
+    parser.bodyTask = claimBody(queue);
+    if (parser.bodyTask < queue->count) {
+        parse(&parser);
+    }
+    if (parser.bodyTask < queue->count) {
+        finishBody(queue, parser.bodyTask, NULL);
+    }
+    cleanParser(&parser);
+    return 0;
+}
+
+/* Compiles the procedure bodies of the program block on up to threadCount threads, each of
+   which parses the whole source and skips the bodies the others claimed. The bodies are then
+   reused like cached blocks by a last compilation, which compiles a body itself when a thread
+   could not. Diagnostics come from that compilation only. */
+bool parseParallel(Parser *parser, int threadCount) {
+#ifdef _WIN32
+    FILE *quiet = fopen("NUL", "w");
+#else
+    FILE *quiet = fopen("/dev/null", "w");
+#endif
+    if (threadCount < 2 || !quiet) {
+        if (quiet) {
+            fclose(quiet);
+        }
+        return parse(parser);
+    }
+    BodyQueue queue;
+    initBodyQueue(&queue, parser->scanner.source, quiet, parser->inlineLimit);
+    if (queue.count < 2) {
+        cleanBodyQueue(&queue);
+        fclose(quiet);
+        return parse(parser);
+    }
+    if (threadCount > queue.count) {
+        threadCount = queue.count;
+    }
+    thrd_t *threads = memAlloc(MEM_PARSER, threadCount * sizeof(thrd_t));
+    int started = 0;
+    while (started < threadCount - 1
+           && thrd_create(&threads[started], compileBodies, &queue) == thrd_success) {
+        started++;
+    }
+    compileBodies(&queue);
+    for (int i = 0; i < started; i++) {
+        thrd_join(threads[i], NULL);
+    }
+    memFree(threads);
+    fclose(quiet);
     
-    next();
-    parseProgram(endSet);
-    return !lexError && !syntaxError && !analysisError;
-}
\ No newline at end of file
+    BlockCache blocks;
+    initBlockCache(&blocks);
+    int base = 0;
+    for (int i = 0; i < queue.count; i++) {
+        CachedBlock *block = queue.bodies[i].block;
+        if (block) {
+            block->base = base;
+            base += block->length;
+            addBlock(&blocks, block);
+            queue.bodies[i].block = NULL;
+        }
+    }
+    finishBlocks(&blocks, true);
+    cleanBodyQueue(&queue);
+    parser->blocks = &blocks;
+    bool success = parse(parser);
+    parser->blocks = NULL;
+    cleanBlockCache(&blocks);
+    return success;
+}
@@ -2,7 +2,78 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stdio.h>
+#include "blocks.h"
+#include "bodies.h"
+#include "code.h"
+#include "reach.h"
+#include "scanner.h"
+#include "scope.h"
 
-bool parse();
+#define INLINE_LIMIT 128
+
+typedef struct {
+    int addr;
+    ObjectRecord *obj;
+} ProcAddress;
+
+/* Procedure of the program block whose body another thread compiles. Once a call needs it,
+   copy holds its code if it is inlined and stays NULL if it is called. */
+typedef struct {
+    int addr;
+    int body;
+    bool isResolved;
+    Code *copy;
+} PendingProc;
+
+/* Compilation context: all state of compiling one source text.
+   Procedures whose statements take at most inlineLimit words are inlined, 0 disables it.
+   allowWholeArray lets the next variable access name an array without index, which it then
+   returns in wholeArray. hasBitTarget tells that an assignment stores into a packed Boolean
+   array.
+   With blocks set, procedure blocks are reused from and kept for other compilations of the same
+   file. procAddrs then lists the procedures by address and inlined the procedures inlined so
+   far with their addresses, for the blocks to name the procedures they depend on.
+   With bodies set, the parser compiles the procedure bodies of the program block it claims and
+   skips the others, whose procedures are pending until a call needs them. bodyFailed marks a
+   body that cannot be kept because a procedure it needs did not compile.
+   blockAddr is the address of the PROC of the block being compiled. With removeDead set, the
+   procedures the program cannot reach are removed once it compiled, as told in removal. */
+typedef struct {
+    Scanner scanner;
+    Scope scope;
+    SymbolType sym;
+    int symArg;
+    bool syntaxError;
+    int statementCount;
+    int inlineLimit;
+    bool allowWholeArray;
+    ObjectRecord *wholeArray;
+    bool hasBitTarget;
+    Code code;
+    BlockCache *blocks;
+    const char *blockEnd;
+    int blockEndLine;
+    ProcAddress *procAddrs;
+    int procAddrCount;
+    int procAddrCapacity;
+    ProcAddress *inlined;
+    int inlinedCount;
+    int inlinedCapacity;
+    BodyQueue *bodies;
+    int bodyTask;
+    bool bodyFailed;
+    PendingProc *pending;
+    int pendingCount;
+    int pendingCapacity;
+    int blockAddr;
+    bool removeDead;
+    Removal removal;
+} Parser;
+
+void initParser(Parser *parser, char *source, FILE *log);
+bool parse(Parser *parser);
+bool parseParallel(Parser *parser, int threadCount);
+void cleanParser(Parser *parser);
 
 #endif
@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include "budget.h"
+#include "code.h"
+#include "input.h"
+#include "interpreter.h"
+#include "parser.h"
+#include "pl.h"
+#include "regvm.h"
+
+/* Code of a compiled program, and its register code once it ran on the register machine */
+struct PlProgram {
+    Code code;
+    RegCode regCode;
+    bool isTranslated;
+    bool hasRegisters;
+};
+
+/* A run going on, which failed once its fail callback was called */
+typedef struct {
+    const PlRun *run;
+    bool failed;
+} Running;
+
+static mtx_t runLock;
+static once_flag runOnce = ONCE_FLAG_INIT;
+/* The program loaded into the stack machine, which is only loaded again for another program */
+static const PlProgram *loaded;
+
+static void initRunLock() {
+    mtx_init(&runLock, mtx_plain);
+}
+
+static bool readValue(void *context, int32_t *value) {
+    const PlRun *run = ((Running*)context)->run;
+    return run->read && run->read(run->context, value);
+}
+
+static void writeValue(void *context, int32_t value) {
+    const PlRun *run = ((Running*)context)->run;
+    if (run->write) {
+        run->write(run->context, value);
+    }
+}
+
+static void failRun(void *context, int line, const char *message) {
+    Running *running = context;
+    running->failed = true;
+    if (running->run->fail) {
+        running->run->fail(running->run->context, line, message);
+    }
+}
+
+/* Compiles length bytes of source text, writing the diagnostics to diagnostics unless it is
+   NULL. Returns NULL if the program does not compile. */
+PlProgram *plCompile(const char *source, size_t length, FILE *diagnostics) {
+    char *src = malloc(length + 1);
+    memcpy(src, source, length);
+    src[length] = '\0';
+    FILE *quiet = NULL;
+    if (!diagnostics) {
+#ifdef _WIN32
+        quiet = fopen("NUL", "w");
+#else
+        quiet = fopen("/dev/null", "w");
+#endif
+    }
+    Parser parser;
+    initParser(&parser, src, diagnostics ? diagnostics : quiet ? quiet : stderr);
+    PlProgram *program = NULL;
+    if (parse(&parser)) {
+        program = malloc(sizeof(PlProgram));
+        program->code = parser.code;
+        initCode(&parser.code);
+        initRegCode(&program->regCode);
+        program->isTranslated = false;
+        program->hasRegisters = false;
+    }
+    cleanParser(&parser);
+    if (quiet) {
+        fclose(quiet);
+    }
+    free(src);
+    return program;
+}
+
+/* Runs the program from a cleared store, so that every run starts as the first one did.
+   Returns false if it stopped with a run time error. */
+bool plRun(PlProgram *program, const PlRun *run) {
+    call_once(&runOnce, initRunLock);
+    mtx_lock(&runLock);
+    Running running = {run, false};
+    setProgramIo(&(ProgramIo){&running, readValue, writeValue, failRun});
+    setBudget(run->maxSteps, run->timeLimit);
+    if (run->registers) {
+        if (!program->isTranslated) {
+            program->isTranslated = true;
+            program->hasRegisters = translateCode(&program->code, &program->regCode);
+        }
+        if (!program->hasRegisters) {
+            reportError(0, "Cannot translate program for the register machine");
+        } else if (loadRegisters(&program->regCode)) {
+            resetRegisters();
+            runRegisters();
+        }
+    } else {
+        if (loaded != program) {
+            loaded = loadProgram(&program->code) ? program : NULL;
+        }
+        if (loaded == program) {
+            resetProgram();
+            runParallel(run->parThreads);
+        }
+    }
+    setBudget(0, 0);
+    setProgramIo(NULL);
+    mtx_unlock(&runLock);
+    return !running.failed;
+}
+
+void plFree(PlProgram *program) {
+    if (!program) {
+        return;
+    }
+    call_once(&runOnce, initRunLock);
+    mtx_lock(&runLock);
+    if (loaded == program) {
+        loaded = NULL;
+    }
+    mtx_unlock(&runLock);
+    cleanRegCode(&program->regCode);
+    cleanCode(&program->code);
+    free(program);
+}
@@ -0,0 +1,35 @@
+#ifndef PL_H
+#define PL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* The compiler and both machines as a library. A program is compiled once into a handle, which
+   then runs any number of times without being compiled again. The machines are shared, so runs
+   take turns: plRun waits while another thread runs a program. Compiling needs no turn. */
+typedef struct PlProgram PlProgram;
+
+/* How to run a program. read gives the next input value and returns false at the end of the
+   input, where a read leaves its variables unchanged. write takes every value written and fail
+   the run time error that stopped the program, with line 0 for errors that have no line. Any
+   callback may be NULL. They get context and are called one at a time, also when par branches
+   run on parThreads threads. maxSteps and timeLimit limit the run like --max-steps and
+   --time-limit, 0 for no limit. registers runs it on the register machine. */
+typedef struct {
+    void *context;
+    bool (*read)(void *context, int32_t *value);
+    void (*write)(void *context, int32_t value);
+    void (*fail)(void *context, int line, const char *message);
+    bool registers;
+    int parThreads;
+    int64_t maxSteps;
+    int64_t timeLimit;
+} PlRun;
+
+PlProgram *plCompile(const char *source, size_t length, FILE *diagnostics);
+bool plRun(PlProgram *program, const PlRun *run);
+void plFree(PlProgram *program);
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define HAS_RDTSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+#define HOT_LINES 10
+
+typedef struct {
+    int line;
+    int64_t count;
+} LineCount;
+
+uint64_t readCycles() {
+#ifdef HAS_RDTSC
+    return __rdtsc();
+#else
+    return (uint64_t)clock();
+#endif
+}
+
+void initProfile(Profile *profile, int codeLength) {
+    memset(profile->opCounts, 0, sizeof(profile->opCounts));
+    profile->pcCounts = calloc(codeLength, sizeof(int64_t));
+    profile->calls = calloc(codeLength, sizeof(int64_t));
+    profile->cycles = calloc(codeLength, sizeof(uint64_t));
+    profile->active = calloc(codeLength, sizeof(int));
+    profile->codeLength = codeLength;
+    profile->callStack = NULL;
+    profile->startStack = NULL;
+    profile->depth = 0;
+    profile->stackCapacity = 0;
+}
+
+void cleanProfile(Profile *profile) {
+    free(profile->pcCounts);
+    free(profile->calls);
+    free(profile->cycles);
+    free(profile->active);
+    free(profile->callStack);
+    free(profile->startStack);
+}
+
+/* Time spent in recursive activations is counted once, by the outermost activation */
+void enterBlock(Profile *profile, int addr) {
+    if (addr < 0 || addr >= profile->codeLength) {
+        return;
+    }
+    if (profile->depth >= profile->stackCapacity) {
+        profile->stackCapacity = profile->stackCapacity ? 2 * profile->stackCapacity : 64;
+        profile->callStack = realloc(profile->callStack, profile->stackCapacity * sizeof(int));
+        profile->startStack = realloc(profile->startStack, profile->stackCapacity * sizeof(uint64_t));
+    }
+    profile->calls[addr]++;
+    profile->active[addr]++;
+    profile->callStack[profile->depth] = addr;
+    profile->startStack[profile->depth] = readCycles();
+    profile->depth++;
+}
+
+void leaveBlock(Profile *profile) {
+    if (profile->depth == 0) {
+        return;
+    }
+    profile->depth--;
+    int addr = profile->callStack[profile->depth];
+    profile->active[addr]--;
+    if (profile->active[addr] == 0) {
+        profile->cycles[addr] += readCycles() - profile->startStack[profile->depth];
+    }
+}
+
+static int compareLines(const void *a, const void *b) {
+    const LineCount *x = a;
+    const LineCount *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->line - y->line;
+}
+
+void printProfile(Profile *profile, const Code *code, FILE *f) {
+    while (profile->depth > 0) {
+        leaveBlock(profile);
+    }
+    int64_t total = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        total += profile->opCounts[op];
+    }
+    
+    fprintf(f, "Instructions: %lld\n", (long long)total);
+    fprintf(f, "%-10s %14s %7s\n", "opcode", "count", "share");
+    for (int op = 1; op < OP_COUNT; op++) {
+        if (profile->opCounts[op] > 0) {
+            fprintf(f, "%-10s %14lld %6.2f%%\n", getOpName(op), (long long)profile->opCounts[op],
+                100.0 * profile->opCounts[op] / total);
+        }
+    }
+    
+    fprintf(f, "\n%-16s %12s %16s %14s\n", "procedure", "calls", "cycles", "cycles/call");
+    for (int i = 0; i < code->procCount; i++) {
+        int addr = code->procs[i].addr;
+        if (addr < profile->codeLength && profile->calls[addr] > 0) {
+            fprintf(f, "%-16s %12lld %16llu %14.1f\n", code->procs[i].name,
+                (long long)profile->calls[addr], (unsigned long long)profile->cycles[addr],
+                (double)profile->cycles[addr] / profile->calls[addr]);
+        }
+    }
+    
+    int *lineOf = malloc((code->length + 1) * sizeof(int));
+    expandLines(code, lineOf);
+    int maxLine = 0;
+    for (int pc = 0; pc < code->length; pc++) {
+        if (lineOf[pc] > maxLine) {
+            maxLine = lineOf[pc];
+        }
+    }
+    LineCount *lines = calloc(maxLine + 1, sizeof(LineCount));
+    for (int i = 0; i <= maxLine; i++) {
+        lines[i].line = i;
+    }
+    for (int pc = 0; pc < profile->codeLength && pc < code->length; pc++) {
+        if (profile->pcCounts[pc] > 0 && lineOf[pc] >= 0) {
+            lines[lineOf[pc]].count += profile->pcCounts[pc];
+        }
+    }
+    free(lineOf);
+    qsort(lines, maxLine + 1, sizeof(LineCount), compareLines);
+    fprintf(f, "\n%-6s %14s %7s\n", "line", "instructions", "share");
+    for (int i = 0; i < HOT_LINES && i <= maxLine && lines[i].count > 0; i++) {
+        fprintf(f, "%-6d %14lld %6.2f%%\n", lines[i].line, (long long)lines[i].count,
+            100.0 * lines[i].count / total);
+    }
+    free(lines);
+}
@@ -0,0 +1,29 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "code.h"
+
+/* Execution counts gathered by profileProgram. The arrays are indexed by code address. */
+struct Profile {
+    int64_t opCounts[OP_COUNT];
+    int64_t *pcCounts;
+    int64_t *calls;
+    uint64_t *cycles;
+    int *active;
+    int codeLength;
+    int *callStack;
+    uint64_t *startStack;
+    int depth;
+    int stackCapacity;
+};
+
+void initProfile(Profile *profile, int codeLength);
+void cleanProfile(Profile *profile);
+void enterBlock(Profile *profile, int addr);
+void leaveBlock(Profile *profile);
+void printProfile(Profile *profile, const Code *code, FILE *f);
+uint64_t readCycles();
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include "reach.h"
+
+/* Block of the code from its PROC (PROG for the program) at addr to its ENDPROC at end. Its
+   statements run from stmt to end, after the blocks nested in it. */
+typedef struct {
+    int addr;
+    int stmt;
+    int end;
+    int parent;
+    bool isLive;
+    bool isCompact;
+    int frameWords;
+    int firstSpace;
+    int spaceCount;
+} ReachBlock;
+
+typedef struct {
+    const Code *code;
+    ReachBlock *blocks;
+    int count;
+    int *order;
+    bool *isUsed;
+    int *newDispl;
+} Reach;
+
+static int blockAt(const Reach *reach, int addr) {
+    int low = 0;
+    int high = reach->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        if (reach->blocks[mid].addr == addr) {
+            return mid;
+        } else if (reach->blocks[mid].addr < addr) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/* Returns the block whose frame is levelDiff static links up from block, -1 if there is none */
+static int frameOf(const Reach *reach, int block, int levelDiff) {
+    while (levelDiff-- > 0 && block >= 0) {
+        block = reach->blocks[block].parent;
+    }
+    return block;
+}
+
+/* Returns the space of a frame holding displ, -1 if none does */
+static int spaceAt(const Reach *reach, int frame, int displ) {
+    const ReachBlock *block = &reach->blocks[frame];
+    int low = 0;
+    int high = block->spaceCount - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const FrameSpace *space = &reach->code->spaces[reach->order[block->firstSpace + mid]];
+        if (displ < space->displ) {
+            high = mid - 1;
+        } else if (displ >= space->displ + space->words) {
+            low = mid + 1;
+        } else {
+            return reach->order[block->firstSpace + mid];
+        }
+    }
+    return -1;
+}
+
+/* A space to sort with the fields it is sorted by, so that the comparison needs no code */
+typedef struct {
+    int block;
+    int displ;
+    int index;
+} SpaceKey;
+
+static int compareSpaces(const void *a, const void *b) {
+    const SpaceKey *x = a;
+    const SpaceKey *y = b;
+    if (x->block != y->block) {
+        return x->block < y->block ? -1 : 1;
+    }
+    if (x->displ != y->displ) {
+        return x->displ < y->displ ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Marks every block reachable by calls from the statements of the program */
+static void markLive(Reach *reach) {
+    const int32_t *words = reach->code->words;
+    int *work = malloc(reach->count * sizeof(int));
+    int top = 0;
+    reach->blocks[0].isLive = true;
+    work[top++] = 0;
+    while (top > 0) {
+        const ReachBlock *block = &reach->blocks[work[--top]];
+        for (int pc = block->stmt; pc < block->end; pc += getOpLength(words[pc])) {
+            if (words[pc] != OP_CALL) {
+                continue;
+            }
+            int callee = blockAt(reach, words[pc + 2]);
+            if (callee >= 0 && !reach->blocks[callee].isLive) {
+                reach->blocks[callee].isLive = true;
+                work[top++] = callee;
+            }
+        }
+    }
+    free(work);
+}
+
+/* Marks the spaces that the statements of live blocks address. A frame whose spaces do not
+   add up to its length, or that is addressed outside them, keeps its layout. */
+static void markSpaces(Reach *reach) {
+    const Code *code = reach->code;
+    reach->order = malloc(code->spaceCount * sizeof(int));
+    SpaceKey *keys = malloc(code->spaceCount * sizeof(SpaceKey));
+    int count = 0;
+    for (int i = 0; i < code->spaceCount; i++) {
+        if (blockAt(reach, code->spaces[i].block) >= 0) {
+            keys[count++] = (SpaceKey){code->spaces[i].block, code->spaces[i].displ, i};
+        }
+    }
+    qsort(keys, count, sizeof(SpaceKey), compareSpaces);
+    for (int i = 0; i < count; i++) {
+        reach->order[i] = keys[i].index;
+    }
+    free(keys);
+    for (int i = 0; i < count; i++) {
+        ReachBlock *block = &reach->blocks[blockAt(reach, code->spaces[reach->order[i]].block)];
+        if (block->spaceCount == 0) {
+            block->firstSpace = i;
+        }
+        block->spaceCount++;
+        block->frameWords += code->spaces[reach->order[i]].words;
+    }
+    for (int i = 0; i < reach->count; i++) {
+        ReachBlock *block = &reach->blocks[i];
+        block->isCompact = block->frameWords == code->words[block->addr + 1];
+    }
+
+    reach->isUsed = calloc(code->spaceCount, sizeof(bool));
+    for (int i = 0; i < reach->count; i++) {
+        const ReachBlock *block = &reach->blocks[i];
+        if (!block->isLive) {
+            continue;
+        }
+        for (int pc = block->stmt; pc < block->end; pc += getOpLength(code->words[pc])) {
+            if (code->words[pc] != OP_VARIABLE) {
+                continue;
+            }
+            int frame = frameOf(reach, i, code->words[pc + 1]);
+            if (frame < 0 || !reach->blocks[frame].isCompact) {
+                continue;
+            }
+            int space = spaceAt(reach, frame, code->words[pc + 2]);
+            if (space < 0) {
+                reach->blocks[frame].isCompact = false;
+            } else {
+                reach->isUsed[space] = true;
+            }
+        }
+    }
+}
+
+/* Gives the used spaces of every compact frame new displacements in the same order */
+static int compactFrames(Reach *reach) {
+    const Code *code = reach->code;
+    reach->newDispl = malloc(code->spaceCount * sizeof(int));
+    int dropped = 0;
+    for (int i = 0; i < reach->count; i++) {
+        ReachBlock *block = &reach->blocks[i];
+        if (!block->isCompact) {
+            block->frameWords = code->words[block->addr + 1];
+            continue;
+        }
+        int length = 0;
+        for (int j = 0; j < block->spaceCount; j++) {
+            int space = reach->order[block->firstSpace + j];
+            if (reach->isUsed[space]) {
+                reach->newDispl[space] = 3 + length;
+                length += code->spaces[space].words;
+            }
+        }
+        if (block->isLive) {
+            dropped += block->frameWords - length;
+        }
+        block->frameWords = length;
+    }
+    return dropped;
+}
+
+/* Removes the procedures that no chain of calls from the program statements reaches, and the
+   frame space that only removed code used. Inlined procedures are reached through the CALL
+   instructions of their copies. The remaining code is copied with its lines, and its addresses
+   and displacements are moved. */
+void removeDeadCode(Code *code, Removal *removal) {
+    *removal = (Removal){0};
+    Reach reach = {.code = code, .blocks = NULL, .count = 0};
+    const int32_t *words = code->words;
+    for (int pc = 0; pc < code->length; pc += getOpLength(words[pc])) {
+        if (words[pc] == OP_PROC || words[pc] == OP_PROG) {
+            reach.count++;
+        }
+    }
+    if (reach.count == 0 || words[0] != OP_PROG) {
+        return;
+    }
+    reach.blocks = calloc(reach.count, sizeof(ReachBlock));
+    int *stack = malloc(reach.count * sizeof(int));
+    int depth = 0;
+    int count = 0;
+    for (int pc = 0; pc < code->length; pc += getOpLength(words[pc])) {
+        if (words[pc] == OP_PROC || words[pc] == OP_PROG) {
+            reach.blocks[count] = (ReachBlock){.addr = pc, .stmt = words[pc + 2], .end = code->length,
+                .parent = depth > 0 ? stack[depth - 1] : -1};
+            stack[depth++] = count++;
+        } else if ((words[pc] == OP_ENDPROC || words[pc] == OP_ENDPROG) && depth > 0) {
+            reach.blocks[stack[--depth]].end = pc;
+        }
+    }
+    removal->procCount = reach.count - 1;
+    markLive(&reach);
+    markSpaces(&reach);
+    removal->frameWords = compactFrames(&reach);
+    for (int i = 0; i < reach.count; i++) {
+        if (!reach.blocks[i].isLive) {
+            removal->procs++;
+        }
+    }
+
+    if (removal->procs > 0 || removal->frameWords > 0) {
+        int *lines = malloc(code->length * sizeof(int));
+        int *map = malloc(code->length * sizeof(int));
+        expandLines(code, lines);
+        Code kept;
+        initCode(&kept);
+        depth = 0;
+        count = 0;
+        for (int pc = 0; pc < code->length; pc += getOpLength(words[pc])) {
+            OpCode op = words[pc];
+            if (op == OP_PROC || op == OP_PROG) {
+                stack[depth++] = count++;
+            }
+            int block = stack[depth - 1];
+            if (reach.blocks[block].isLive) {
+                map[pc] = kept.length;
+                setLine(&kept, lines[pc]);
+                appendWords(&kept, &words[pc], getOpLength(op));
+                int frame = op == OP_VARIABLE ? frameOf(&reach, block, words[pc + 1]) : -1;
+                if (frame >= 0 && reach.blocks[frame].isCompact) {
+                    int space = spaceAt(&reach, frame, words[pc + 2]);
+                    kept.words[map[pc] + 2] = reach.newDispl[space] + words[pc + 2] - code->spaces[space].displ;
+                } else if (op == OP_PROC || op == OP_PROG) {
+                    kept.words[map[pc] + 1] = reach.blocks[block].frameWords;
+                }
+            } else {
+                removal->words += getOpLength(op);
+            }
+            if ((op == OP_ENDPROC || op == OP_ENDPROG) && depth > 1) {
+                depth--;
+            }
+        }
+        for (int pc = 0; pc < kept.length; pc += getOpLength(kept.words[pc])) {
+            OpCode op = kept.words[pc];
+            if (isJump(op)) {
+                kept.words[pc + 1] = map[kept.words[pc + 1]];
+            } else if (op == OP_CALL || op == OP_PROC || op == OP_PROG) {
+                kept.words[pc + 2] = map[kept.words[pc + 2]];
+            }
+        }
+        for (int i = 0; i < code->procCount; i++) {
+            int block = blockAt(&reach, code->procs[i].addr);
+            if (block >= 0 && reach.blocks[block].isLive) {
+                addProc(&kept, map[code->procs[i].addr], code->procs[i].name);
+            }
+        }
+        kept.last = map[code->last];
+        cleanCode(code);
+        *code = kept;
+        free(lines);
+        free(map);
+    }
+    free(stack);
+    free(reach.blocks);
+    free(reach.order);
+    free(reach.isUsed);
+    free(reach.newDispl);
+}
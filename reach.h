@@ -0,0 +1,16 @@
+#ifndef REACH_H
+#define REACH_H
+
+#include "code.h"
+
+/* What removeDeadCode took out of a program */
+typedef struct {
+    int procs;
+    int procCount;
+    int words;
+    int frameWords;
+} Removal;
+
+void removeDeadCode(Code *code, Removal *removal);
+
+#endif
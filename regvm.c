@@ -0,0 +1,649 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "budget.h"
+#include "code.h"
+#include "input.h"
+#include "interpreter.h"
+#include "regvm.h"
+
+#define REG_CODE_LEN 1024
+#define MAX_NESTING 32
+
+typedef enum {
+    E_CONSTANT, // a: value
+    E_REGISTER, // a: register holding the value
+    E_LOCAL,    // a: displacement of a variable of the running block
+    E_OUTER,    // a: displacement, b: level difference of a variable of an enclosing block
+    E_ADDRESS,  // a: register holding the address of a variable
+    E_BIT       // a: register holding 32 * word + bit of an element of a packed Boolean array
+} EntryKind;
+
+/* An operand of the stack machine, kept symbolically until an instruction consumes it */
+typedef struct {
+    EntryKind kind;
+    int a;
+    int b;
+} Entry;
+
+typedef struct {
+    int procAddr;
+    int varLength;
+    int tempBase;
+    int maxDepth;
+} Block;
+
+typedef struct {
+    RegCode *out;
+    Entry *stack;
+    int depth;
+    int capacity;
+    Block blocks[MAX_NESTING];
+    int blockCount;
+    int lastWrite;
+    int origin;
+} Translator;
+
+void initRegCode(RegCode *regCode) {
+    regCode->words = NULL;
+    regCode->length = 0;
+    regCode->capacity = 0;
+    regCode->constants = NULL;
+    regCode->constantCount = 0;
+    regCode->constantCapacity = 0;
+    regCode->origins = NULL;
+    regCode->code = NULL;
+}
+
+void cleanRegCode(RegCode *regCode) {
+    free(regCode->words);
+    free(regCode->constants);
+    free(regCode->origins);
+    initRegCode(regCode);
+}
+
+/* Returns the address of the instruction. The instruction does not count as the producer
+   of a temporary unless the caller sets lastWrite. */
+static int emit(Translator *t, RegOp op, int32_t a, int32_t b, int32_t c) {
+    RegCode *out = t->out;
+    if (out->length + 4 > out->capacity) {
+        out->capacity = out->capacity ? 2 * out->capacity : REG_CODE_LEN;
+        out->words = realloc(out->words, out->capacity * sizeof(int32_t));
+        out->origins = realloc(out->origins, out->capacity / 4 * sizeof(int));
+    }
+    int addr = out->length;
+    out->words[addr] = op;
+    out->words[addr + 1] = a;
+    out->words[addr + 2] = b;
+    out->words[addr + 3] = c;
+    out->origins[addr / 4] = t->origin;
+    out->length += 4;
+    t->lastWrite = -1;
+    return addr;
+}
+
+static int constant(Translator *t, int32_t value) {
+    RegCode *out = t->out;
+    if (out->constantCount >= out->constantCapacity) {
+        out->constantCapacity = out->constantCapacity ? 2 * out->constantCapacity : REG_CODE_LEN;
+        out->constants = realloc(out->constants, out->constantCapacity * sizeof(int32_t));
+    }
+    out->constants[out->constantCount] = value;
+    return -1 - out->constantCount++;
+}
+
+static Block *block(Translator *t) {
+    return &t->blocks[t->blockCount - 1];
+}
+
+/* The temporary register of stack position i */
+static int temp(Translator *t, int i) {
+    return block(t)->tempBase + i;
+}
+
+static void push(Translator *t, EntryKind kind, int a, int b) {
+    if (t->depth >= t->capacity) {
+        t->capacity = t->capacity ? 2 * t->capacity : 64;
+        t->stack = realloc(t->stack, t->capacity * sizeof(Entry));
+    }
+    t->stack[t->depth++] = (Entry){kind, a, b};
+    if (t->depth > block(t)->maxDepth) {
+        block(t)->maxDepth = t->depth;
+    }
+}
+
+/* Source operand of the value at stack position i */
+static int operand(Translator *t, int i) {
+    Entry *e = &t->stack[i];
+    return e->kind == E_CONSTANT ? constant(t, e->a) : e->a;
+}
+
+/* Replaces the address at stack position i by the value it refers to. The value of a variable
+   of the running block is its register, so it needs no instruction. */
+static void toValue(Translator *t, int i) {
+    Entry *e = &t->stack[i];
+    int reg = temp(t, i);
+    if (e->kind == E_LOCAL) {
+        *e = (Entry){E_REGISTER, e->a, 0};
+    } else if (e->kind == E_OUTER) {
+        t->lastWrite = emit(t, R_GETOUTER, reg, e->a, e->b);
+        *e = (Entry){E_REGISTER, reg, 0};
+    } else if (e->kind == E_ADDRESS) {
+        t->lastWrite = emit(t, R_LOAD, reg, e->a, 0);
+        *e = (Entry){E_REGISTER, reg, 0};
+    } else if (e->kind == E_BIT) {
+        t->lastWrite = emit(t, R_LOADBIT, reg, e->a, 0);
+        *e = (Entry){E_REGISTER, reg, 0};
+    }
+}
+
+/* Returns a register holding the address at stack position i */
+static int toAddress(Translator *t, int i) {
+    Entry *e = &t->stack[i];
+    if (e->kind == E_ADDRESS) {
+        return e->a;
+    }
+    int reg = temp(t, i);
+    emit(t, R_ADDRESS, reg, e->a, e->kind == E_OUTER ? e->b : 0);
+    return reg;
+}
+
+static void translateBinary(Translator *t, RegOp op) {
+    int b = operand(t, t->depth - 1);
+    int a = operand(t, t->depth - 2);
+    t->depth--;
+    int reg = temp(t, t->depth - 1);
+    t->lastWrite = emit(t, op, reg, a, b);
+    t->stack[t->depth - 1] = (Entry){E_REGISTER, reg, 0};
+}
+
+static void translateUnary(Translator *t, RegOp op) {
+    int a = operand(t, t->depth - 1);
+    int reg = temp(t, t->depth - 1);
+    t->lastWrite = emit(t, op, reg, a, 0);
+    t->stack[t->depth - 1] = (Entry){E_REGISTER, reg, 0};
+}
+
+static void storeValue(Translator *t, Entry *target, int value) {
+    if (target->kind == E_LOCAL) {
+        emit(t, R_MOVE, target->a, value, 0);
+    } else if (target->kind == E_OUTER) {
+        emit(t, R_SETOUTER, target->a, value, target->b);
+    } else if (target->kind == E_BIT) {
+        emit(t, R_STOREBIT, target->a, value, 0);
+    } else {
+        emit(t, R_STORE, target->a, value, 0);
+    }
+}
+
+/* A single assignment to a variable of the running block takes over the destination of the
+   instruction computing its value. In a multiple assignment a value still held by a variable
+   is copied before an earlier target overwrites that variable. */
+static void translateAssign(Translator *t, int count) {
+    int first = t->depth - 2 * count;
+    Entry *targets = &t->stack[first];
+    Entry *values = &t->stack[first + count];
+    RegCode *out = t->out;
+    if (count == 1 && targets[0].kind == E_LOCAL && values[0].kind == E_REGISTER
+        && values[0].a >= block(t)->tempBase && t->lastWrite >= 0
+        && out->words[t->lastWrite + 1] == values[0].a) {
+        out->words[t->lastWrite + 1] = targets[0].a;
+    } else {
+        for (int j = 1; j < count; j++) {
+            if (values[j].kind != E_REGISTER || values[j].a >= block(t)->tempBase) {
+                continue;
+            }
+            for (int k = 0; k < j; k++) {
+                if (targets[k].kind == E_LOCAL && targets[k].a == values[j].a) {
+                    int reg = temp(t, first + count + j);
+                    emit(t, R_MOVE, reg, values[j].a, 0);
+                    values[j].a = reg;
+                    break;
+                }
+            }
+        }
+        for (int k = 0; k < count; k++) {
+            storeValue(t, &targets[k], operand(t, first + count + k));
+        }
+    }
+    t->depth = first;
+    t->lastWrite = -1;
+}
+
+/* A guard that ends in a comparison just computed becomes a single compare and branch */
+static void translateArrow(Translator *t, int target) {
+    Entry *e = &t->stack[t->depth - 1];
+    RegCode *out = t->out;
+    RegOp fused = 0;
+    if (e->kind == E_REGISTER && t->lastWrite >= 0 && out->words[t->lastWrite + 1] == e->a
+        && e->a >= block(t)->tempBase) {
+        switch (out->words[t->lastWrite]) {
+            case R_LESS: fused = R_JUMPNOTLESS; break;
+            case R_EQUAL: fused = R_JUMPNOTEQUAL; break;
+            case R_GREATER: fused = R_JUMPNOTGREATER; break;
+            case R_NOT: fused = R_JUMPNONZERO; break;
+            default: break;
+        }
+    }
+    if (fused) {
+        out->words[t->lastWrite] = fused;
+        out->words[t->lastWrite + 1] = target;
+    } else {
+        emit(t, R_JUMPFALSE, target, operand(t, t->depth - 1), 0);
+    }
+    t->depth--;
+    t->lastWrite = -1;
+}
+
+static void translateCompareJump(Translator *t, RegOp op, int target) {
+    int b = operand(t, t->depth - 2);
+    int c = operand(t, t->depth - 1);
+    t->depth -= 2;
+    emit(t, op, target, b, c);
+}
+
+static bool startBlock(Translator *t, RegOp op, int varLength, int stmtAddr) {
+    if (t->blockCount >= MAX_NESTING) {
+        return false;
+    }
+    int addr = emit(t, op, 0, stmtAddr, 0);
+    t->blocks[t->blockCount++] = (Block){addr, varLength, 3 + varLength, 0};
+    return true;
+}
+
+static void endBlock(Translator *t, RegOp op) {
+    emit(t, op, 0, 0, 0);
+    if (t->blockCount > 0) {
+        Block *b = block(t);
+        t->out->words[b->procAddr + 1] = b->varLength + b->maxDepth;
+        t->blockCount--;
+    }
+}
+
+static bool translateInstruction(Translator *t, const int32_t *words) {
+    if (t->blockCount == 0 && words[0] != OP_PROG && words[0] != OP_PROC) {
+        return false;
+    }
+    switch (words[0]) {
+        case OP_ADD: translateBinary(t, R_ADD); break;
+        case OP_AND: translateBinary(t, R_AND); break;
+        case OP_ARROW: translateArrow(t, words[1]); break;
+        case OP_ASSIGN: translateAssign(t, words[1]); break;
+        case OP_ASSIGNBITS: translateAssign(t, words[1]); break;
+        case OP_BAR: emit(t, R_JUMP, words[1], 0, 0); break;
+        case OP_BRANCH: break;
+        case OP_CALL: emit(t, R_CALL, words[1], words[2], 0); break;
+        case OP_CONSTANT: push(t, E_CONSTANT, words[1], 0); break;
+        case OP_COPY:
+            emit(t, R_COPY, toAddress(t, t->depth - 2), toAddress(t, t->depth - 1), words[1]);
+            t->depth -= 2;
+            break;
+        case OP_DIVIDE: translateBinary(t, R_DIVIDE); break;
+        case OP_ENDBRANCH: break;
+        case OP_ENDPROC: endBlock(t, R_ENDPROC); break;
+        case OP_ENDPROG: endBlock(t, R_ENDPROG); break;
+        case OP_EQUAL: translateBinary(t, R_EQUAL); break;
+        case OP_FI: emit(t, R_FI, 0, 0, 0); break;
+        case OP_FILL:
+            emit(t, R_FILL, toAddress(t, t->depth - 2), operand(t, t->depth - 1), words[1]);
+            t->depth -= 2;
+            break;
+        case OP_FILLBITS:
+            emit(t, R_FILLBITS, toAddress(t, t->depth - 2), operand(t, t->depth - 1), words[1]);
+            t->depth -= 2;
+            break;
+        case OP_GREATER: translateBinary(t, R_GREATER); break;
+        case OP_INDEX: {
+            int index = operand(t, t->depth - 1);
+            t->depth--;
+            int reg = toAddress(t, t->depth - 1);
+            emit(t, R_INDEX, reg, index, words[1]);
+            t->stack[t->depth - 1] = (Entry){E_ADDRESS, reg, 0};
+            break;
+        }
+        case OP_INDEXBIT: {
+            int index = operand(t, t->depth - 1);
+            t->depth--;
+            int reg = toAddress(t, t->depth - 1);
+            emit(t, R_INDEXBIT, reg, index, words[1]);
+            t->stack[t->depth - 1] = (Entry){E_BIT, reg, 0};
+            break;
+        }
+        case OP_JUMPEQUAL: translateCompareJump(t, R_JUMPEQUAL, words[1]); break;
+        case OP_JUMPFALSE:
+            emit(t, R_JUMPZERO, words[1], operand(t, t->depth - 1), 0);
+            t->depth--;
+            break;
+        case OP_JUMPGREATER: translateCompareJump(t, R_JUMPGREATER, words[1]); break;
+        case OP_JUMPLESS: translateCompareJump(t, R_JUMPLESS, words[1]); break;
+        case OP_JUMPTRUE:
+            emit(t, R_JUMPTRUE, words[1], operand(t, t->depth - 1), 0);
+            t->depth--;
+            break;
+        case OP_LESS: translateBinary(t, R_LESS); break;
+        case OP_MINUS: translateUnary(t, R_MINUS); break;
+        case OP_MODULO: translateBinary(t, R_MODULO); break;
+        case OP_MULTIPLY: translateBinary(t, R_MULTIPLY); break;
+        case OP_NOT: translateUnary(t, R_NOT); break;
+        case OP_OR: translateBinary(t, R_OR); break;
+        case OP_PAR: break;
+        case OP_PROC: return startBlock(t, R_PROC, words[1], words[2]);
+        case OP_PROG: return startBlock(t, R_PROG, words[1], words[2]);
+        case OP_READ:
+            for (int i = t->depth - words[1]; i < t->depth; i++) {
+                emit(t, R_READ, toAddress(t, i), 0, 0);
+            }
+            t->depth -= words[1];
+            break;
+        case OP_READARRAY:
+            emit(t, R_READARRAY, toAddress(t, t->depth - 1), 0, words[1]);
+            t->depth--;
+            break;
+        case OP_SPLIT: t->depth -= 2; break;
+        case OP_SUBTRACT: translateBinary(t, R_SUBTRACT); break;
+        case OP_VALUE: toValue(t, t->depth - 1); break;
+        case OP_VALUEBIT: toValue(t, t->depth - 1); break;
+        case OP_VARIABLE:
+            if (words[1] == 0) {
+                push(t, E_LOCAL, words[2], 0);
+            } else {
+                push(t, E_OUTER, words[2], words[1]);
+            }
+            break;
+        case OP_WRITE:
+            for (int i = t->depth - words[1]; i < t->depth; i++) {
+                emit(t, R_WRITE, 0, operand(t, i), 0);
+            }
+            t->depth -= words[1];
+            break;
+        default:
+            return false;
+    }
+    return t->depth >= 0;
+}
+
+/* Translates the code of the stack machine. Jumps of the stack code only lead to statement
+   and guard boundaries, where the stack is empty, so one pass in address order that keeps the
+   stack symbolically sees the same stack at every instruction as the stack machine does. The
+   branches of par statements run one after another. Split loops run their iterations
+   themselves, so the copy of their body after SPLIT is left out; the code was verified, so
+   SPLIT leads forward. */
+bool translateCode(const Code *code, RegCode *regCode) {
+    Translator t = {.out = regCode, .stack = NULL, .depth = 0, .capacity = 0, .blockCount = 0,
+                    .lastWrite = -1};
+    regCode->code = code;
+    int *addrMap = malloc((code->length + 1) * sizeof(int));
+    bool ok = true;
+    int next;
+    for (int pc = 0; ok && pc < code->length; pc = next) {
+        next = code->words[pc] == OP_SPLIT ? code->words[pc + 1] : pc + getOpLength(code->words[pc]);
+        addrMap[pc] = regCode->length;
+        t.origin = pc;
+        ok = pc + getOpLength(code->words[pc]) <= code->length
+            && translateInstruction(&t, &code->words[pc]);
+    }
+    addrMap[code->length] = regCode->length;
+
+    for (int addr = 0; ok && addr < regCode->length; addr += 4) {
+        int32_t *words = &regCode->words[addr];
+        if (words[0] >= R_JUMP && words[0] <= R_JUMPZERO) {
+            words[1] = addrMap[words[1]];
+        } else if (words[0] == R_CALL || words[0] == R_PROC || words[0] == R_PROG) {
+            words[2] = addrMap[words[2]];
+        }
+    }
+    free(addrMap);
+    free(t.stack);
+    return ok;
+}
+
+static int32_t store[MAX_STORE];
+static const int32_t *words;
+static const int32_t *constants;
+static int pc;
+static int bp;
+static int sp;
+static bool isRunning;
+static bool hasFailed;
+static const RegCode *program;
+static int64_t steps;
+
+#define R(x) store[bp + (x)]
+#define RK(x) ((x) >= 0 ? store[bp + (x)] : constants[-1 - (x)])
+
+static void error(const char *text) {
+    reportError(findLine(program->code, program->origins[pc / 4]), text);
+    isRunning = false;
+    hasFailed = true;
+}
+
+static void refillSteps() {
+    const char *spent = takeSteps(&steps);
+    if (spent) {
+        error(spent);
+    }
+}
+
+/* Backward branches and calls spend a step of the budget */
+static inline void spendStep() {
+    if (--steps < 0) {
+        refillSteps();
+    }
+}
+
+/* Target of a branch taken by JUMPEQUAL, JUMPGREATER, JUMPLESS, JUMPTRUE or JUMPZERO. These are
+   only translated from the branches that close loops, so they always jump back. */
+static inline int back(int target) {
+    spendStep();
+    return target;
+}
+
+static bool allocate(int wordCount) {
+    sp = sp + wordCount;
+    if (sp >= MAX_STORE) {
+        reportError(0, "Stack Overflow");
+        isRunning = false;
+        hasFailed = true;
+        return false;
+    }
+    return true;
+}
+
+/* Base of the frame level blocks out from the running one */
+static int frame(int level) {
+    int x = bp;
+    while (level > 0) {
+        x = store[x];
+        level--;
+    }
+    return x;
+}
+
+bool loadRegisters(const RegCode *regCode) {
+    words = regCode->words;
+    constants = regCode->constants;
+    program = regCode;
+    return regCode->length > 0;
+}
+
+/* Clears the frames a run left, so that the next run starts as the first one did */
+void resetRegisters() {
+    memset(store, 0, sizeof(store));
+}
+
+/* Executes the loaded code. Compiled once without and once with the count of instructions,
+   so that runRegisters carries no counting code. */
+static inline int64_t run(bool counting) {
+    int64_t count = 0;
+    isRunning = true;
+    hasFailed = false;
+    pc = 0;
+    steps = 0;
+    startBudget();
+    while (isRunning) {
+        if (counting) {
+            count++;
+        }
+        const int32_t *i = &words[pc];
+        int32_t a = i[1];
+        int32_t b = i[2];
+        int32_t c = i[3];
+        switch (i[0]) {
+            case R_ADD: R(a) = RK(b) + RK(c); pc += 4; break;
+            case R_ADDRESS: R(a) = frame(c) + b; pc += 4; break;
+            case R_AND: R(a) = RK(b) == 1 ? RK(c) : RK(b); pc += 4; break;
+            case R_CALL:
+                spendStep();
+                if (allocate(3)) {
+                    store[sp - 2] = frame(a);
+                    store[sp - 1] = bp;
+                    store[sp] = pc + 4;
+                    bp = sp - 2;
+                    pc = b;
+                }
+                break;
+            case R_COPY: memmove(&store[R(a)], &store[R(b)], c * sizeof(int32_t)); pc += 4; break;
+            case R_DIVIDE: R(a) = RK(b) / RK(c); pc += 4; break;
+            case R_ENDPROC:
+                sp = bp - 1;
+                pc = store[bp + 2];
+                bp = store[bp + 1];
+                break;
+            case R_ENDPROG: isRunning = false; break;
+            case R_EQUAL: R(a) = RK(b) == RK(c) ? 1 : 0; pc += 4; break;
+            case R_FI: error("If Statement Fails"); break;
+            case R_FILL: {
+                int32_t value = RK(b);
+                int32_t *element = &store[R(a)];
+                for (int k = 0; k < c; k++) {
+                    element[k] = value;
+                }
+                pc += 4;
+                break;
+            }
+            case R_FILLBITS: {
+                int32_t value = RK(b) ? -1 : 0;
+                int32_t *word = &store[R(a)];
+                for (int k = 0; k < c; k++) {
+                    word[k] = value;
+                }
+                pc += 4;
+                break;
+            }
+            case R_GETOUTER: R(a) = store[frame(c) + b]; pc += 4; break;
+            case R_GREATER: R(a) = RK(b) > RK(c) ? 1 : 0; pc += 4; break;
+            case R_INDEX: {
+                int index = RK(b);
+                if (index < 1 || index > c) {
+                    error("Range Error");
+                } else {
+                    R(a) += index - 1;
+                    pc += 4;
+                }
+                break;
+            }
+            case R_INDEXBIT: {
+                int index = RK(b);
+                if (index < 1 || index > c) {
+                    error("Range Error");
+                } else {
+                    R(a) = 32 * R(a) + index - 1;
+                    pc += 4;
+                }
+                break;
+            }
+            case R_JUMP:
+                if (a < pc) {
+                    spendStep();
+                }
+                pc = a;
+                break;
+            case R_JUMPEQUAL: pc = RK(b) == RK(c) ? back(a) : pc + 4; break;
+            case R_JUMPFALSE: pc = RK(b) != 1 ? a : pc + 4; break;
+            case R_JUMPGREATER: pc = RK(b) > RK(c) ? back(a) : pc + 4; break;
+            case R_JUMPLESS: pc = RK(b) < RK(c) ? back(a) : pc + 4; break;
+            case R_JUMPNONZERO: pc = RK(b) != 0 ? a : pc + 4; break;
+            case R_JUMPNOTEQUAL: pc = RK(b) != RK(c) ? a : pc + 4; break;
+            case R_JUMPNOTGREATER: pc = RK(b) > RK(c) ? pc + 4 : a; break;
+            case R_JUMPNOTLESS: pc = RK(b) < RK(c) ? pc + 4 : a; break;
+            case R_JUMPTRUE: pc = RK(b) == 1 ? back(a) : pc + 4; break;
+            case R_JUMPZERO: pc = RK(b) == 0 ? back(a) : pc + 4; break;
+            case R_LESS: R(a) = RK(b) < RK(c) ? 1 : 0; pc += 4; break;
+            case R_LOAD: R(a) = store[R(b)]; pc += 4; break;
+            case R_LOADBIT: R(a) = ((uint32_t)store[R(b) >> 5] >> (R(b) & 31)) & 1; pc += 4; break;
+            case R_MINUS: R(a) = -RK(b); pc += 4; break;
+            case R_MODULO: R(a) = RK(b) % RK(c); pc += 4; break;
+            case R_MOVE: R(a) = RK(b); pc += 4; break;
+            case R_MULTIPLY: R(a) = RK(b) * RK(c); pc += 4; break;
+            case R_NOT: R(a) = 1 - RK(b); pc += 4; break;
+            case R_OR: R(a) = RK(b) == 0 ? RK(c) : RK(b); pc += 4; break;
+            case R_PROC:
+                if (allocate(a)) {
+                    pc = b;
+                }
+                break;
+            case R_PROG:
+                bp = 0;
+                store[0] = 0;
+                store[1] = 0;
+                store[2] = 0;
+                sp = 2;
+                if (allocate(a)) {
+                    pc = b;
+                }
+                break;
+            case R_READ: readInteger(&store[R(a)]); pc += 4; break;
+            case R_READARRAY: readIntegers(&store[R(a)], c); pc += 4; break;
+            case R_SETOUTER: store[frame(c) + a] = RK(b); pc += 4; break;
+            case R_STORE: store[R(a)] = RK(b); pc += 4; break;
+            case R_STOREBIT: {
+                uint32_t *word = (uint32_t*)&store[R(a) >> 5];
+                uint32_t mask = 1u << (R(a) & 31);
+                *word = RK(b) ? *word | mask : *word & ~mask;
+                pc += 4;
+                break;
+            }
+            case R_SUBTRACT: R(a) = RK(b) - RK(c); pc += 4; break;
+            case R_WRITE: writeInteger(RK(b)); pc += 4; break;
+            default:
+                printf("Invalid instruction %d at %d\n", i[0], pc);
+                isRunning = false;
+                hasFailed = true;
+                break;
+        }
+    }
+    stopBudget();
+    return count;
+}
+
+/* Same as readCallStack, mapping the register code addresses back to the stack code */
+int readRegisterCallStack(int32_t *blocks, int max, int *at) {
+    if (!isRunning) {
+        return 0;
+    }
+    *at = program->origins[pc / 4];
+    int depth = 0;
+    int frame = bp;
+    while (frame > 0 && frame + 2 < MAX_STORE && depth < max - 1) {
+        int ret = store[frame + 2];
+        if (ret < 4 || ret > program->length) {
+            break;
+        }
+        blocks[depth++] = program->origins[words[ret - 2] / 4];
+        frame = store[frame + 1];
+    }
+    blocks[depth++] = 0;
+    return depth;
+}
+
+/* Returns false if the program stopped with a run time error */
+bool runRegisters() {
+    run(false);
+    return !hasFailed;
+}
+
+int64_t countRegisters() {
+    return run(true);
+}
@@ -0,0 +1,83 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "code.h"
+
+/* Instructions of the register machine. Every instruction takes four words: op, a, b, c.
+   a is the destination register or the jump target, b and c are the source operands. */
+typedef enum {
+    R_ADD = 1,
+    R_ADDRESS,
+    R_AND,
+    R_CALL,
+    R_COPY,
+    R_DIVIDE,
+    R_ENDPROC,
+    R_ENDPROG,
+    R_EQUAL,
+    R_FI,
+    R_FILL,
+    R_FILLBITS,
+    R_GETOUTER,
+    R_GREATER,
+    R_INDEX,
+    R_INDEXBIT,
+    R_JUMP,
+    R_JUMPEQUAL,
+    R_JUMPFALSE,
+    R_JUMPGREATER,
+    R_JUMPLESS,
+    R_JUMPNONZERO,
+    R_JUMPNOTEQUAL,
+    R_JUMPNOTGREATER,
+    R_JUMPNOTLESS,
+    R_JUMPTRUE,
+    R_JUMPZERO,
+    R_LESS,
+    R_LOAD,
+    R_LOADBIT,
+    R_MINUS,
+    R_MODULO,
+    R_MOVE,
+    R_MULTIPLY,
+    R_NOT,
+    R_OR,
+    R_PROC,
+    R_PROG,
+    R_READ,
+    R_READARRAY,
+    R_SETOUTER,
+    R_STORE,
+    R_STOREBIT,
+    R_SUBTRACT,
+    R_WRITE,
+    R_COUNT
+} RegOp;
+
+/* Register code translated from the code of the stack machine.
+   A register is a displacement in the frame of the running block: the variables of the block
+   followed by the temporaries of its expressions. A negative source operand -1-i denotes
+   constants[i]. origins holds the stack code address of every instruction for error lines. */
+typedef struct {
+    int32_t *words;
+    int length;
+    int capacity;
+    int32_t *constants;
+    int constantCount;
+    int constantCapacity;
+    int *origins;
+    const Code *code;
+} RegCode;
+
+void initRegCode(RegCode *regCode);
+void cleanRegCode(RegCode *regCode);
+bool translateCode(const Code *code, RegCode *regCode);
+bool loadRegisters(const RegCode *regCode);
+void resetRegisters();
+bool runRegisters();
+int64_t countRegisters();
+int readRegisterCallStack(int32_t *blocks, int max, int *at);
+
+#endif
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include "sampler.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/time.h>
+#define HAS_ITIMER
+#endif
+
+typedef struct {
+    int line;
+    int64_t count;
+} LineSamples;
+
+static Sampler *active;
+
+void initSampler(Sampler *sampler, const Code *code, StackReader read) {
+    sampler->code = code;
+    sampler->read = read;
+    sampler->rate = 0;
+    sampler->samples = 0;
+    sampler->dropped = 0;
+    sampler->pcCounts = calloc(code->length, sizeof(int64_t));
+    sampler->stacks = calloc(STACK_SLOTS, sizeof(StackCount));
+}
+
+void cleanSampler(Sampler *sampler) {
+    free(sampler->pcCounts);
+    free(sampler->stacks);
+}
+
+/* Counts the address and the call stack of one sample in the open addressed stack table */
+static void takeSample(Sampler *sampler) {
+    int32_t blocks[SAMPLE_DEPTH];
+    int at = 0;
+    int depth = sampler->read(blocks, SAMPLE_DEPTH, &at);
+    if (depth <= 0) {
+        return;
+    }
+    sampler->samples++;
+    if (at >= 0 && at < sampler->code->length) {
+        sampler->pcCounts[at]++;
+    }
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < depth; i++) {
+        hash = (hash ^ (uint32_t)blocks[i]) * 16777619u;
+    }
+    for (int probe = 0; probe < STACK_SLOTS; probe++) {
+        StackCount *slot = &sampler->stacks[(hash + probe) & (STACK_SLOTS - 1)];
+        if (slot->depth == 0) {
+            slot->hash = hash;
+            slot->depth = depth;
+            memcpy(slot->blocks, blocks, depth * sizeof(int32_t));
+            slot->count = 1;
+            return;
+        }
+        if (slot->hash == hash && slot->depth == depth
+                && !memcmp(slot->blocks, blocks, depth * sizeof(int32_t))) {
+            slot->count++;
+            return;
+        }
+    }
+    sampler->dropped++;
+}
+
+#ifdef HAS_ITIMER
+static void onProfileSignal(int signo) {
+    (void)signo;
+    if (active) {
+        takeSample(active);
+    }
+}
+#endif
+
+/* The timer counts processor time of the process, so a program waiting for input is not
+   sampled */
+bool startSampler(Sampler *sampler, int rate) {
+#ifdef HAS_ITIMER
+    if (rate < 1 || rate > 1000000) {
+        return false;
+    }
+    sampler->rate = rate;
+    active = sampler;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onProfileSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+    long interval = 1000000L / rate;
+    struct itimerval timer = {{interval / 1000000, interval % 1000000}, {interval / 1000000, interval % 1000000}};
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+#else
+    (void)sampler;
+    (void)rate;
+    return false;
+#endif
+}
+
+void stopSampler(Sampler *sampler) {
+#ifdef HAS_ITIMER
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_DFL);
+#endif
+    (void)sampler;
+    active = NULL;
+}
+
+static const char *blockName(const Code *code, int addr) {
+    int index = findProc(code, addr);
+    return index >= 0 ? code->procs[index].name : "?";
+}
+
+static int compareLineSamples(const void *a, const void *b) {
+    const LineSamples *x = a;
+    const LineSamples *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->line - y->line;
+}
+
+/* A procedure's own samples are those with it innermost, its total samples those with it
+   anywhere on the stack, counted once for recursive activations */
+void printSamples(const Sampler *sampler, FILE *f) {
+    const Code *code = sampler->code;
+    int64_t total = sampler->samples;
+    fprintf(f, "Samples: %lld at %d per second", (long long)total, sampler->rate);
+    if (sampler->dropped > 0) {
+        fprintf(f, ", %lld without room for their stack", (long long)sampler->dropped);
+    }
+    fprintf(f, "\n");
+    if (total == 0) {
+        return;
+    }
+    
+    int64_t *self = calloc(code->procCount + 1, sizeof(int64_t));
+    int64_t *inclusive = calloc(code->procCount + 1, sizeof(int64_t));
+    for (int s = 0; s < STACK_SLOTS; s++) {
+        const StackCount *slot = &sampler->stacks[s];
+        for (int i = 0; i < slot->depth; i++) {
+            int index = findProc(code, slot->blocks[i]);
+            bool isRepeated = false;
+            for (int k = 0; k < i; k++) {
+                isRepeated = isRepeated || slot->blocks[k] == slot->blocks[i];
+            }
+            if (index < 0 || isRepeated) {
+                continue;
+            }
+            inclusive[index] += slot->count;
+            if (i == 0) {
+                self[index] += slot->count;
+            }
+        }
+    }
+    fprintf(f, "\n%-16s %12s %7s %12s %7s\n", "procedure", "self", "share", "total", "share");
+    for (int i = 0; i < code->procCount; i++) {
+        if (inclusive[i] > 0) {
+            fprintf(f, "%-16s %12lld %6.2f%% %12lld %6.2f%%\n", code->procs[i].name,
+                (long long)self[i], 100.0 * self[i] / total,
+                (long long)inclusive[i], 100.0 * inclusive[i] / total);
+        }
+    }
+    free(self);
+    free(inclusive);
+    
+    int *lineOf = malloc((code->length + 1) * sizeof(int));
+    expandLines(code, lineOf);
+    int maxLine = 0;
+    for (int pc = 0; pc < code->length; pc++) {
+        if (lineOf[pc] > maxLine) {
+            maxLine = lineOf[pc];
+        }
+    }
+    LineSamples *lines = calloc(maxLine + 1, sizeof(LineSamples));
+    for (int i = 0; i <= maxLine; i++) {
+        lines[i].line = i;
+    }
+    for (int pc = 0; pc < code->length; pc++) {
+        if (sampler->pcCounts[pc] > 0 && lineOf[pc] >= 0) {
+            lines[lineOf[pc]].count += sampler->pcCounts[pc];
+        }
+    }
+    free(lineOf);
+    qsort(lines, maxLine + 1, sizeof(LineSamples), compareLineSamples);
+    fprintf(f, "\n%-6s %12s %7s\n", "line", "samples", "share");
+    for (int i = 0; i <= maxLine && lines[i].count > 0; i++) {
+        fprintf(f, "%-6d %12lld %6.2f%%\n", lines[i].line, (long long)lines[i].count,
+            100.0 * lines[i].count / total);
+    }
+    free(lines);
+}
+
+/* One line per call stack, outermost block first: "program;A;B count" */
+void writeFolded(const Sampler *sampler, FILE *f) {
+    for (int s = 0; s < STACK_SLOTS; s++) {
+        const StackCount *slot = &sampler->stacks[s];
+        for (int i = slot->depth - 1; i >= 0; i--) {
+            fprintf(f, "%s%c", blockName(sampler->code, slot->blocks[i]), i > 0 ? ';' : ' ');
+        }
+        if (slot->depth > 0) {
+            fprintf(f, "%lld\n", (long long)slot->count);
+        }
+    }
+}
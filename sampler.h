@@ -0,0 +1,43 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "code.h"
+
+#define SAMPLE_DEPTH 32 // Blocks kept of a sampled call stack
+#define STACK_SLOTS 4096 // Distinct call stacks counted
+
+/* Reads the call stack of the running machine from a signal handler: the entry addresses of
+   the active blocks, innermost first, and the current code address. Returns the depth, 0 when
+   no program is running. */
+typedef int (*StackReader)(int32_t *blocks, int max, int *at);
+
+typedef struct {
+    uint32_t hash;
+    int depth;
+    int64_t count;
+    int32_t blocks[SAMPLE_DEPTH];
+} StackCount;
+
+/* Samples taken by a profiling timer. Everything the signal handler touches is allocated
+   before the timer starts. */
+typedef struct Sampler {
+    const Code *code;
+    StackReader read;
+    int rate;
+    int64_t samples;
+    int64_t dropped;
+    int64_t *pcCounts;
+    StackCount *stacks;
+} Sampler;
+
+void initSampler(Sampler *sampler, const Code *code, StackReader read);
+void cleanSampler(Sampler *sampler);
+bool startSampler(Sampler *sampler, int rate);
+void stopSampler(Sampler *sampler);
+void printSamples(const Sampler *sampler, FILE *f);
+void writeFolded(const Sampler *sampler, FILE *f);
+
+#endif
@@ -1,277 +1,306 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "memory.h"
 #include "scanner.h"
 
-#define NAME_LEN 10
 #define STORE_LEN 4096
+#define KEYWORD_SLOTS 32
 
 typedef struct Name_ {
-    const char* spelling;
+    int spelling;
+    int length;
     int index;
-    bool isReserved;
     struct Name_ *next;
 } Name;
 
 typedef struct {
-    char *start;
-    int capacity;
-    int loaded;
-} SpellingStore;
+    const char *spelling;
+    int length;
+    SymbolType type;
+} Keyword;
 
-Name *nameTable;
-bool lexError;
-
-static char *source;
-static char ch;
-static int lineNumber;
-static int nameCount;
-static SpellingStore spelStore;
+/* Perfect hash of the keywords on their length and first two characters, see keywordSlot */
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    [0] = {"proc", 4, T_PROC}, [1] = {"Boolean", 7, T_BOOLEAN}, [3] = {"const", 5, T_CONST},
+    [4] = {"do", 2, T_DO}, [5] = {"array", 5, T_ARRAY}, [10] = {"skip", 4, T_SKIP},
+    [11] = {"false", 5, T_FALSE}, [15] = {"Integer", 7, T_INTEGER}, [16] = {"true", 4, T_TRUE},
+    [17] = {"par", 3, T_PAR}, [18] = {"read", 4, T_READ}, [19] = {"begin", 5, T_BEGIN},
+    [22] = {"od", 2, T_OD}, [24] = {"fi", 2, T_FI}, [25] = {"rap", 3, T_RAP}, [26] = {"if", 2, T_IF},
+    [27] = {"end", 3, T_END}, [29] = {"write", 5, T_WRITE}, [30] = {"call", 4, T_CALL}
+};
 
 static const char* symNames[T_COUNT] = {
     "begin", "end", "const", "skip", "array", "proc", "read", "write", "call", "if",
-    "fi", "do", "od", "[", "]", "=", "<", ">", "[]", "->", ":=", "&", "|", ";", "-",
+    "fi", "do", "od", "par", "rap", "[", "]", "=", "<", ">", "[]", "->", ":=", "&", "|", ";", "-",
     "+", "*", "/", "\\", "(", ")", "~", ",", ".", "false", "true", "Integer",
     "Boolean", "number", "identifier", "end of file"
 };
 
-static void initSpellingStore(int capacity) {
-    spelStore.start = malloc(capacity);
-    spelStore.capacity = capacity;
-    spelStore.loaded = 0;
+static void initSpellingStore(SpellingStore *store, int capacity) {
+    store->start = memAlloc(MEM_SCANNER, capacity);
+    store->capacity = capacity;
+    store->loaded = 0;
 }
 
-static void cleanSpellingStore() {
-    free(spelStore.start);
-    spelStore.capacity = 0;
-    spelStore.loaded = 0;
+static void cleanSpellingStore(SpellingStore *store) {
+    memFree(store->start);
+    store->capacity = 0;
+    store->loaded = 0;
 }
 
-static char *saveSpelling(const char *str) {
-    int strLen = strlen(str) + 1;
-    if (spelStore.loaded + strLen >= spelStore.capacity) {
-        //TODO: Expand memory
+/* Returns the offset of the saved spelling, which stays valid when the store grows */
+static int saveSpelling(SpellingStore *store, const char *str, int length) {
+    int strLen = length + 1;
+    if (store->loaded + strLen > store->capacity) {
+        while (store->loaded + strLen > store->capacity) {
+            store->capacity *= 2;
+        }
+        store->start = memRealloc(MEM_SCANNER, store->start, store->capacity);
     }
-    char *strStart = &spelStore.start[spelStore.loaded];
-    strcpy(strStart, str);
-    spelStore.loaded += strLen;
-    return strStart;
+    int offset = store->loaded;
+    memcpy(&store->start[offset], str, length);
+    store->start[offset + length] = '\0';
+    store->loaded += strLen;
+    return offset;
 }
 
-static Name *reserveName(const char *str, int index, bool isReserved) {
-    Name *newName = malloc(sizeof(Name));
-    newName->spelling = saveSpelling(str);
+static Name *insertName(Scanner *scanner, const char *str, int length, int index) {
+    Name *newName = memAlloc(MEM_SCANNER, sizeof(Name));
+    newName->spelling = saveSpelling(&scanner->spelStore, str, length);
+    newName->length = length;
     newName->index = index;
-    newName->isReserved = isReserved;
-    newName->next = nameTable;
-    nameTable = newName;
-    return nameTable;
+    newName->next = scanner->nameTable;
+    scanner->nameTable = newName;
+    if (index >= scanner->nameCapacity) {
+        scanner->nameCapacity = scanner->nameCapacity ? 2 * scanner->nameCapacity : 256;
+        scanner->nameSpellings = memRealloc(MEM_SCANNER, scanner->nameSpellings, scanner->nameCapacity * sizeof(int));
+    }
+    scanner->nameSpellings[index] = newName->spelling;
+    return scanner->nameTable;
 }
 
-static Symbol getSymbol(char *str, int strLen) {
-    if (strLen > NAME_LEN) {
-        strLen = NAME_LEN;
+/* Every keyword has two to seven characters and a slot of its own */
+static int keywordSlot(const char *str, int length) {
+    if (length < 2 || length > 7) {
+        return -1;
+    }
+    int slot = (length + 4 * (unsigned char)str[0] + 14 * (unsigned char)str[1]) & (KEYWORD_SLOTS - 1);
+    const Keyword *keyword = &keywords[slot];
+    if (keyword->length != length || memcmp(keyword->spelling, str, length)) {
+        return -1;
+    }
+    return slot;
+}
+
+/* str is the name in the source, of any length and not terminated */
+static Symbol getSymbol(Scanner *scanner, const char *str, int strLen) {
+    int slot = keywordSlot(str, strLen);
+    if (slot >= 0) {
+        return (Symbol){.type = keywords[slot].type};
+    } else if (scanner->skipNames) {
+        return (Symbol){.type = T_NAME, .arg = -1};
     }
-    str[strLen] = '\0';
     
-    Name *node = nameTable;
-    bool found = false;
+    Name *node = scanner->nameTable;
     while (node) {
-        if (!strcmp(node->spelling, str)) {
-            found = true;
+        if (node->length == strLen && !memcmp(&scanner->spelStore.start[node->spelling], str, strLen)) {
             break;
-        } else {
-            node = node->next;
         }
+        node = node->next;
     }
-    
-    if (!found) {
-        node = reserveName(str, nameCount, false);
-        nameCount++;
-    }
-    if (node->isReserved) {
-        return (Symbol){.type = node->index};
-    } else {
-        return (Symbol){.type = T_NAME, .arg = node->index};
+    if (!node) {
+        node = insertName(scanner, str, strLen, scanner->nameCount);
+        scanner->nameCount++;
     }
+    return (Symbol){.type = T_NAME, .arg = node->index};
 }
 
-static void cleanNames() {
-    Name *node = nameTable;
+static void cleanNames(Scanner *scanner) {
+    Name *node = scanner->nameTable;
     while (node) {
         Name *next = node->next;
-        free(node);
+        memFree(node);
         node = next;
     }
+    scanner->nameTable = NULL;
+    memFree(scanner->nameSpellings);
+    scanner->nameSpellings = NULL;
+    scanner->nameCapacity = 0;
 }
 
-static void advance() {
-    if (*source != '\0') {
-        source++;
-        ch = *source;
+static void advance(Scanner *scanner) {
+    if (*scanner->source != '\0') {
+        scanner->source++;
+        scanner->ch = *scanner->source;
     }
-    if (ch == '\n') {
-        lineNumber++;
+    if (scanner->ch == '\n') {
+        scanner->lineNumber++;
     }
 }
 
-static bool isEOF() {
-    return ch == '\0';
+static bool isEOF(Scanner *scanner) {
+    return scanner->ch == '\0';
 }
 
-static bool isAlpha() {
+static bool isAlpha(char ch) {
     return (ch == '_' || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'));
 }
 
-static bool isDigit() {
+static bool isDigit(char ch) {
     return (ch >= '0' && ch <= '9');
 }
 
-static void skipBlanks() {
-    while (!isEOF() && (ch <= 0x20 || ch == '$')) {
-        if (ch == '$') {
-            while (!isEOF() && ch != '\n') {
-                advance();
+static void skipBlanks(Scanner *scanner) {
+    while (!isEOF(scanner) && (scanner->ch <= 0x20 || scanner->ch == '$')) {
+        if (scanner->ch == '$') {
+            while (!isEOF(scanner) && scanner->ch != '\n') {
+                advance(scanner);
             }
         }
-        advance();
+        advance(scanner);
     }
 }
 
-void initScan(char *str) {
-    lexError = false;
-    source = str;
-    ch = *source;
-    lineNumber = 1;
-    nameTable = NULL;
-    nameCount = 0;
-    initSpellingStore(STORE_LEN);
-    reserveName("begin", T_BEGIN, true);
-    reserveName("end", T_END, true);
-    reserveName("const", T_CONST, true);
-    reserveName("skip", T_SKIP, true);
-    reserveName("array", T_ARRAY, true);
-    reserveName("proc", T_PROC, true);
-    reserveName("read", T_READ, true);
-    reserveName("write", T_WRITE, true);
-    reserveName("call", T_CALL, true);
-    reserveName("if", T_IF, true);
-    reserveName("fi", T_FI, true);
-    reserveName("do", T_DO, true);
-    reserveName("od", T_OD, true);
-    reserveName("false", T_FALSE, true);
-    reserveName("true", T_TRUE, true);
-    reserveName("Integer", T_INTEGER, true);
-    reserveName("Boolean", T_BOOLEAN, true);
+void initScan(Scanner *scanner, char *str, FILE *log) {
+    scanner->lexError = false;
+    scanner->skipNames = false;
+    scanner->log = log;
+    scanner->source = str;
+    scanner->ch = *str;
+    scanner->lineNumber = 1;
+    scanner->symLine = 1;
+    scanner->nameTable = NULL;
+    scanner->nameSpellings = NULL;
+    scanner->nameCapacity = 0;
+    scanner->nameCount = 0;
+    initSpellingStore(&scanner->spelStore, STORE_LEN);
 }
 
-void cleanScan() {
-    cleanNames();
-    cleanSpellingStore();
+void cleanScan(Scanner *scanner) {
+    cleanNames(scanner);
+    cleanSpellingStore(&scanner->spelStore);
 }
 
-Symbol scanNext() {
+Symbol scanNext(Scanner *scanner) {
     while (true) {
-        skipBlanks();
-        switch (ch) {
+        skipBlanks(scanner);
+        scanner->symLine = scanner->lineNumber;
+        switch (scanner->ch) {
             case '[':
-                advance();
-                if (ch == ']') {
-                    advance();
+                advance(scanner);
+                if (scanner->ch == ']') {
+                    advance(scanner);
                     return (Symbol){.type=T_GUARD};
                 } else {
                     return (Symbol){.type=T_LSQUAR};
                 }
-            case ']': advance(); return (Symbol){.type=T_RSQUAR};
-            case '=': advance(); return (Symbol){.type=T_EQ};
-            case '<': advance(); return (Symbol){.type=T_LES};
-            case '>': advance(); return (Symbol){.type=T_GRE};
+            case ']': advance(scanner); return (Symbol){.type=T_RSQUAR};
+            case '=': advance(scanner); return (Symbol){.type=T_EQ};
+            case '<': advance(scanner); return (Symbol){.type=T_LES};
+            case '>': advance(scanner); return (Symbol){.type=T_GRE};
             case '-':
-                advance();
-                if (ch == '>') {
-                    advance();
+                advance(scanner);
+                if (scanner->ch == '>') {
+                    advance(scanner);
                     return (Symbol){.type=T_ARROW};
                 } else {
                     return (Symbol){.type=T_MINUS};
                 }
             case ':':
-                advance();
-                if (ch == '=') {
-                    advance();
+                advance(scanner);
+                if (scanner->ch == '=') {
+                    advance(scanner);
                     return (Symbol){.type=T_ASSIGN};
                 } else {
-                    lexError = true;
-                    printf("Unrecognized symbol '%c'. Did you mean ':='? (%d)\n", ch, lineNumber);
+                    scanner->lexError = true;
+                    fprintf(scanner->log, "Unrecognized symbol '%c'. Did you mean ':='? (%d)\n",
+                        scanner->ch, scanner->lineNumber);
                     break;
                 }
-            case '&': advance(); return (Symbol){.type=T_AND};
-            case '|': advance(); return (Symbol){.type=T_OR};
-            case ';': advance(); return (Symbol){.type=T_SEMI};
-            case '+': advance(); return (Symbol){.type=T_PLUS};
-            case '*': advance(); return (Symbol){.type=T_MULT};
-            case '/': advance(); return (Symbol){.type=T_DIV};
-            case '\\': advance(); return (Symbol){.type=T_MOD};
-            case '(': advance(); return (Symbol){.type=T_LPAREN};
-            case ')': advance(); return (Symbol){.type=T_RPAREN};
-            case '~': advance(); return (Symbol){.type=T_NOT};
-            case ',': advance(); return (Symbol){.type=T_COMMA};
-            case '.': advance(); return (Symbol){.type=T_POINT};
-            case '\0': advance(); return (Symbol){.type=T_EOF};
+            case '&': advance(scanner); return (Symbol){.type=T_AND};
+            case '|': advance(scanner); return (Symbol){.type=T_OR};
+            case ';': advance(scanner); return (Symbol){.type=T_SEMI};
+            case '+': advance(scanner); return (Symbol){.type=T_PLUS};
+            case '*': advance(scanner); return (Symbol){.type=T_MULT};
+            case '/': advance(scanner); return (Symbol){.type=T_DIV};
+            case '\\': advance(scanner); return (Symbol){.type=T_MOD};
+            case '(': advance(scanner); return (Symbol){.type=T_LPAREN};
+            case ')': advance(scanner); return (Symbol){.type=T_RPAREN};
+            case '~': advance(scanner); return (Symbol){.type=T_NOT};
+            case ',': advance(scanner); return (Symbol){.type=T_COMMA};
+            case '.': advance(scanner); return (Symbol){.type=T_POINT};
+            case '\0': advance(scanner); return (Symbol){.type=T_EOF};
             default:
-                if (isDigit()) {
+                if (isDigit(scanner->ch)) {
                     char numberStr[11];
                     int numberLen = 0;
-                    while (isDigit()) {
+                    while (isDigit(scanner->ch)) {
                         if (numberLen < 10) {
-                            numberStr[numberLen] = ch;
+                            numberStr[numberLen] = scanner->ch;
                         }
                         numberLen++;
-                        advance();
+                        advance(scanner);
                     }
                     int value = 0;
                     if (numberLen >= 10) {
                         //TODO: Improve checking
-                        printf("%d: Number too big!\n", lineNumber);
+                        fprintf(scanner->log, "%d: Number too big!\n", scanner->lineNumber);
                     } else {
                         numberStr[numberLen] = '\0';
                         value = atoi(numberStr);
                     }
                     return (Symbol){.type=T_NUM, .arg=value};
-                } else if (isAlpha()) {
-                    char nameStr[NAME_LEN+1];
+                } else if (isAlpha(scanner->ch)) {
+                    const char *nameStr = scanner->source;
                     int nameLen = 0;
-                    while (isAlpha() || isDigit()) {
-                        if (nameLen < NAME_LEN) { 
-                            nameStr[nameLen] = ch;
-                        }
+                    while (isAlpha(scanner->ch) || isDigit(scanner->ch)) {
                         nameLen++;
-                        advance();
+                        advance(scanner);
                     }
-                    return getSymbol(nameStr, nameLen);
+                    return getSymbol(scanner, nameStr, nameLen);
                 } else {
-                    lexError = true;
-                    printf("Unrecognized symbol '%d'.(%d)\n", ch, lineNumber);
-                    advance();
+                    scanner->lexError = true;
+                    fprintf(scanner->log, "Unrecognized symbol '%d'.(%d)\n",
+                        scanner->ch, scanner->lineNumber);
+                    advance(scanner);
                     break;
                 }
         }
     }
 }
 
-int getLine() {
-    return lineNumber;
+int getLine(Scanner *scanner) {
+    return scanner->lineNumber;
 }
 
 const char *getSymName(SymbolType type) {
     return symNames[type-1];
 }
 
-const char *getNameSpel(int name) {
-    Name *node = nameTable;
+const char *getNameSpel(Scanner *scanner, int name) {
+    if (name < 0 || name >= scanner->nameCount) {
+        return NULL;
+    }
+    return &scanner->spelStore.start[scanner->nameSpellings[name]];
+}
+
+/* Returns the index of a name already scanned, -1 for a name not seen yet */
+int lookupName(Scanner *scanner, const char *spelling) {
+    int length = strlen(spelling);
+    Name *node = scanner->nameTable;
     while (node) {
-        if (!node->isReserved && node->index == name) {
-            return node->spelling;
+        if (node->length == length && !memcmp(&scanner->spelStore.start[node->spelling], spelling, length)) {
+            return node->index;
         }
         node = node->next;
     }
-    return NULL;
+    return -1;
+}
+
+/* Moves over source text known to need no scanning, counting its lines */
+void skipText(Scanner *scanner, int length) {
+    while (length-- > 0 && !isEOF(scanner)) {
+        advance(scanner);
+    }
 }
@@ -2,6 +2,7 @@
 #define LEXER_H
 
 #include <stdbool.h>
+#include <stdio.h>
 
 typedef enum {
     T_BEGIN=1, // 'begin'
@@ -17,6 +18,8 @@ typedef enum {
     T_FI,      // 'fi'
     T_DO,      // 'do'
     T_OD,      // 'od'
+    T_PAR,     // 'par'
+    T_RAP,     // 'rap'
     T_LSQUAR,  // '['
     T_RSQUAR,  // ']'
     T_EQ,      // '='
@@ -53,13 +56,37 @@ typedef struct {
     int arg;
 } Symbol;
 
-extern bool lexError;
+typedef struct {
+    char *start;
+    int capacity;
+    int loaded;
+} SpellingStore;
+
+/* Scanner state of one compilation. Diagnostics go to log.
+   With skipNames set, names are not entered and all have the argument -1, for scans that
+   only look for keywords. */
+typedef struct {
+    char *source;
+    char ch;
+    int lineNumber;
+    int symLine;
+    int nameCount;
+    struct Name_ *nameTable;
+    int *nameSpellings;
+    int nameCapacity;
+    SpellingStore spelStore;
+    bool lexError;
+    bool skipNames;
+    FILE *log;
+} Scanner;
 
-void initScan(char *str);
-void cleanScan();
-Symbol scanNext();
-int getLine();
+void initScan(Scanner *scanner, char *str, FILE *log);
+void cleanScan(Scanner *scanner);
+Symbol scanNext(Scanner *scanner);
+int getLine(Scanner *scanner);
 const char *getSymName(SymbolType type);
-const char *getNameSpel(int name);
+const char *getNameSpel(Scanner *scanner, int name);
+int lookupName(Scanner *scanner, const char *spelling);
+void skipText(Scanner *scanner, int length);
 
 #endif
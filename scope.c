@@ -1,21 +1,13 @@
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include "memory.h"
 #include "scope.h"
 #include "scanner.h"
 
-#define MAX_LEVEL 10
-
-typedef struct {
-    ObjectRecord *prev;
-} BlockRecord;
-
-bool analysisError;
-
-static BlockRecord blockTable[MAX_LEVEL];
-static int blockLevel;
-
-static ObjectRecord *nameExists(int name, int level) {
-    ObjectRecord *obj = blockTable[level].prev;
+static ObjectRecord *nameExists(Scope *scope, int name, int level) {
+    ObjectRecord *obj = scope->blockTable[level].prev;
     while (obj) {
         if (obj->name == name) {
             break;
@@ -25,59 +17,364 @@ static ObjectRecord *nameExists(int name, int level) {
     return obj;
 }
 
-ObjectRecord *defineName(int name, int kind) {
-    if (name != NO_NAME && nameExists(name, blockLevel)) {
-        printf("%d: Ambiguous definition '%s'!\n", getLine(), getNameSpel(name));
-        analysisError = true;
+static void cleanBlock(BlockRecord *block) {
+    ObjectRecord *obj = block->prev;
+    while (obj) {
+        ObjectRecord *prev = obj->prev;
+        if (obj->kind == OBJ_PROC) {
+            memFree(obj->as.proc.accesses);
+        }
+        memFree(obj);
+        obj = prev;
+    }
+    block->prev = NULL;
+}
+
+void initScope(Scope *scope, Scanner *scanner) {
+    scope->blockLevel = 0;
+    scope->maxLevel = 0;
+    scope->overflowLevels = 0;
+    scope->blockTable[0].prev = NULL;
+    scope->blockTable[0].varLength = 0;
+    scope->blockTable[0].proc = NULL;
+    scope->blockTable[0].accessStart = 0;
+    scope->analysisError = false;
+    scope->scanner = scanner;
+    scope->accesses = NULL;
+    scope->accessCount = 0;
+    scope->accessCapacity = 0;
+    scope->input = (ObjectRecord){.name = NO_NAME, .kind = OBJ_UNDEFINED};
+    scope->output = (ObjectRecord){.name = NO_NAME, .kind = OBJ_UNDEFINED};
+    scope->recordCount = 0;
+}
+
+void cleanScope(Scope *scope) {
+    memFree(scope->accesses);
+    scope->accesses = NULL;
+    scope->accessCount = 0;
+    scope->accessCapacity = 0;
+}
+
+ObjectRecord *defineName(Scope *scope, int name, int kind) {
+    if (name != NO_NAME && nameExists(scope, name, scope->blockLevel)) {
+        fprintf(scope->scanner->log, "%d: Ambiguous definition '%s'!\n",
+            getLine(scope->scanner), getNameSpel(scope->scanner, name));
+        scope->analysisError = true;
     }
-    ObjectRecord *rec = malloc(sizeof(ObjectRecord));
+    ObjectRecord *rec = memAlloc(MEM_SCOPE, sizeof(ObjectRecord));
+    scope->recordCount++;
     rec->name = name;
+    rec->hash = 0;
     rec->kind = kind;
-    rec->prev = blockTable[blockLevel].prev;
-    blockTable[blockLevel].prev = rec;
+    rec->prev = scope->blockTable[scope->blockLevel].prev;
+    scope->blockTable[scope->blockLevel].prev = rec;
     return rec;
 }
 
-ObjectRecord *findName(int name) {
-    int lvl = blockLevel;
+ObjectRecord *findName(Scope *scope, int name) {
+    int lvl = scope->blockLevel;
     while (lvl >= 0) {
-        ObjectRecord *obj = nameExists(name, lvl);
+        ObjectRecord *obj = nameExists(scope, name, lvl);
         if (obj) {
             return obj;
         } else {
             lvl--;
         }
     }
-    printf("%d: Undefined name '%s'!\n", getLine(), getNameSpel(name));
-    analysisError = true;
-    return defineName(name, OBJ_UNDEFINED);
+    fprintf(scope->scanner->log, "%d: Undefined name '%s'!\n",
+        getLine(scope->scanner), getNameSpel(scope->scanner, name));
+    scope->analysisError = true;
+    return defineName(scope, name, OBJ_UNDEFINED);
+}
+
+/* Returns the record of a name defined in the block at level, NULL without a diagnostic if
+   there is none */
+ObjectRecord *findNameAt(Scope *scope, int name, int level) {
+    if (level < 0 || level > scope->blockLevel) {
+        return NULL;
+    }
+    return nameExists(scope, name, level);
+}
+
+/* FNV-1a over bytes */
+uint64_t hashWords(uint64_t hash, const void *data, int length) {
+    const unsigned char *bytes = data;
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+/* Everything about a record that code compiled in its scope may depend on, except the code of
+   procedures, which the incremental compiler checks itself */
+static uint64_t hashRecord(Scope *scope, ObjectRecord *obj) {
+    uint64_t hash = obj->prev ? obj->prev->hash : 0xCBF29CE484222325ULL;
+    const char *spelling = getNameSpel(scope->scanner, obj->name);
+    if (spelling) {
+        hash = hashWords(hash, spelling, strlen(spelling) + 1);
+    }
+    int32_t fields[5] = {obj->kind};
+    if (obj->kind == OBJ_CONST) {
+        fields[1] = obj->as.constant.type;
+        fields[2] = obj->as.constant.value;
+    } else if (obj->kind == OBJ_VAR) {
+        fields[1] = obj->as.var.type;
+        fields[2] = obj->as.var.level;
+        fields[3] = obj->as.var.displ;
+    } else if (obj->kind == OBJ_ARR) {
+        fields[1] = obj->as.arr.type;
+        fields[2] = obj->as.arr.level;
+        fields[3] = obj->as.arr.displ;
+        fields[4] = obj->as.arr.count;
+    } else if (obj->kind == OBJ_PROC) {
+        fields[1] = obj->as.proc.level;
+    }
+    hash = hashWords(hash, fields, sizeof(fields));
+    return hash ? hash : 1;
+}
+
+/* Hash of all names visible in the current block. Records are complete once the next name is
+   defined, so the hash of every record but the last of a block is kept. */
+uint64_t scopeHash(Scope *scope) {
+    uint64_t hash = hashWords(0xCBF29CE484222325ULL, &scope->blockLevel, sizeof(int));
+    for (int level = 0; level <= scope->blockLevel; level++) {
+        ObjectRecord *head = scope->blockTable[level].prev;
+        if (!head) {
+            continue;
+        }
+        int pending = 0;
+        ObjectRecord *obj = head;
+        while (obj && obj->hash == 0) {
+            pending++;
+            obj = obj->prev;
+        }
+        ObjectRecord **chain = memAlloc(MEM_SCOPE, pending * sizeof(ObjectRecord*));
+        obj = head;
+        for (int i = pending - 1; i >= 0; i--) {
+            chain[i] = obj;
+            obj = obj->prev;
+        }
+        for (int i = 0; i < pending; i++) {
+            chain[i]->hash = hashRecord(scope, chain[i]);
+        }
+        memFree(chain);
+        uint64_t levelHash = head->hash;
+        head->hash = 0;
+        hash = hashWords(hash, &levelHash, sizeof(levelHash));
+    }
+    return hash;
+}
+
+/* Reserves words in the frame of the current block and returns their displacement.
+   The first three words of a frame hold the static link, dynamic link and return address. */
+int allocateVariable(Scope *scope, int words) {
+    BlockRecord *block = &scope->blockTable[scope->blockLevel];
+    int displ = 3 + block->varLength;
+    block->varLength += words;
+    return displ;
+}
+
+void startBlock(Scope *scope, ObjectRecord *proc) {
+    if (scope->blockLevel+1 >= MAX_LEVEL) {
+        fprintf(scope->scanner->log, "%d: Nesting level is too big!\n", getLine(scope->scanner));
+        scope->analysisError = true;
+        scope->overflowLevels++;
+    } else {
+        scope->blockLevel++;
+        if (scope->blockLevel > scope->maxLevel) {
+            scope->maxLevel = scope->blockLevel;
+        }
+        scope->blockTable[scope->blockLevel].prev = NULL;
+        scope->blockTable[scope->blockLevel].varLength = 0;
+        scope->blockTable[scope->blockLevel].proc = proc;
+        scope->blockTable[scope->blockLevel].accessStart = scope->accessCount;
+    }
 }
 
-void startBlock() {
-    if (blockLevel+1 >= MAX_LEVEL) {
-        printf("%d: Nesting level is too big!\n", getLine());
-        analysisError = true;
+/* The accesses of a procedure are known once its block is finished */
+void finishBlock(Scope *scope) {
+    if (scope->overflowLevels > 0) {
+        scope->overflowLevels--;
+        return;
+    }
+    BlockRecord *block = &scope->blockTable[scope->blockLevel];
+    if (block->proc) {
+        keepAccesses(scope, block->proc, block->accessStart);
     } else {
-        blockLevel++;
-        blockTable[blockLevel].prev = NULL;
+        scope->accessCount = block->accessStart;
     }
+    cleanBlock(block);
+    scope->blockLevel--;
 }
 
-void finishBlock() {
-    blockLevel--;
+/* Level of the block defining a variable, array or procedure, -1 for the input and output */
+int levelOf(const ObjectRecord *obj) {
+    if (obj->kind == OBJ_VAR) {
+        return obj->as.var.level;
+    } else if (obj->kind == OBJ_ARR) {
+        return obj->as.arr.level;
+    } else if (obj->kind == OBJ_PROC) {
+        return obj->as.proc.level;
+    }
+    return -1;
 }
 
-void kindError(ObjectRecord *obj) {
+/* Objects visible at once differ in level or name, except the input and output */
+static int compareObjects(const ObjectRecord *a, const ObjectRecord *b) {
+    if (levelOf(a) != levelOf(b)) {
+        return levelOf(a) < levelOf(b) ? -1 : 1;
+    } else if (a->name != b->name) {
+        return a->name < b->name ? -1 : 1;
+    }
+    return a < b ? -1 : a > b;
+}
+
+static int compareAccesses(const void *a, const void *b) {
+    const Access *x = a;
+    const Access *y = b;
+    int order = compareObjects(x->obj, y->obj);
+    if (order != 0) {
+        return order;
+    } else if (x->kind != y->kind) {
+        return x->kind < y->kind ? -1 : 1;
+    }
+    return x->via < y->via ? -1 : x->via > y->via;
+}
+
+void noteAccess(Scope *scope, ObjectRecord *obj, AccessKind kind, int via) {
+    if (scope->accessCount >= scope->accessCapacity) {
+        scope->accessCapacity = scope->accessCapacity ? 2 * scope->accessCapacity : 256;
+        scope->accesses = memRealloc(MEM_SCOPE, scope->accesses, scope->accessCapacity * sizeof(Access));
+    }
+    scope->accesses[scope->accessCount++] = (Access){obj, kind, via};
+}
+
+/* A call does what the statements of the procedure do outside it */
+void noteCall(Scope *scope, ObjectRecord *proc) {
+    if (!proc->as.proc.isKnown) {
+        noteAccess(scope, proc, ACCESS_CALL, proc->as.proc.addr);
+        return;
+    }
+    for (int i = 0; i < proc->as.proc.accessCount; i++) {
+        const Access *access = &proc->as.proc.accesses[i];
+        noteAccess(scope, access->obj, access->kind, access->via >= 0 ? access->via : proc->as.proc.addr);
+    }
+}
+
+/* Keeps the accesses logged from start on that reach outside the block of proc, once each, as
+   the accesses of proc and drops them from the log. Calls of proc itself add nothing. */
+void keepAccesses(Scope *scope, ObjectRecord *proc, int start) {
+    int level = proc->as.proc.level;
+    Access *kept = memAlloc(MEM_SCOPE, (scope->accessCount - start + 1) * sizeof(Access));
+    int count = 0;
+    for (int i = start; i < scope->accessCount; i++) {
+        const Access *access = &scope->accesses[i];
+        if (levelOf(access->obj) <= level && access->obj != proc) {
+            kept[count++] = *access;
+        }
+    }
+    qsort(kept, count, sizeof(Access), compareAccesses);
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        if (unique == 0 || compareAccesses(&kept[unique - 1], &kept[i]) != 0) {
+            kept[unique++] = kept[i];
+        }
+    }
+    memFree(proc->as.proc.accesses);
+    proc->as.proc.accesses = memRealloc(MEM_SCOPE, kept, (unique + 1) * sizeof(Access));
+    proc->as.proc.accessCount = unique;
+    proc->as.proc.isKnown = true;
+    scope->accessCount = start;
+}
+
+typedef struct {
+    const Access *access;
+    int branch;
+} BranchAccess;
+
+static int compareBranchAccesses(const void *a, const void *b) {
+    const BranchAccess *x = a;
+    const BranchAccess *y = b;
+    int order = compareObjects(x->access->obj, y->access->obj);
+    if (order != 0) {
+        return order;
+    }
+    return x->branch < y->branch ? -1 : x->branch > y->branch;
+}
+
+static void branchError(Scope *scope, const ObjectRecord *obj) {
+    int line = getLine(scope->scanner);
+    if (obj == &scope->input) {
+        fprintf(scope->scanner->log, "%d: Parallel branches share the input!\n", line);
+    } else if (obj == &scope->output) {
+        fprintf(scope->scanner->log, "%d: Parallel branches share the output!\n", line);
+    } else if (obj->kind == OBJ_PROC) {
+        fprintf(scope->scanner->log, "%d: Parallel branch calls unfinished procedure '%s'!\n", line,
+            getNameSpel(scope->scanner, obj->name));
+    } else {
+        fprintf(scope->scanner->log, "%d: Parallel branches share variable '%s'!\n", line,
+            getNameSpel(scope->scanner, obj->name));
+    }
+    scope->analysisError = true;
+}
+
+/* The branches of a par statement logged their accesses from starts on. No object one of them
+   writes may be used by another, and every procedure they call must be known. */
+void checkBranches(Scope *scope, const int *starts, int count) {
+    if (count < 2) {
+        return;
+    }
+    BranchAccess *list = memAlloc(MEM_SCOPE, (scope->accessCount - starts[0] + 1) * sizeof(BranchAccess));
+    int length = 0;
+    for (int branch = 0; branch < count; branch++) {
+        int end = branch + 1 < count ? starts[branch + 1] : scope->accessCount;
+        for (int i = starts[branch]; i < end; i++) {
+            const Access *access = &scope->accesses[i];
+            if (access->kind == ACCESS_CALL) {
+                branchError(scope, access->obj);
+                memFree(list);
+                return;
+            }
+            list[length++] = (BranchAccess){access, branch};
+        }
+    }
+    qsort(list, length, sizeof(BranchAccess), compareBranchAccesses);
+    for (int i = 0; i < length; ) {
+        const ObjectRecord *obj = list[i].access->obj;
+        bool isWritten = false;
+        int branches = 0;
+        int last = -1;
+        for (; i < length && list[i].access->obj == obj; i++) {
+            isWritten = isWritten || list[i].access->kind == ACCESS_WRITE;
+            if (list[i].branch != last) {
+                branches++;
+                last = list[i].branch;
+            }
+        }
+        if (isWritten && branches > 1) {
+            branchError(scope, obj);
+            break;
+        }
+    }
+    memFree(list);
+}
+
+void kindError(Scope *scope, ObjectRecord *obj) {
     if (obj->kind != OBJ_UNDEFINED) {
-        printf("%d: Incorrect kind!\n", getLine());
-        analysisError = true;
+        fprintf(scope->scanner->log, "%d: Incorrect kind!\n", getLine(scope->scanner));
+        scope->analysisError = true;
     }
 }
 
-void typeError(int type) {
+void typeError(Scope *scope, int type) {
     if (type != NO_NAME) {
-        printf("%d: Incorrect type!\n", getLine());
-        analysisError = true;
+        fprintf(scope->scanner->log, "%d: Incorrect type!\n", getLine(scope->scanner));
+        scope->analysisError = true;
         type = NO_NAME;
     }
 }
+
+void countError(Scope *scope) {
+    fprintf(scope->scanner->log, "%d: Incorrect number of expressions!\n", getLine(scope->scanner));
+    scope->analysisError = true;
+}
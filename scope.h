@@ -1,11 +1,35 @@
 #ifndef SCOPE_H
 #define SCOPE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "scanner.h"
+
 #define NO_NAME -1
+#define MAX_LEVEL 10
+
+/* What a statement does with an object: reads or writes a variable, an array, the input or the
+   output, or calls a procedure whose accesses are not known yet. via is the address of the
+   procedure through whose call the access is made, -1 for the statements themselves. */
+typedef enum {
+    ACCESS_READ,
+    ACCESS_WRITE,
+    ACCESS_CALL
+} AccessKind;
 
+typedef struct {
+    struct ObjectRecord_ *obj;
+    AccessKind kind;
+    int via;
+} Access;
+
+/* hash covers the record and all records before it in its block, 0 until scopeHash needs it.
+   A procedure's signature and line identify its compiled block for incremental compilation.
+   Once its block is compiled, the accesses of a procedure to objects outside it are known. */
 typedef struct ObjectRecord_ {
     int name;
     struct ObjectRecord_ *prev;
+    uint64_t hash;
     enum ObjectKind {
         OBJ_UNDEFINED,
         OBJ_CONST,
@@ -15,18 +39,58 @@ typedef struct ObjectRecord_ {
     } kind;
     union {
         struct {int type; int value;} constant;
-        struct {int type;} var;
-        struct {int count; int type;} arr;
+        struct {int type; int level; int displ;} var;
+        struct {int count; int type; int level; int displ; bool isPacked;} arr;
+        struct {
+            int level; int addr; int end; int line; uint64_t signature;
+            Access *accesses; int accessCount; bool isKnown;
+        } proc;
     } as;
 } ObjectRecord;
 
-extern bool analysisError;
+/* Block of procedure proc, NULL for the program, whose accesses are logged from accessStart */
+typedef struct {
+    ObjectRecord *prev;
+    int varLength;
+    ObjectRecord *proc;
+    int accessStart;
+} BlockRecord;
+
+/* Scope analysis state of one compilation. accesses logs what the statements of the open
+   blocks do, with input and output standing for the input and output. recordCount counts the
+   object records defined and maxLevel is the deepest block level opened. */
+typedef struct {
+    BlockRecord blockTable[MAX_LEVEL];
+    int blockLevel;
+    int maxLevel;
+    int overflowLevels;
+    bool analysisError;
+    Scanner *scanner;
+    Access *accesses;
+    int accessCount;
+    int accessCapacity;
+    ObjectRecord input;
+    ObjectRecord output;
+    int recordCount;
+} Scope;
 
-ObjectRecord *defineName(int name, int kind);
-ObjectRecord *findName(int name);
-void startBlock();
-void finishBlock();
-void kindError(ObjectRecord *obj);
-void typeError(int type);
+void initScope(Scope *scope, Scanner *scanner);
+void cleanScope(Scope *scope);
+ObjectRecord *defineName(Scope *scope, int name, int kind);
+ObjectRecord *findName(Scope *scope, int name);
+ObjectRecord *findNameAt(Scope *scope, int name, int level);
+int levelOf(const ObjectRecord *obj);
+uint64_t scopeHash(Scope *scope);
+uint64_t hashWords(uint64_t hash, const void *data, int length);
+int allocateVariable(Scope *scope, int words);
+void startBlock(Scope *scope, ObjectRecord *proc);
+void finishBlock(Scope *scope);
+void noteAccess(Scope *scope, ObjectRecord *obj, AccessKind kind, int via);
+void noteCall(Scope *scope, ObjectRecord *proc);
+void keepAccesses(Scope *scope, ObjectRecord *proc, int start);
+void checkBranches(Scope *scope, const int *starts, int count);
+void kindError(Scope *scope, ObjectRecord *obj);
+void typeError(Scope *scope, int type);
+void countError(Scope *scope);
 
 #endif
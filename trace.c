@@ -0,0 +1,125 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <string.h>
+#include "trace.h"
+
+#ifdef _WIN32
+#include <io.h>
+#define writeOut(fd, text, length) _write(fd, text, length)
+#else
+#include <unistd.h>
+#define writeOut(fd, text, length) write(fd, text, length)
+#endif
+
+#define LINE_LEN 128
+
+static Trace *watched;
+static const int fatalSignals[] = {SIGINT, SIGTERM, SIGSEGV, SIGFPE, SIGABRT};
+
+void initTrace(Trace *trace, const Code *code, int dumpCount) {
+    memset(trace->entries, 0, sizeof(trace->entries));
+    trace->next = 0;
+    trace->code = code;
+    if (dumpCount < 1 || dumpCount > TRACE_SIZE) {
+        dumpCount = TRACE_SIZE;
+    }
+    trace->dumpCount = dumpCount;
+}
+
+/* The dump runs inside signal handlers, so it formats its lines by hand instead of with stdio */
+static int putText(char *line, int length, const char *text) {
+    while (*text && length < LINE_LEN - 1) {
+        line[length++] = *text++;
+    }
+    return length;
+}
+
+static int putNumber(char *line, int length, int32_t number, int width) {
+    char digits[12];
+    int count = 0;
+    uint32_t value = number < 0 ? -(uint32_t)number : (uint32_t)number;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    if (number < 0) {
+        digits[count++] = '-';
+    }
+    while (width-- > count && length < LINE_LEN - 1) {
+        line[length++] = ' ';
+    }
+    while (count > 0 && length < LINE_LEN - 1) {
+        line[length++] = digits[--count];
+    }
+    return length;
+}
+
+/* Writes the last dumpCount entries, oldest first, as source line, address and disassembled
+   instruction with the stack pointer and top of stack before the instruction ran */
+void dumpTrace(const Trace *trace, int fd) {
+    const Code *code = trace->code;
+    uint32_t next = trace->next;
+    uint32_t count = next < (uint32_t)trace->dumpCount ? next : (uint32_t)trace->dumpCount;
+    char line[LINE_LEN];
+    int length = putText(line, 0, "Last ");
+    length = putNumber(line, length, count, 0);
+    length = putText(line, length, " instructions:\n");
+    writeOut(fd, line, length);
+    for (uint32_t i = next - count; i != next; i++) {
+        const TraceEntry *entry = &trace->entries[i & (TRACE_SIZE - 1)];
+        length = putNumber(line, 0, findLine(code, entry->pc), 6);
+        length = putText(line, length, ": ");
+        length = putNumber(line, length, entry->pc, 6);
+        length = putText(line, length, " ");
+        OpCode op = entry->pc >= 0 && entry->pc < code->length ? code->words[entry->pc] : 0;
+        length = putText(line, length, getOpName(op));
+        int operands = getOpLength(op);
+        for (int k = 1; k < operands && entry->pc + k < code->length; k++) {
+            length = putText(line, length, " ");
+            length = putNumber(line, length, code->words[entry->pc + k], 0);
+        }
+        length = putText(line, length, "  sp=");
+        length = putNumber(line, length, entry->sp, 0);
+        length = putText(line, length, " top=");
+        length = putNumber(line, length, entry->top, 0);
+        line[length++] = '\n';
+        writeOut(fd, line, length);
+    }
+}
+
+/* SIGUSR1 dumps the trace and lets the program go on; fatal signals dump it and then take their
+   default action */
+static void onSignal(int signo) {
+    if (watched) {
+        dumpTrace(watched, 2);
+    }
+#ifdef SIGUSR1
+    if (signo == SIGUSR1) {
+        signal(SIGUSR1, onSignal);
+        return;
+    }
+#endif
+    signal(signo, SIG_DFL);
+    raise(signo);
+}
+
+void watchSignals(Trace *trace) {
+    watched = trace;
+    for (size_t i = 0; i < sizeof(fatalSignals) / sizeof(fatalSignals[0]); i++) {
+        signal(fatalSignals[i], onSignal);
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, onSignal);
+#endif
+}
+
+void unwatchSignals() {
+    for (size_t i = 0; i < sizeof(fatalSignals) / sizeof(fatalSignals[0]); i++) {
+        signal(fatalSignals[i], SIG_DFL);
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, SIG_DFL);
+#endif
+    watched = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "code.h"
+
+#define TRACE_SIZE 4096 // Entries of the ring, a power of two
+
+/* The instruction itself is read back from the code when the entry is dumped */
+typedef struct {
+    int32_t pc;
+    int32_t sp;
+    int32_t top;
+} TraceEntry;
+
+/* The last TRACE_SIZE instructions executed by traceProgram. Only the running thread writes the
+   ring, and a dump from a signal handler reads it, so next is the only shared word. */
+typedef struct Trace {
+    TraceEntry entries[TRACE_SIZE];
+    volatile uint32_t next;
+    const Code *code;
+    int dumpCount;
+} Trace;
+
+static inline void traceStep(Trace *trace, int32_t pc, int32_t sp, int32_t top) {
+    uint32_t next = trace->next;
+    trace->entries[next & (TRACE_SIZE - 1)] = (TraceEntry){pc, sp, top};
+    trace->next = next + 1;
+}
+
+void initTrace(Trace *trace, const Code *code, int dumpCount);
+void dumpTrace(const Trace *trace, int fd);
+void watchSignals(Trace *trace);
+void unwatchSignals();
+
+#endif
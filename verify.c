@@ -0,0 +1,344 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include "verify.h"
+
+/* Block of the code from its PROC (PROG for the program) at addr to its ENDPROC at end, nested
+   in the block parent */
+typedef struct {
+    int addr;
+    int end;
+    int parent;
+} VerifyBlock;
+
+typedef struct {
+    const Code *code;
+    VerifyBlock *blocks;
+    int count;
+    int *blockOf;
+    int *branchOf;
+    int branchCount;
+    int *depths;
+    int *work;
+    const char *error;
+    int at;
+} Verifier;
+
+static bool fail(Verifier *v, int pc, const char *error) {
+    v->error = error;
+    v->at = pc;
+    return false;
+}
+
+/* Words an instruction takes from the stack and leaves on it */
+static void getStackEffect(const int32_t *words, int *pops, int *pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch ((OpCode)words[0]) {
+        case OP_ADD: case OP_AND: case OP_DIVIDE: case OP_EQUAL: case OP_GREATER: case OP_LESS:
+        case OP_MODULO: case OP_MULTIPLY: case OP_OR: case OP_SUBTRACT:
+        case OP_INDEX: case OP_INDEXBIT:
+            *pops = 2;
+            *pushes = 1;
+            break;
+        case OP_MINUS: case OP_NOT: case OP_VALUE: case OP_VALUEBIT:
+            *pops = 1;
+            *pushes = 1;
+            break;
+        case OP_CONSTANT: case OP_COUNTER: case OP_VARIABLE:
+            *pushes = 1;
+            break;
+        case OP_ARROW: case OP_JUMPFALSE: case OP_JUMPTRUE: case OP_READARRAY:
+            *pops = 1;
+            break;
+        case OP_COPY: case OP_FILL: case OP_FILLBITS:
+        case OP_JUMPEQUAL: case OP_JUMPGREATER: case OP_JUMPLESS: case OP_SPLIT:
+            *pops = 2;
+            break;
+        case OP_ASSIGN: case OP_ASSIGNBITS:
+            *pops = 2 * words[1];
+            break;
+        case OP_READ: case OP_WRITE:
+            *pops = words[1];
+            break;
+        default:
+            break;
+    }
+}
+
+/* Returns the block whose frame is levelDiff static links up from block, -1 if there is none */
+static int frameOf(const Verifier *v, int block, int levelDiff) {
+    while (levelDiff-- > 0 && block >= 0) {
+        block = v->blocks[block].parent;
+    }
+    return block;
+}
+
+/* Finds the blocks: the program block at 0 holding every PROC up to the ENDPROC it ends with */
+static bool findBlocks(Verifier *v) {
+    const Code *code = v->code;
+    int capacity = 0;
+    int *stack = malloc(code->length * sizeof(int));
+    int depth = 0;
+    bool ok = true;
+    int pc = 0;
+    while (ok && pc < code->length) {
+        OpCode op = code->words[pc];
+        if (op < 1 || op >= OP_COUNT) {
+            ok = fail(v, pc, "unknown instruction");
+        } else if (pc + getOpLength(op) > code->length) {
+            ok = fail(v, pc, "instruction runs past the end");
+        } else if ((op == OP_PROG) != (pc == 0) || (op == OP_PROC && depth == 0)) {
+            ok = fail(v, pc, "block outside the program");
+        } else if (op == OP_PROC || op == OP_PROG) {
+            if (v->count >= capacity) {
+                capacity = capacity ? 2 * capacity : 64;
+                v->blocks = realloc(v->blocks, capacity * sizeof(VerifyBlock));
+            }
+            v->blocks[v->count] = (VerifyBlock){pc, -1, depth > 0 ? stack[depth - 1] : -1};
+            stack[depth++] = v->count++;
+        } else if (depth == 0) {
+            ok = fail(v, pc, "instruction outside the program");
+        } else if ((op == OP_ENDPROC || op == OP_ENDPROG)
+                   && (op == OP_ENDPROG) != (code->words[v->blocks[stack[depth - 1]].addr] == OP_PROG)) {
+            ok = fail(v, pc, "block ends with the wrong instruction");
+        }
+        if (ok) {
+            v->blockOf[pc] = depth > 0 ? stack[depth - 1] : -1;
+            if (op == OP_ENDPROC || op == OP_ENDPROG) {
+                v->blocks[stack[--depth]].end = pc;
+            }
+            pc += getOpLength(op);
+        }
+    }
+    if (ok && (code->length == 0 || depth > 0)) {
+        ok = fail(v, code->length, "program does not end");
+    }
+    free(stack);
+    return ok;
+}
+
+static bool isInstruction(const Verifier *v, int pc) {
+    return pc >= 0 && pc < v->code->length && v->blockOf[pc] >= 0;
+}
+
+static int checkPar(Verifier *v, int block, int pc);
+
+/* Walks the statements of block from pc up to end, or up to the ENDBRANCH of branch if they
+   are in a branch, -1 otherwise. Their instructions belong to branch, which is the body of a
+   split loop if isSplit is set. Returns the address where the walk stopped, -1 if the par
+   statements and split loops are not nested right. */
+static int checkStatements(Verifier *v, int block, int pc, int end, int branch, bool isSplit) {
+    const int32_t *words = v->code->words;
+    while (pc < end) {
+        if (!isInstruction(v, pc) || v->blockOf[pc] != block) {
+            fail(v, pc, "block inside statements");
+            return -1;
+        }
+        v->branchOf[pc] = branch;
+        if (words[pc] == OP_PAR || words[pc] == OP_SPLIT) {
+            pc = checkPar(v, block, pc);
+            if (pc < 0) {
+                return -1;
+            }
+        } else if (words[pc] == OP_ENDBRANCH && branch >= 0) {
+            return pc;
+        } else if (words[pc] == OP_BRANCH || words[pc] == OP_ENDBRANCH) {
+            fail(v, pc, "branch outside a par statement");
+            return -1;
+        } else if (words[pc] == OP_COUNTER && !isSplit) {
+            fail(v, pc, "counter outside a split loop");
+            return -1;
+        } else {
+            pc += getOpLength(words[pc]);
+        }
+    }
+    if (branch >= 0) {
+        fail(v, pc, "branch does not end");
+        return -1;
+    }
+    return pc;
+}
+
+/* A par statement is PAR end followed by BRANCH next, statements and ENDBRANCH for every
+   branch, where next addresses the next branch and the last branch ends at end. A split loop
+   is SPLIT end followed by one branch, its body. Returns end, -1 if the statement is not
+   valid. */
+static int checkPar(Verifier *v, int block, int pc) {
+    const int32_t *words = v->code->words;
+    int end = words[pc + 1];
+    int branch = pc + 2;
+    bool isSplit = words[pc] == OP_SPLIT;
+    if (end <= branch || end > v->blocks[block].end) {
+        fail(v, pc, "par statement out of its block");
+        return -1;
+    } else if (isSplit && (words[branch] != OP_BRANCH || words[branch + 1] != end)) {
+        fail(v, pc, "split loop without its body");
+        return -1;
+    }
+    while (branch < end) {
+        if (!isInstruction(v, branch) || v->blockOf[branch] != block || words[branch] != OP_BRANCH || words[branch + 1] <= branch + 2
+                || words[branch + 1] > end) {
+            fail(v, branch, "par statement without its branch");
+            return -1;
+        }
+        int id = v->branchCount++;
+        v->branchOf[branch] = id;
+        int last = checkStatements(v, block, branch + 2, words[branch + 1], id, isSplit);
+        if (last < 0) {
+            return -1;
+        } else if (last != words[branch + 1] - 1) {
+            fail(v, branch, "branch ends before its next");
+            return -1;
+        }
+        branch = words[branch + 1];
+    }
+    return end;
+}
+
+/* Checks the operands of an instruction of the statements of block. The targets of PAR, SPLIT
+   and BRANCH are checked with their statement, other jumps stay in their branch. */
+static bool checkOperands(Verifier *v, int block, int pc) {
+    const int32_t *words = &v->code->words[pc];
+    const VerifyBlock *b = &v->blocks[block];
+    int stmt = v->code->words[b->addr + 2];
+    OpCode op = words[0];
+    if (op == OP_PAR || op == OP_SPLIT || op == OP_BRANCH) {
+        return true;
+    } else if (isJump(op)) {
+        int target = words[1];
+        if (!isInstruction(v, target) || v->blockOf[target] != block || target < stmt) {
+            return fail(v, pc, "jump out of its block");
+        } else if (v->branchOf[target] != v->branchOf[pc]) {
+            return fail(v, pc, "jump out of its branch");
+        }
+    } else if (op == OP_CALL) {
+        int callee = isInstruction(v, words[2]) && v->code->words[words[2]] == OP_PROC
+            ? v->blockOf[words[2]] : -1;
+        if (callee < 0 || words[1] < 0 || v->blocks[callee].parent != frameOf(v, block, words[1])) {
+            return fail(v, pc, "call of a procedure out of scope");
+        }
+    } else if (op == OP_VARIABLE) {
+        int frame = words[1] >= 0 ? frameOf(v, block, words[1]) : -1;
+        if (frame < 0 || words[2] < 3 || words[2] >= 3 + v->code->words[v->blocks[frame].addr + 1]) {
+            return fail(v, pc, "variable outside its frame");
+        }
+    } else if (op == OP_ASSIGN || op == OP_ASSIGNBITS || op == OP_READ || op == OP_WRITE
+               || op == OP_INDEX || op == OP_INDEXBIT) {
+        if (words[1] < 1 || words[1] > MAX_STORE) {
+            return fail(v, pc, "count out of range");
+        }
+    } else if (op == OP_COPY || op == OP_FILL || op == OP_FILLBITS || op == OP_READARRAY) {
+        if (words[1] < 0 || words[1] > MAX_STORE) {
+            return fail(v, pc, "count out of range");
+        }
+    }
+    return true;
+}
+
+/* Follows every path through the statements of a block, which must reach every instruction
+   with the same stack depth and leave the stack empty at its end and around the branches of par
+   statements and split loops. Returns the largest depth, -1 if the block is not valid. */
+static int measureBlock(Verifier *v, int block) {
+    const int32_t *words = v->code->words;
+    const VerifyBlock *b = &v->blocks[block];
+    int stmt = words[b->addr + 2];
+    int top = 0;
+    int maxDepth = 0;
+    v->depths[stmt] = 0;
+    v->work[top++] = stmt;
+    while (top > 0) {
+        int pc = v->work[--top];
+        OpCode op = words[pc];
+        int pops;
+        int pushes;
+        getStackEffect(&words[pc], &pops, &pushes);
+        if (v->depths[pc] < pops) {
+            fail(v, pc, "stack underflow");
+            return -1;
+        }
+        int depth = v->depths[pc] - pops + pushes;
+        if (depth > maxDepth) {
+            maxDepth = depth;
+        }
+        if ((op == OP_ENDPROC || op == OP_ENDPROG) && v->depths[pc] != 0) {
+            fail(v, pc, "stack not empty at the end of the block");
+            return -1;
+        } else if ((op == OP_PAR || op == OP_SPLIT || op == OP_BRANCH || op == OP_ENDBRANCH) && depth != 0) {
+            fail(v, pc, "stack not empty at a par statement");
+            return -1;
+        }
+        int next[2];
+        int count = 0;
+        if (op != OP_BAR && op != OP_FI && op != OP_ENDPROC && op != OP_ENDPROG) {
+            next[count++] = pc + getOpLength(op);
+        }
+        if (isJump(op)) {
+            next[count++] = words[pc + 1];
+        }
+        for (int i = 0; i < count; i++) {
+            if (v->depths[next[i]] < 0) {
+                v->depths[next[i]] = depth;
+                v->work[top++] = next[i];
+            } else if (v->depths[next[i]] != depth) {
+                fail(v, next[i], "stack depth differs between paths");
+                return -1;
+            }
+        }
+    }
+    return maxDepth;
+}
+
+/* Checks that code is safe to run: its blocks are nested, its jumps stay in their block, its
+   calls and variables are in scope and its operands are in range. Every path through a block
+   must see the same stack depth at each instruction. needs[addr] is then set for the block at
+   addr to the words its frame, its deepest stack and the links of a call take, and for a PAR or
+   SPLIT at addr to the words the deepest stack of its block takes. Returns NULL, or what is
+   wrong at *at. */
+const char *verifyCode(const Code *code, int32_t *needs, int *at) {
+    Verifier v = {.code = code, .blocks = NULL, .count = 0, .branchCount = 0, .error = NULL, .at = 0};
+    v.blockOf = malloc((code->length + 1) * sizeof(int));
+    v.branchOf = malloc((code->length + 1) * sizeof(int));
+    v.depths = malloc((code->length + 1) * sizeof(int));
+    v.work = malloc((code->length + 1) * sizeof(int));
+    for (int pc = 0; pc <= code->length; pc++) {
+        v.blockOf[pc] = -1;
+        v.branchOf[pc] = -1;
+        v.depths[pc] = -1;
+    }
+    bool ok = findBlocks(&v);
+    for (int i = 0; ok && i < v.count; i++) {
+        const VerifyBlock *b = &v.blocks[i];
+        int varLength = code->words[b->addr + 1];
+        int stmt = code->words[b->addr + 2];
+        if (varLength < 0 || varLength > MAX_STORE || !isInstruction(&v, stmt) || v.blockOf[stmt] != i || stmt <= b->addr) {
+            ok = fail(&v, b->addr, "block has no statements");
+        }
+        ok = ok && checkStatements(&v, i, stmt, b->end, -1, false) >= 0;
+        for (int pc = stmt; ok && pc < b->end; pc += getOpLength(code->words[pc])) {
+            ok = v.blockOf[pc] == i ? checkOperands(&v, i, pc) : fail(&v, pc, "block inside statements");
+        }
+        int maxDepth = ok ? measureBlock(&v, i) : -1;
+        ok = maxDepth >= 0;
+        if (ok) {
+            needs[b->addr] = varLength + maxDepth + 3;
+        }
+        for (int pc = stmt; ok && pc < b->end; pc += getOpLength(code->words[pc])) {
+            if (code->words[pc] == OP_PAR || code->words[pc] == OP_SPLIT) {
+                needs[pc] = maxDepth;
+            }
+        }
+    }
+    for (int pc = 0; ok && pc < code->length; pc += getOpLength(code->words[pc])) {
+        const VerifyBlock *b = &v.blocks[v.blockOf[pc]];
+        if (pc > b->addr && pc < code->words[b->addr + 2]) {
+            ok = fail(&v, pc, "instruction before the statements of its block");
+        }
+    }
+    free(v.blockOf);
+    free(v.branchOf);
+    free(v.depths);
+    free(v.work);
+    free(v.blocks);
+    *at = v.at;
+    return v.error;
+}
@@ -0,0 +1,9 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include "code.h"
+
+const char *verifyCode(const Code *code, int32_t *needs, int *at);
+
+#endif